@@ -23,6 +23,10 @@
 /*
  * This is the default path where the driver will look for the
  * default tracefiles. You can override it at runtime with the -t flag.
+ *
+ * The trace lists, heap limits, sparse page size, hash load and timing
+ * method below are defaults: mdriver's -k key=value, or MDRIVER_<KEY> in
+ * the environment, overrides them without rebuilding (see mdriver -h).
  */
 #define TRACEDIR "./traces/"
 #define OLD_TRACEDIR "./traces-old/"
@@ -106,6 +110,54 @@
 */
 #define MAXFILL     2048
 
+/*
+ * Give up on offline greedy placement (-o) after this many overlap
+ * checks; the online best-fit bound is always computed
+ */
+#define ORACLE_MAX_WORK (1L<<30)
+
+/*
+ * Cache line and page sizes (as log2 of bytes) assumed by the locality
+ * report (-L), and the number of points in each trace at which the
+ * cache lines and pages covered by the live blocks are counted
+ */
+#define LOCALITY_LINE_BITS 6
+#define LOCALITY_PAGE_BITS 12
+#define LOCALITY_PAGE (1 << LOCALITY_PAGE_BITS)
+#define LOCALITY_SAMPLES 64
+
+/*
+ * With -P, every TOUCH_PERIOD ops the driver reads the payloads of
+ * TOUCH_BLOCKS randomly chosen live blocks
+ */
+#define TOUCH_PERIOD 16
+#define TOUCH_BLOCKS 8
+
+/*
+ * With -F, the heap is evicted from the cache a line of FLUSH_LINE_BYTES
+ * at a time.  Where there is no clflush, a buffer of FLUSH_SWEEP_BYTES,
+ * which should be larger than the last level cache, is read instead.
+ */
+#define FLUSH_LINE_BYTES 64
+#define FLUSH_SWEEP_BYTES (1<<25)
+
+/*
+ * With -M, each thread count is timed this many times, and the fastest
+ * run is reported
+ */
+#define MT_RUNS 3
+
+/*
+ * With -M, every MT_FREE_SAMPLE'th free of each thread is timed
+ */
+#define MT_FREE_SAMPLE 4
+
+/*
+ * Size of the arena that the null allocator used to calibrate driver
+ * overhead (-C, -S) cycles through
+ */
+#define NULL_ARENA_BYTES (1<<20)
+
 /*
  * Alignment requirement in bytes (either 4, 8, or 16)
  */
@@ -113,15 +165,22 @@
 
 /*********** Parameters controlling dense memory version of heap ***********/
 /*
- * Maximum heap size in bytes
+ * Maximum heap size in bytes (heap_max).  This much address space is
+ * reserved per heap, but only the pages the heap grows into are committed.
  */
 #define MAX_DENSE_HEAP (100*(1<<20))  /* 100 MB */
 
 /*
- * Starting address of the memory allocated for the heap by mmap
+ * Starting address of the memory allocated for the heap by mmap (heap_start)
  */
 #define TRY_DENSE_HEAP_START (void *) 0x800000000
 
+/*
+ * Farthest past the end of a heap that a segment of it is placed, when
+ * the addresses just past the end are taken
+ */
+#define SEGMENT_MAX_GAP (1UL<<34)  /* 16 GB */
+
 
 /*********** Parameters controlling sparse memory version of heap ***********/
 
@@ -136,18 +195,19 @@
 #define SPARSE_HEAP_START (void *) 0x2130051300000000UL
 
 /*
- * Number of bytes in each page
+ * Number of bytes in each page, a power of two (sparse_page)
  */
 #define SPARSE_PAGE_SIZE (1<<10)
 
 /*
- * Maximum target load for hash table
+ * Maximum target load for hash table (hash_load)
  */
 #define HASH_LOAD 10.0
 
 
 /*****************************************************************************
- * Set exactly one of these USE_xxx constants to "1" to select a timing method
+ * Set exactly one of these USE_xxx constants to "1" to select the default
+ * timing method (timer=fcyc, itimer or gettod)
  *****************************************************************************/
 #define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
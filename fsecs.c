@@ -11,8 +11,26 @@
 
 static double Mhz;  /* estimated CPU clock frequency */
 
+/* timing method; config.h selects the default */
+static fsecs_method_t method =
+#if USE_FCYC
+    FSECS_FCYC;
+#elif USE_ITIMER
+    FSECS_ITIMER;
+#else
+    FSECS_GETTOD;
+#endif
+
 extern bool verbose; /* -v option in mdriver.c */
 
+/*
+ * set_fsecs_method - choose the timing method; call before init_fsecs
+ */
+void set_fsecs_method(fsecs_method_t m)
+{
+    method = m;
+}
+
 /*
  * init_fsecs - initialize the timing package
  */
@@ -20,24 +38,28 @@ void init_fsecs(void)
 {
     Mhz = 0; /* keep gcc -Wall happy */
 
-#if USE_FCYC
-    if (verbose)
-	printf("Measuring performance with a cycle counter.\n");
-
-    /* set key parameters for the fcyc package */
-    set_fcyc_maxsamples(20); 
-    set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
-    set_fcyc_epsilon(0.01);
-    set_fcyc_k(3);
-    Mhz = mhz(verbose);
-#elif USE_ITIMER
-    if (verbose)
-	printf("Measuring performance with the interval timer.\n");
-#elif USE_GETTOD
-    if (verbose)
-	printf("Measuring performance with gettimeofday().\n");
-#endif
+    switch (method) {
+    case FSECS_FCYC:
+	if (verbose)
+	    printf("Measuring performance with a cycle counter.\n");
+
+	/* set key parameters for the fcyc package */
+	set_fcyc_maxsamples(20); 
+	set_fcyc_clear_cache(1);
+	set_fcyc_compensate(1);
+	set_fcyc_epsilon(0.01);
+	set_fcyc_k(3);
+	Mhz = mhz(verbose);
+	break;
+    case FSECS_ITIMER:
+	if (verbose)
+	    printf("Measuring performance with the interval timer.\n");
+	break;
+    case FSECS_GETTOD:
+	if (verbose)
+	    printf("Measuring performance with gettimeofday().\n");
+	break;
+    }
 }
 
 /*
@@ -45,14 +67,15 @@ void init_fsecs(void)
  */
 double fsecs(fsecs_test_funct f, void *argp) 
 {
-#if USE_FCYC
-    double cycles = fcyc(f, argp);
-    return cycles/(Mhz*1e6);
-#elif USE_ITIMER
-    return ftimer_itimer(f, argp, 10);
-#elif USE_GETTOD
-    return ftimer_gettod(f, argp, 10);
-#endif 
+    switch (method) {
+    case FSECS_ITIMER:
+	return ftimer_itimer(f, argp, 10);
+    case FSECS_GETTOD:
+	return ftimer_gettod(f, argp, 10);
+    case FSECS_FCYC:
+    default:
+	return fcyc(f, argp)/(Mhz*1e6);
+    }
 }
 
 
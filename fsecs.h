@@ -1,4 +1,12 @@
 typedef void (*fsecs_test_funct)(void *);
 
+/* How fsecs measures time */
+typedef enum {
+    FSECS_FCYC,     /* cycle counter w/K-best scheme (x86 & Alpha only) */
+    FSECS_ITIMER,   /* interval timer (any Unix box) */
+    FSECS_GETTOD    /* gettimeofday (any Unix box) */
+} fsecs_method_t;
+
+void set_fsecs_method(fsecs_method_t method);
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
@@ -20,12 +20,17 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <ctype.h>
+#include <sys/resource.h>
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
 #include "stree.h"
+#include "oracle.h"
 
 /**********************
  * Constants and macros
@@ -36,8 +41,8 @@
 #define HDRLINES       4          /* number of header lines in a trace file */
 #define LINENUM(i) (i+HDRLINES+1) /* cnvt trace request nums to linenums (origin 1) */
 
-/* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
+/* Returns true if p is a-byte aligned */
+#define IS_ALIGNED(p, a)  ((((unsigned long)(p)) % (a)) == 0)
 
 /* weights */
 typedef enum { WNONE, WALL, WUTIL, WPERF } weight_t;
@@ -74,11 +79,27 @@ typedef struct {
     tree_t *lo_tree;
 } range_set_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/*
+ * Characterizes a single trace operation (allocator request).  A batch
+ * line in the trace becomes count consecutive ops on consecutive ids,
+ * the first of which is tagged ALLOC_BATCH or FREE_BATCH and the rest
+ * ALLOC or FREE, so that evaluators without a batch path can treat the
+ * batch as count single requests.
+ */
 typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
+    enum { ALLOC, FREE, REALLOC, ALLOC_BATCH, FREE_BATCH, MEMALIGN,
+           ARENA_NEW, ARENA_ALLOC, ARENA_RESET, ARENA_DESTROY,
+           CACHE_NEW, CACHE_ALLOC, CACHE_FREE, CACHE_DESTROY } type;
     long index;                         /* index for free() to use later */
-    size_t size;                        /* byte size of alloc/realloc request */
+    size_t size;                        /* byte size of request, or of the
+                                           block being freed */
+    int count;                          /* number of ops in a batch */
+    size_t align;                       /* alignment the payload needs */
+    int arena;                          /* arena of an arena request */
+    int dead;                           /* offset in arena_dead of the count
+                                           ids a reset or destroy releases */
+    int cache;                          /* object cache of a cache request */
+    int thread;                         /* thread that makes the request */
 } traceop_t;
 
 /* Holds the information for one trace file */
@@ -86,12 +107,18 @@ typedef struct {
     char filename[MAXLINE];
     size_t data_bytes;    /* Peak number of data bytes allocated during trace */
     int num_ids;          /* number of alloc/realloc ids */
-    int num_ops;          /* number of distinct requests */
+    int num_ops;          /* number of distinct requests, batches expanded */
     weight_t weight;      /* weight for this trace */
     traceop_t *ops;       /* array of requests */
     char **blocks;        /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes;  /* ... and a corresponding array of payload sizes */
     int *block_rand_base; /* index into random_data, if debug is on */
+    int num_arenas;       /* number of arena ids */
+    mm_arena_t **arenas;  /* the live arenas, by id */
+    int *arena_dead;      /* ids released by each arena reset or destroy */
+    int num_caches;       /* number of object cache ids */
+    mm_cache_t **caches;  /* the live object caches, by id */
+    int num_threads;      /* number of thread ids; 1 if the trace has none */
 } trace_t;
 
 /*
@@ -104,6 +131,34 @@ typedef struct {
     range_set_t *ranges;
 } speed_t;
 
+/* One of the threads of a threaded replay (-M) */
+typedef struct {
+    trace_t *trace;
+    int *ops;                  /* the ops this thread makes, in order */
+    int num_ops;
+    const int *dep;            /* op each op must wait for, or -1 */
+    char *done;                /* flags set as the ops are made */
+    pthread_barrier_t *start;  /* released once every thread is ready */
+    mm_heap_t *heap;           /* heap of its own (-X), or NULL */
+    mm_heap_t **block_heap;    /* heap each block came from (-X) */
+    double *free_ns;           /* times of every MT_FREE_SAMPLE'th free */
+    int num_free_ns;
+    double secs;               /* time from the start until its last op */
+    double wait_secs;          /* part of secs spent waiting on others */
+    bool failed;               /* set if a request failed */
+} mt_thread_t;
+
+/* Result of replaying a trace on some number of threads (-M) */
+typedef struct {
+    double secs;       /* time from the start until every thread is done */
+    double lat_mean;   /* mean over the threads of their time per op */
+    double lat_max;    /* time per op of the slowest thread */
+    double remote;     /* fraction of frees made by another thread */
+    size_t heap_bytes; /* size of the heaps after the run */
+    double free_mean;  /* mean time of the sampled frees, in ns */
+    double free_p99;   /* 99th percentile of the same */
+} mt_result_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -114,9 +169,40 @@ typedef struct {
     /* run-time stats defined for both libc and student */
     bool valid;        /* was the trace processed correctly by the allocator? */
     double secs;       /* number of secs needed to run the trace */
+    double raw_secs;    /* secs before the replay loop is subtracted (-S) */
+    double driver_secs; /* time taken by the replay loop itself (-C) */
+    double flush_secs;  /* time taken evicting the heap, left out (-F) */
 
     /* defined only for the student malloc package */
     double util;       /* space utilization for this trace (always 0 for libc) */
+    size_t heap_bytes; /* peak heap size in the utilization run */
+    size_t sbrk_calls; /* times the heap grew in the utilization run */
+    size_t overshoot;  /* bytes of the heap past any payload, at its end */
+    size_t realloc_moves;  /* reallocs that moved the block */
+    size_t realloc_copied; /* payload bytes those reallocs had to copy */
+
+    /* set by eval_oracle, if -o is given */
+    size_t peak_bytes;   /* high-water mark of live payload bytes */
+    size_t bound_bytes;  /* peak of aligned live bytes: unreachable bound */
+    size_t oracle_bytes; /* smallest heap found by offline placement */
+
+    /* set by eval_mm_locality, if -L is given */
+    double alloc_dist;   /* mean distance between consecutive allocations */
+    double alloc_near;   /* fraction of those within one page */
+    double reuse;        /* fraction of allocations at a freed address */
+    double reuse_dist;   /* mean ops between the free and the reuse */
+    double live_lines;   /* mean cache lines touched by the live set */
+    double live_pages;   /* mean pages touched by the live set */
+    double line_density; /* live bytes / bytes of the lines they touch */
+
+    /* set by eval_mm_threads, if -M is given */
+    mt_result_t *mt;     /* results with 1 .. mt_threads threads, or NULL */
+
+    /* minor page faults, set in run_tests */
+    long flt_init;       /* mapping the heap */
+    long flt_first;      /* correctness and utilization runs */
+    long flt_timed;      /* timing runs */
+    int timed_runs;      /* number of timing runs */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -155,6 +241,51 @@ int verbose = 1;  /* global flag for verbose output */
 static int errors = 0;  /* number of errs found when running student malloc */
 static bool onetime_flag = false;
 static bool tab_mode = false;     /* Print output as tab-separated fields */
+static bool oracle_flag = false;  /* Compare utilization to offline placement */
+static bool locality_flag = false; /* Report locality of returned addresses */
+static bool sized_flag = false;   /* Free with mm_free_sized */
+
+/* If nonzero, speed runs store to every touch_stride'th payload byte */
+static size_t touch_stride = 0;
+
+/* If nonzero, speed runs evict the heap from the cache every flush_period ops */
+static int flush_period = 0;
+static double flush_secs = 0;   /* time spent evicting in the last run */
+static volatile char touch_sink;  /* Keeps the payload reads alive */
+
+/* If nonzero, replay each trace on 1 .. mt_threads threads */
+static int mt_threads = 0;
+
+/*
+ * If nonnegative, threaded replays use a heap per thread, and this
+ * percentage of the frees is made by a thread other than the one that
+ * allocated the block (-X)
+ */
+static int mt_remote_pct = -1;
+static mem_region_t **mt_regions = NULL;  /* regions of the heaps */
+
+/* Cache small blocks per thread rather than per CPU (-R, MM_PERCPU) */
+static bool thread_cache_flag = false;
+
+/* If positive, threaded replays run mm.c's maintenance thread with this
+   percentage of a CPU (-B) */
+static int maint_pct = 0;
+
+/* Report how often and how far the heap was grown (-G) */
+static bool growth_flag = false;
+
+/* Report page faults, with the heap backed as given by -H */
+static bool pages_flag = false;
+static const char *pages_name = "base pages";
+static int speed_runs = 0;        /* calls of eval_mm_speed(_touch) */
+
+/* Measure (and optionally subtract) the cost of the replay loop itself */
+static bool calibrate_flag = false;
+static bool subtract_flag = false;
+
+/* Backing store for the null allocator used in calibration */
+static char null_arena[NULL_ARENA_BYTES];
+static size_t null_brk = 0;
 
 /* If set, use sparse memory emulation */
 static bool sparse_mode = (SPARSE_MODE==1);  
@@ -177,6 +308,10 @@ static char *default_giant_tracefiles[] = {
     DEFAULT_GIANT_TRACEFILES, NULL
 };
 
+/* The lists in use, unless replaced by the traces and giant_traces settings */
+static char **tracefile_list = default_tracefiles;
+static char **giant_tracefile_list = default_giant_tracefiles;
+
 /* Store names of trace files as array of char *'s */
 static int num_global_tracefiles = 0;
 static char **global_tracefiles = NULL;
@@ -196,10 +331,57 @@ static sum_stats_t global_mm_sum_stats;
 /* This function enables generating the set of trace files */
 static void add_tracefile(char *trace);
 
+/*
+ * Settings that override config.h at run time, given as -k key=value or
+ * in the environment as MDRIVER_<KEY>=value; -k wins
+ */
+typedef struct {
+    const char *key;
+    const char *help;
+    bool (*set)(const char *value);
+} setting_t;
+
+static bool set_heap_max(const char *value);
+static bool set_heap_start(const char *value);
+static bool set_sparse_page(const char *value);
+static bool set_hash_load(const char *value);
+static bool set_timer(const char *value);
+static bool set_tracedir(const char *value);
+static bool set_traces(const char *value);
+static bool set_giant_traces(const char *value);
+static bool parse_size(const char *value, size_t *bytes);
+static char **split_list(const char *value);
+static void apply_setting(const char *key, const char *value);
+static void apply_env_settings(void);
+
+/*
+ * mm.c's free list links are 32 bits, in 16-byte units, so they reach
+ * only 64 GB of heap unless it is built with WIDE_LINKS
+ */
+#ifdef WIDE_LINKS
+#define HEAP_MAX_LIMIT SIZE_MAX
+#define HEAP_MAX_HELP "Bytes reserved per heap (K, M, G suffixes)"
+#else
+#define HEAP_MAX_LIMIT ((size_t) 64 << 30)
+#define HEAP_MAX_HELP "Bytes reserved per heap (K, M, G suffixes), at most 64G"
+#endif
+
+static const setting_t settings[] = {
+    { "heap_max", HEAP_MAX_HELP, set_heap_max },
+    { "heap_start", "Address to map the heap at, or 0 for any", set_heap_start },
+    { "sparse_page", "Bytes per page of sparse emulation", set_sparse_page },
+    { "hash_load", "Pages per bucket of the sparse page table", set_hash_load },
+    { "timer", "Timing method: fcyc, itimer or gettod", set_timer },
+    { "tracedir", "Directory to find default traces", set_tracedir },
+    { "traces", "Comma separated default traces", set_traces },
+    { "giant_traces", "Comma separated default sparse traces", set_giant_traces },
+};
+#define NUM_SETTINGS (sizeof(settings) / sizeof(settings[0]))
+
 /* these functions manipulate range sets */
 static range_set_t *new_range_set();
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
-                      const trace_t *trace, int opnum, int index);
+                      size_t align, const trace_t *trace, int opnum, int index);
 static void remove_range(range_set_t *ranges, char *lo);
 static void free_range_set(range_set_t *ranges);
 
@@ -212,6 +394,9 @@ static void randomize_block(trace_t *trace, int index);
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
 static void reinit_trace(trace_t *trace);
+static void check_trace_id(const trace_t *trace, int index, int count);
+static void link_arenas(trace_t *trace);
+static void link_caches(trace_t *trace);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -221,11 +406,42 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats);
+static void raise_top(char **top, char *p, size_t size);
 static void eval_mm_speed(void *ptr);
+static void flush_heap(void);
+static void eval_mm_speed_touch(void *ptr);
+static void touch_live(int *live, int *slot, int *nlive, int index);
+static void touch_dead(int *live, int *slot, int *nlive, int index);
+
+/* Routines for measuring the cost of the driver's replay loop */
+static void *null_malloc(size_t size);
+static void *null_realloc(void *ptr, size_t size);
+static void null_free(void *ptr);
+static void eval_null_speed(void *ptr);
+
+/* Offline bound on the heap size each trace requires */
+static void eval_oracle(trace_t *trace, stats_t *stats);
+
+/* Locality of the addresses mm_malloc returns */
+static void eval_mm_locality(trace_t *trace, stats_t *stats);
+
+/* Replay the trace on threads (-M) */
+static void eval_mm_threads(trace_t *trace, stats_t *stats);
+static int cmp_double(const void *a, const void *b);
+static void *mt_replay(void *ptr);
+static double timespec_secs(const struct timespec *start,
+                            const struct timespec *end);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats, sum_stats_t *sumstats);
+static void printoracle(int n, stats_t *stats);
+static void printlocality(int n, stats_t *stats);
+static void printoverhead(int n, stats_t *stats);
+static void printscaling(int n, stats_t *stats);
+static void printfaults(int n, stats_t *stats);
+static void printgrowth(int n, stats_t *stats);
+static long minor_faults(void);
 static void usage(char *prog);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -255,7 +471,9 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
+        mm_stats[i].flt_init = -minor_faults();
         mem_init(sparse_mode);
+        mm_stats[i].flt_init += minor_faults();
         range_set_t *ranges = new_range_set();
 
 
@@ -272,6 +490,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         } else {
             if (verbose > 1)
                 printf("Checking mm_malloc for correctness, ");
+            mm_stats[i].flt_first = -minor_faults();
             mm_stats[i].valid = eval_mm_valid(trace, ranges);
 
             if (onetime_flag) {
@@ -282,12 +501,45 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
+            mm_stats[i].util = eval_mm_util(trace, i, &mm_stats[i]);
+            mm_stats[i].heap_bytes = mem_heap_peak();
+            mm_stats[i].sbrk_calls = mem_sbrk_calls();
+            mm_stats[i].flt_first += minor_faults();
+            if (oracle_flag)
+                eval_oracle(trace, &mm_stats[i]);
+            if (locality_flag)
+                eval_mm_locality(trace, &mm_stats[i]);
+            if (mt_threads && !sparse_mode)
+                eval_mm_threads(trace, &mm_stats[i]);
             speed_params->trace = trace;
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = sparse_mode ? 1.0 : fsecs(eval_mm_speed, speed_params);
+            mm_stats[i].flt_timed = -minor_faults();
+            speed_runs = 0;
+            mm_stats[i].secs = sparse_mode ? 1.0 :
+                fsecs(touch_stride ? eval_mm_speed_touch : eval_mm_speed,
+                      speed_params);
+            mm_stats[i].flt_timed += minor_faults();
+            mm_stats[i].timed_runs = speed_runs;
+            if (flush_period && !sparse_mode) {
+                /* The evictions of the last run stand in for those of
+                 * the run fsecs picked */
+                double secs = mm_stats[i].secs - flush_secs;
+                mm_stats[i].flush_secs = flush_secs;
+                mm_stats[i].secs = (secs > 0.01 * mm_stats[i].secs) ?
+                    secs : 0.01 * mm_stats[i].secs;
+            }
+            mm_stats[i].raw_secs = mm_stats[i].secs;
+            if (calibrate_flag && !sparse_mode) {
+                mm_stats[i].driver_secs = fsecs(eval_null_speed, speed_params);
+                if (subtract_flag) {
+                    /* Never let a noisy calibration drive time to zero */
+                    double secs = mm_stats[i].secs - mm_stats[i].driver_secs;
+                    mm_stats[i].secs = (secs > 0.01 * mm_stats[i].secs) ?
+                        secs : 0.01 * mm_stats[i].secs;
+                }
+            }
         }
 
 #if 0
@@ -332,10 +584,12 @@ int main(int argc, char **argv)
     setbuf(stdout, 0);
     setbuf(stderr, 0);
 
+    apply_env_settings();
+
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDT")) != EOF) {
+    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hpOVAlDToLP:CSzF:M:X:RB:H:k:G")) != EOF) {
         switch (c) {
 
         case 'A': /* Hidden Autolab driver argument */
@@ -392,6 +646,92 @@ int main(int argc, char **argv)
             tab_mode = true;
             break;
 
+        case 'o': /* Compare utilization to an offline oracle */
+            oracle_flag = true;
+            break;
+
+        case 'L': /* Report placement locality */
+            locality_flag = true;
+            break;
+
+        case 'C': /* Measure the cost of the replay loop */
+            calibrate_flag = true;
+            break;
+
+        case 'S': /* ... and subtract it from the measured time */
+            calibrate_flag = true;
+            subtract_flag = true;
+            break;
+
+        case 'P': { /* Touch payloads while measuring throughput */
+            char *end;
+            long stride = strtol(optarg, &end, 0);
+            if (end == optarg || *end != '\0' || stride <= 0)
+                app_error("-P requires a positive stride\n");
+            touch_stride = stride;
+            break;
+        }
+
+        case 'z': /* Pass the block size back when freeing */
+            sized_flag = true;
+            break;
+
+        case 'F': /* Time with a cold heap */
+            flush_period = atoi(optarg);
+            if (flush_period <= 0)
+                app_error("-F requires a positive period\n");
+            break;
+
+        case 'M': /* Replay on up to n threads */
+            mt_threads = atoi(optarg);
+            if (mt_threads <= 0)
+                app_error("-M requires a positive number of threads\n");
+            break;
+
+        case 'H': /* Heap page backing, and report page faults */
+            pages_flag = true;
+            if (strcmp(optarg, "none") == 0) {
+                mem_set_pages(MEM_PAGES_DEFAULT);
+            } else if (strcmp(optarg, "thp") == 0) {
+                mem_set_pages(MEM_PAGES_HUGE);
+                pages_name = "transparent huge pages";
+            } else if (strcmp(optarg, "populate") == 0) {
+                mem_set_pages(MEM_PAGES_POPULATE);
+                pages_name = "prefaulted base pages";
+            } else {
+                app_error("-H requires none, thp or populate\n");
+            }
+            break;
+
+        case 'G': /* Report heap growth */
+            growth_flag = true;
+            break;
+
+        case 'k': { /* Override a config.h setting */
+            char *value = strchr(optarg, '=');
+            if (value == NULL)
+                app_error("-k requires key=value\n");
+            *value++ = '\0';
+            apply_setting(optarg, value);
+            break;
+        }
+
+        case 'B': /* Maintenance thread with pct% of a CPU */
+            maint_pct = atoi(optarg);
+            if (maint_pct <= 0 || maint_pct > 100)
+                app_error("-B requires a percentage from 1 to 100\n");
+            break;
+
+        case 'R': /* Per-thread caches instead of per-CPU */
+            thread_cache_flag = true;
+            break;
+
+        case 'X': /* Heap per thread, with some frees made remotely */
+            mt_remote_pct = atoi(optarg);
+            if (mt_remote_pct < 0 || mt_remote_pct > 100)
+                app_error("-X requires a percentage from 0 to 100\n");
+            break;
+
         case 'h': /* Print this message */
             usage(argv[0]);
             exit(0);
@@ -402,14 +742,31 @@ int main(int argc, char **argv)
         }
     }
 
+#ifndef MM_THREADSAFE
+    /* Threads can only share the default heap if it takes a lock */
+    if (mt_threads > 1 && mt_remote_pct < 0) {
+        fprintf(stderr, "mm.c is not built thread safe; "
+                "use mdriver-mt or -X to replay on more than one thread\n");
+        mt_threads = 1;
+    }
+    if (maint_pct > 0)
+        app_error("-B needs the maintenance thread of mdriver-mt\n");
+#endif
+#ifdef MM_PERCPU
+    if (mm_set_cpu_caches(!thread_cache_flag))
+        printf("Caching small blocks per CPU (rseq)\n");
+    else
+        printf("Caching small blocks per thread\n");
+#endif
+
     if (num_global_tracefiles == 0) {
         int i;
         if (sparse_mode & !run_libc) {
-            for (i = 0; default_giant_tracefiles[i]; i++)
-                add_tracefile(default_giant_tracefiles[i]);
+            for (i = 0; giant_tracefile_list[i]; i++)
+                add_tracefile(giant_tracefile_list[i]);
         }
-        for (i = 0; default_tracefiles[i]; i++)
-            add_tracefile(default_tracefiles[i]);
+        for (i = 0; tracefile_list[i]; i++)
+            add_tracefile(tracefile_list[i]);
     }
 
     if (debug_mode != DBG_NONE) {
@@ -490,6 +847,30 @@ int main(int argc, char **argv)
             printf("\nResults for mm malloc:\n");
             printresults(num_global_tracefiles, mm_stats, &global_mm_sum_stats);
             printf("\n");
+            if (oracle_flag) {
+                printoracle(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (locality_flag) {
+                printlocality(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (calibrate_flag && !sparse_mode) {
+                printoverhead(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (mt_threads && !sparse_mode) {
+                printscaling(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (pages_flag) {
+                printfaults(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
+            if (growth_flag) {
+                printgrowth(num_global_tracefiles, mm_stats);
+                printf("\n");
+            }
         }
     }
 
@@ -642,6 +1023,159 @@ static void add_tracefile(char *trace) {
 }
 
 
+/*****************************************************************
+ * The following routines override the config.h settings listed in
+ * settings[], from -k key=value and MDRIVER_<KEY> environment variables
+ ****************************************************************/
+
+/*
+ * apply_setting - Set key to value, or exit if either is bad
+ */
+static void apply_setting(const char *key, const char *value) {
+    size_t i;
+
+    for (i = 0; i < NUM_SETTINGS; i++) {
+        if (strcmp(key, settings[i].key) == 0) {
+            if (!settings[i].set(value))
+                app_error("Bad value '%s' for %s: %s\n", value, key,
+                          settings[i].help);
+            return;
+        }
+    }
+    app_error("Unknown setting '%s'; run with -h for the list\n", key);
+}
+
+/*
+ * apply_env_settings - Apply each setting given as MDRIVER_<KEY>
+ */
+static void apply_env_settings(void) {
+    size_t i, j;
+    char name[MAXLINE];
+
+    for (i = 0; i < NUM_SETTINGS; i++) {
+        const char *key = settings[i].key;
+        const char *value;
+        strcpy(name, "MDRIVER_");
+        for (j = 0; key[j]; j++)
+            name[8 + j] = toupper((unsigned char) key[j]);
+        name[8 + j] = '\0';
+        if ((value = getenv(name)) != NULL)
+            apply_setting(key, value);
+    }
+}
+
+/*
+ * parse_size - Read a byte count with an optional K, M or G suffix.
+ *   Negative counts and counts too big for a size_t are rejected.
+ */
+static bool parse_size(const char *value, size_t *bytes) {
+    char *end;
+    unsigned long long n;
+    int shift = 0;
+
+    while (isspace((unsigned char) *value))
+        value++;
+    if (*value == '-')
+        return false;
+    errno = 0;
+    n = strtoull(value, &end, 0);
+    if (errno != 0 || end == value)
+        return false;
+    switch (toupper((unsigned char) *end)) {
+    case 'G':
+        shift += 10;
+        /* fall through */
+    case 'M':
+        shift += 10;
+        /* fall through */
+    case 'K':
+        shift += 10;
+        end++;
+        break;
+    }
+    if (*end != '\0' || n > (SIZE_MAX >> shift))
+        return false;
+    *bytes = (size_t) n << shift;
+    return true;
+}
+
+/*
+ * split_list - Make a null-terminated list of the comma separated names
+ *              in value
+ */
+static char **split_list(const char *value) {
+    char *names = strdup(value);
+    char **list = malloc((strlen(value) / 2 + 2) * sizeof(char *));
+    char *name;
+    int n = 0;
+
+    for (name = strtok(names, ","); name != NULL; name = strtok(NULL, ","))
+        list[n++] = name;
+    list[n] = NULL;
+    return list;
+}
+
+static bool set_heap_max(const char *value) {
+    size_t bytes;
+    return parse_size(value, &bytes) && bytes <= HEAP_MAX_LIMIT &&
+        mem_set_heap_max(bytes);
+}
+
+static bool set_heap_start(const char *value) {
+    char *end;
+    unsigned long long addr;
+
+    errno = 0;
+    addr = strtoull(value, &end, 0);
+    if (errno != 0 || end == value || *end != '\0')
+        return false;
+    mem_set_heap_start((void *) (uintptr_t) addr);
+    return true;
+}
+
+static bool set_sparse_page(const char *value) {
+    size_t bytes;
+    return parse_size(value, &bytes) && mem_set_sparse_page(bytes);
+}
+
+static bool set_hash_load(const char *value) {
+    char *end;
+    double load = strtod(value, &end);
+    return end != value && *end == '\0' && mem_set_hash_load(load);
+}
+
+static bool set_timer(const char *value) {
+    if (strcmp(value, "fcyc") == 0)
+        set_fsecs_method(FSECS_FCYC);
+    else if (strcmp(value, "itimer") == 0)
+        set_fsecs_method(FSECS_ITIMER);
+    else if (strcmp(value, "gettod") == 0)
+        set_fsecs_method(FSECS_GETTOD);
+    else
+        return false;
+    return true;
+}
+
+static bool set_tracedir(const char *value) {
+    if (*value == '\0' || strlen(value) + 2 > MAXLINE)
+        return false;
+    strcpy(tracedir, value);
+    if (tracedir[strlen(tracedir)-1] != '/')
+        strcat(tracedir, "/"); /* path always ends with "/" */
+    return true;
+}
+
+static bool set_traces(const char *value) {
+    tracefile_list = split_list(value);
+    return tracefile_list[0] != NULL;
+}
+
+static bool set_giant_traces(const char *value) {
+    giant_tracefile_list = split_list(value);
+    return true;
+}
+
+
 
 /*****************************************************************
  * The following routines manipulate the range list, which keeps
@@ -662,27 +1196,27 @@ static range_set_t *new_range_set() {
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
- *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     size bytes at addr lo, aligned to align bytes. After checking the
+ *     block for correctness, we create a range struct for this block and
+ *     add it to the range list.
  */
 static bool add_range(range_set_t *ranges, char *lo, size_t size,
-                      const trace_t *trace, int opnum, int index) {
+                      size_t align, const trace_t *trace, int opnum, int index) {
     char *hi = lo + size - 1;
 
     assert(size > 0);
 
-    /* Payload addresses must be ALIGNMENT-byte aligned */
-    if (!IS_ALIGNED(lo)) {
+    /* Payload addresses must be aligned as requested */
+    if (!IS_ALIGNED(lo, align)) {
         malloc_error(trace, opnum,
-                     "Payload address (%p) not aligned to %d bytes", lo, ALIGNMENT);
+                     "Payload address (%p) not aligned to %zu bytes", lo, align);
         return false;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap or a segment */
+    if (!mem_heap_contains(lo, size)) {
         malloc_error(trace, opnum,
-                     "Payload (%p:%p) lies outside heap (%p:%p)",
+                     "Payload (%p:%p) lies outside heap (%p:%p) and its segments",
                      lo, hi, mem_heap_lo(), mem_heap_hi());
         return false;
     }
@@ -858,9 +1392,11 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     trace_t *trace;
     char type[MAXLINE];
     int index;
-    size_t size;
+    int count, k, arena, cache;
+    size_t size, align;
     int max_index = 0;
     int op_index;
+    int thread = 0;
     int ignore = 0;
 
     if (verbose > 1)
@@ -908,29 +1444,154 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         unix_error("malloc 5 failed in read_trace");
 
 
+    trace->num_arenas = 0;
+    trace->num_caches = 0;
+    trace->num_threads = 1;
+
     /* read every request line in the trace file */
     index = 0;
     op_index = 0;
     while (fscanf(tracefile, "%s", type) != EOF) {
+        trace->ops[op_index].align = ALIGNMENT;
+        trace->ops[op_index].thread = thread;
         switch(type[0]) {
+        case '@':
+            /* @<thread> in front of a request: it and the requests
+             * that follow, up to the next @, are made by that thread */
+            thread = atoi(type + 1);
+            if (thread < 0)
+                app_error("Bad thread %d in tracefile %s\n",
+                          thread, trace->filename);
+            trace->num_threads = (thread >= trace->num_threads) ?
+                thread + 1 : trace->num_threads;
+            continue;
         case 'a':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
+            check_trace_id(trace, index, 1);
             trace->ops[op_index].type = ALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->block_sizes[index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'r':
             ignore += fscanf(tracefile, "%u %lu", &index, &size);
+            check_trace_id(trace, index, 1);
             trace->ops[op_index].type = REALLOC;
             trace->ops[op_index].index = index;
             trace->ops[op_index].size = size;
+            trace->block_sizes[index] = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'm':
+            ignore += fscanf(tracefile, "%u %lu %lu", &index, &size, &align);
+            check_trace_id(trace, index, 1);
+            if (align == 0 || (align & (align - 1)) != 0 || align % sizeof(void *))
+                app_error("Bad alignment %lu in tracefile %s\n",
+                          align, trace->filename);
+            trace->ops[op_index].type = MEMALIGN;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].align = align;
+            trace->block_sizes[index] = size;
             max_index = (index > max_index) ? index : max_index;
             break;
         case 'f':
             ignore += fscanf(tracefile, "%u", &index);
+            if (index >= 0)
+                check_trace_id(trace, index, 1);
             trace->ops[op_index].type = FREE;
             trace->ops[op_index].index = index;
+            trace->ops[op_index].size =
+                (index >= 0) ? trace->block_sizes[index] : 0;
+            break;
+        case 'N':
+        case 'R':
+        case 'D':
+            ignore += fscanf(tracefile, "%d", &arena);
+            if (arena < 0)
+                app_error("Bad arena %d in tracefile %s\n",
+                          arena, trace->filename);
+            trace->ops[op_index].type = (type[0] == 'N') ? ARENA_NEW :
+                (type[0] == 'R') ? ARENA_RESET : ARENA_DESTROY;
+            trace->ops[op_index].index = -1;
+            trace->ops[op_index].arena = arena;
+            trace->num_arenas = (arena >= trace->num_arenas) ?
+                arena + 1 : trace->num_arenas;
+            break;
+        case 'b':
+            ignore += fscanf(tracefile, "%d %u %lu", &arena, &index, &size);
+            check_trace_id(trace, index, 1);
+            trace->ops[op_index].type = ARENA_ALLOC;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].arena = arena;
+            trace->block_sizes[index] = size;
+            max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'K':
+            ignore += fscanf(tracefile, "%d %lu %lu", &cache, &size, &align);
+            if (align == 0)
+                align = ALIGNMENT;
+            if (cache < 0 || size == 0 ||
+                (align & (align - 1)) != 0 || align % sizeof(void *))
+                app_error("Bad cache %d in tracefile %s\n",
+                          cache, trace->filename);
+            trace->ops[op_index].type = CACHE_NEW;
+            trace->ops[op_index].index = -1;
+            trace->ops[op_index].size = size;
+            trace->ops[op_index].align = align;
+            trace->ops[op_index].cache = cache;
+            trace->num_caches = (cache >= trace->num_caches) ?
+                cache + 1 : trace->num_caches;
+            break;
+        case 'X':
+            ignore += fscanf(tracefile, "%d", &cache);
+            trace->ops[op_index].type = CACHE_DESTROY;
+            trace->ops[op_index].index = -1;
+            trace->ops[op_index].cache = cache;
+            break;
+        case 'k':
+        case 'x':
+            /* link_caches fills in the size and alignment */
+            ignore += fscanf(tracefile, "%d %u", &cache, &index);
+            check_trace_id(trace, index, 1);
+            trace->ops[op_index].type =
+                (type[0] == 'k') ? CACHE_ALLOC : CACHE_FREE;
+            trace->ops[op_index].index = index;
+            trace->ops[op_index].size = 0;
+            trace->ops[op_index].cache = cache;
+            if (type[0] == 'k')
+                max_index = (index > max_index) ? index : max_index;
+            break;
+        case 'A':
+        case 'F':
+            if (type[0] == 'A') {
+                ignore += fscanf(tracefile, "%u %u %lu", &index, &count, &size);
+            } else {
+                ignore += fscanf(tracefile, "%u %u", &index, &count);
+                size = 0;
+            }
+            if (count <= 0 || op_index + count > trace->num_ops)
+                app_error("Bad batch of %d requests in tracefile %s\n",
+                          count, trace->filename);
+            check_trace_id(trace, index, count);
+            for (k = 0; k < count; k++) {
+                trace->ops[op_index + k].type = (type[0] == 'A') ? ALLOC : FREE;
+                trace->ops[op_index + k].align = ALIGNMENT;
+                trace->ops[op_index + k].thread = thread;
+                trace->ops[op_index + k].index = index + k;
+                if (type[0] == 'A')
+                    trace->block_sizes[index + k] = size;
+                trace->ops[op_index + k].size = trace->block_sizes[index + k];
+            }
+            trace->ops[op_index].type =
+                (type[0] == 'A') ? ALLOC_BATCH : FREE_BATCH;
+            trace->ops[op_index].count = count;
+            if (type[0] == 'A')
+                max_index = (index + count - 1 > max_index) ?
+                    index + count - 1 : max_index;
+            op_index += count - 1;
             break;
         default:
             app_error("Bogus type character (%c) in tracefile %s\n",
@@ -940,6 +1601,9 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
         if (op_index == trace->num_ops) break;
     }
     fclose(tracefile);
+    link_arenas(trace);
+    link_caches(trace);
+    reinit_trace(trace);
     assert(max_index == trace->num_ids - 1);
     assert(trace->num_ops == op_index);
 
@@ -951,6 +1615,185 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     return trace;
 }
 
+/*
+ * link_arenas - Check the arena requests of a trace that has been read,
+ *     and list the ids that each reset or destroy releases: the blocks
+ *     allocated from the arena since it was created or last reset.
+ *     A block of an arena may not be freed or reallocated with f, F or r.
+ *     The trace lines are
+ *         N <arena>              create arena
+ *         b <arena> <id> <size>  allocate block id from arena
+ *         R <arena>              release every block of arena
+ *         D <arena>              release them and destroy arena
+ */
+static void link_arenas(trace_t *trace)
+{
+    int i, id, ndead = 0;
+    int *last;      /* last block allocated from each arena, or -1 */
+    int *prev;      /* block allocated from the same arena before each one */
+    int *owner;     /* arena each live arena block came from, or -1 */
+    bool *open;     /* whether each arena exists */
+
+    if ((trace->arenas = calloc(trace->num_arenas + 1,
+                                sizeof(*trace->arenas))) == NULL ||
+        (trace->arena_dead = malloc((trace->num_ops + 1) * sizeof(int))) == NULL ||
+        (last = malloc((trace->num_arenas + 1) * sizeof(int))) == NULL ||
+        (prev = malloc((trace->num_ids + 1) * sizeof(int))) == NULL ||
+        (owner = malloc((trace->num_ids + 1) * sizeof(int))) == NULL ||
+        (open = calloc(trace->num_arenas + 1, sizeof(bool))) == NULL)
+        unix_error("malloc failed in link_arenas");
+    for (i = 0; i < trace->num_ids; i++)
+        owner[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        switch (op->type) {
+        case FREE:
+        case FREE_BATCH:
+        case REALLOC:
+            if (op->index >= 0 && owner[op->index] >= 0)
+                app_error("Block %ld of arena %d freed with f, F or r "
+                          "in tracefile %s\n",
+                          op->index, owner[op->index], trace->filename);
+            break;
+
+        case ARENA_NEW:
+            if (open[op->arena])
+                app_error("Arena %d created twice in tracefile %s\n",
+                          op->arena, trace->filename);
+            open[op->arena] = true;
+            last[op->arena] = -1;
+            break;
+
+        case ARENA_ALLOC:
+            if (op->arena < 0 || op->arena >= trace->num_arenas ||
+                !open[op->arena])
+                app_error("Arena %d used before created in tracefile %s\n",
+                          op->arena, trace->filename);
+            prev[op->index] = last[op->arena];
+            last[op->arena] = op->index;
+            owner[op->index] = op->arena;
+            break;
+
+        case ARENA_RESET:
+        case ARENA_DESTROY:
+            if (!open[op->arena])
+                app_error("Arena %d used before created in tracefile %s\n",
+                          op->arena, trace->filename);
+            op->dead = ndead;
+            for (id = last[op->arena]; id >= 0; id = prev[id]) {
+                trace->arena_dead[ndead++] = id;
+                owner[id] = -1;
+            }
+            op->count = ndead - op->dead;
+            last[op->arena] = -1;
+            open[op->arena] = (op->type == ARENA_RESET);
+            break;
+
+        default:
+            break;
+        }
+    }
+    free(last);
+    free(prev);
+    free(owner);
+    free(open);
+}
+
+/*
+ * link_caches - Check the object cache requests of a trace that has been
+ *     read, and give each object the size and alignment of its cache.
+ *     An object must be freed with x to the cache it came from, never
+ *     with f, F or r, and a cache must have no live objects when it is
+ *     destroyed.  The trace lines are
+ *         K <cache> <size> <align>  create cache of size-byte objects
+ *         k <cache> <id>            allocate object id from cache
+ *         x <cache> <id>            free object id to cache
+ *         X <cache>                 destroy cache
+ */
+static void link_caches(trace_t *trace)
+{
+    int i;
+    int *owner;     /* cache each live object came from, or -1 */
+    int *live;      /* number of live objects of each cache */
+    traceop_t **def;    /* the op that created each cache, if it exists */
+
+    if ((trace->caches = calloc(trace->num_caches + 1,
+                                sizeof(*trace->caches))) == NULL ||
+        (owner = malloc((trace->num_ids + 1) * sizeof(int))) == NULL ||
+        (live = calloc(trace->num_caches + 1, sizeof(int))) == NULL ||
+        (def = calloc(trace->num_caches + 1, sizeof(*def))) == NULL)
+        unix_error("malloc failed in link_caches");
+    for (i = 0; i < trace->num_ids; i++)
+        owner[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        if ((op->type == FREE || op->type == FREE_BATCH ||
+             op->type == REALLOC) && op->index >= 0 && owner[op->index] >= 0)
+            app_error("Object %ld of cache %d freed with f, F or r "
+                      "in tracefile %s\n",
+                      op->index, owner[op->index], trace->filename);
+        if (op->type < CACHE_NEW)
+            continue;
+        if (op->type != CACHE_NEW &&
+            (op->cache < 0 || op->cache >= trace->num_caches ||
+             def[op->cache] == NULL))
+            app_error("Cache %d used before created in tracefile %s\n",
+                      op->cache, trace->filename);
+        switch (op->type) {
+        case CACHE_NEW:
+            if (def[op->cache] != NULL)
+                app_error("Cache %d created twice in tracefile %s\n",
+                          op->cache, trace->filename);
+            def[op->cache] = op;
+            break;
+
+        case CACHE_ALLOC:
+            op->size = def[op->cache]->size;
+            op->align = def[op->cache]->align;
+            owner[op->index] = op->cache;
+            live[op->cache]++;
+            break;
+
+        case CACHE_FREE:
+            if (owner[op->index] != op->cache)
+                app_error("Object %ld freed to cache %d in tracefile %s\n",
+                          op->index, op->cache, trace->filename);
+            op->size = def[op->cache]->size;
+            op->align = def[op->cache]->align;
+            owner[op->index] = -1;
+            live[op->cache]--;
+            break;
+
+        case CACHE_DESTROY:
+            if (live[op->cache] != 0)
+                app_error("Cache %d destroyed with %d live objects "
+                          "in tracefile %s\n",
+                          op->cache, live[op->cache], trace->filename);
+            def[op->cache] = NULL;
+            break;
+
+        default:
+            break;
+        }
+    }
+    free(owner);
+    free(live);
+    free(def);
+}
+
+/*
+ * check_trace_id - make sure that ids index..index+count-1 were declared
+ *     in the header of the trace being read
+ */
+static void check_trace_id(const trace_t *trace, int index, int count)
+{
+    if (index < 0 || index + count > trace->num_ids)
+        app_error("Bad id %d in tracefile %s\n",
+                  index + count - 1, trace->filename);
+}
+
 /*
  * reinit_trace - get the trace ready for another run.
  */
@@ -958,6 +1801,8 @@ static void reinit_trace(trace_t *trace)
 {
     memset(trace->blocks, 0, trace->num_ids * sizeof(*trace->blocks));
     memset(trace->block_sizes, 0, trace->num_ids * sizeof(*trace->block_sizes));
+    memset(trace->arenas, 0, trace->num_arenas * sizeof(*trace->arenas));
+    memset(trace->caches, 0, trace->num_caches * sizeof(*trace->caches));
     /* block_rand_base is unused if size is zero */
 }
 
@@ -971,6 +1816,9 @@ static void free_trace(trace_t *trace)
     free(trace->blocks);
     free(trace->block_sizes);
     free(trace->block_rand_base);
+    free(trace->arenas);
+    free(trace->arena_dead);
+    free(trace->caches);
     free(trace);              /* and the trace record itself... */
 }
 
@@ -984,8 +1832,8 @@ static void free_trace(trace_t *trace)
  */
 static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 {
-    int i;
-    int index;
+    int i, k;
+    int index, count, arena, cache;
     size_t size;
     char *newp;
     char *oldp;
@@ -1026,9 +1874,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_malloc */
+        case MEMALIGN: /* mm_memalign */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return false;
             }
@@ -1038,8 +1891,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
              * to the range list if OK. The block must be  be aligned properly,
              * and must not overlap any currently allocated block.
              */
-            if (add_range(ranges, p, size, trace, i, index) == 0)
+            if (add_range(ranges, p, size, trace->ops[i].align,
+                          trace, i, index) == 0)
+                return false;
+
+            if (mm_usable_size(p) < size) {
+                malloc_error(trace, i, "mm_usable_size less than requested.");
                 return false;
+            }
 
             /* Remember region */
             trace->blocks[index] = p;
@@ -1049,6 +1908,28 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
             randomize_block(trace, index);
             break;
 
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count) {
+                malloc_error(trace, i, "mm_malloc_batch failed.");
+                return false;
+            }
+            for (k = 0; k < count; k++) {
+                if (add_range(ranges, trace->blocks[index + k], size,
+                              ALIGNMENT, trace, i + k, index + k) == 0)
+                    return false;
+                if (mm_usable_size(trace->blocks[index + k]) < size) {
+                    malloc_error(trace, i + k,
+                                 "mm_usable_size less than requested.");
+                    return false;
+                }
+                trace->block_sizes[index + k] = size;
+                randomize_block(trace, index + k);
+            }
+            i += count - 1;
+            break;
+
         case REALLOC: /* mm_realloc */
             check_index(trace, i, index);
 
@@ -1070,8 +1951,14 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
 
             /* Check new block for correctness and add it to range list */
             if (size > 0) {
-                if (add_range(ranges, newp, size, trace, i, index) == 0)
+                if (add_range(ranges, newp, size, ALIGNMENT,
+                              trace, i, index) == 0)
                     return false;
+                if (mm_usable_size(newp) < size) {
+                    malloc_error(trace, i,
+                                 "mm_usable_size less than requested.");
+                    return false;
+                }
             }
 
 
@@ -1100,7 +1987,93 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            if (sized_flag)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            count = trace->ops[i].count;
+            for (k = 0; k < count; k++) {
+                check_index(trace, i + k, index + k);
+                remove_range(ranges, trace->blocks[index + k]);
+            }
+            mm_free_batch((void **) &trace->blocks[index], count);
+            i += count - 1;
+            break;
+
+        case ARENA_NEW: /* mm_arena_create */
+            arena = trace->ops[i].arena;
+            if ((trace->arenas[arena] = mm_arena_create(0)) == NULL) {
+                malloc_error(trace, i, "mm_arena_create failed.");
+                return false;
+            }
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            arena = trace->ops[i].arena;
+            if ((p = mm_arena_alloc(trace->arenas[arena], size)) == NULL) {
+                malloc_error(trace, i, "mm_arena_alloc failed.");
+                return false;
+            }
+            if (add_range(ranges, p, size, ALIGNMENT, trace, i, index) == 0)
+                return false;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            randomize_block(trace, index);
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            arena = trace->ops[i].arena;
+            for (k = 0; k < trace->ops[i].count; k++) {
+                index = trace->arena_dead[trace->ops[i].dead + k];
+                check_index(trace, i, index);
+                remove_range(ranges, trace->blocks[index]);
+            }
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[arena]);
+                trace->arenas[arena] = NULL;
+            }
+            break;
+
+        case CACHE_NEW: /* mm_cache_create */
+            cache = trace->ops[i].cache;
+            trace->caches[cache] = mm_cache_create(size, trace->ops[i].align);
+            if (trace->caches[cache] == NULL) {
+                malloc_error(trace, i, "mm_cache_create failed.");
+                return false;
+            }
+            break;
+
+        case CACHE_ALLOC: /* mm_cache_alloc */
+            cache = trace->ops[i].cache;
+            if ((p = mm_cache_alloc(trace->caches[cache])) == NULL) {
+                malloc_error(trace, i, "mm_cache_alloc failed.");
+                return false;
+            }
+            if (add_range(ranges, p, size, trace->ops[i].align,
+                          trace, i, index) == 0)
+                return false;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            randomize_block(trace, index);
+            break;
+
+        case CACHE_FREE: /* mm_cache_free */
+            check_index(trace, i, index);
+            p = trace->blocks[index];
+            remove_range(ranges, p);
+            mm_cache_free(trace->caches[trace->ops[i].cache], p);
+            break;
+
+        case CACHE_DESTROY: /* mm_cache_destroy */
+            cache = trace->ops[i].cache;
+            mm_cache_destroy(trace->caches[cache]);
+            trace->caches[cache] = NULL;
             break;
 
         default:
@@ -1122,16 +2095,23 @@ static bool eval_mm_valid(trace_t *trace, range_set_t *ranges)
  *   is always the high water mark of the heap.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   stats->overshoot is set to the bytes between the end of the highest
+ *   payload ever handed out and the break at the end, which is what the
+ *   heap was grown by beyond any need, and stats->realloc_moves and
+ *   stats->realloc_copied to the reallocs that moved their block and the
+ *   bytes they copied.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, stats_t *stats)
 {
-    int i;
-    int index;
+    int i, k;
+    int index, count, arena, cache;
     size_t size, newsize, oldsize;
     size_t max_total_size = 0;
     size_t total_size = 0;
     char *p;
     char *newp, *oldp;
+    char *top;
 
     reinit_trace(trace);
 
@@ -1139,15 +2119,21 @@ static double eval_mm_util(trace_t *trace, int tracenum)
     mem_reset_brk();
     if (!mm_init())
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
+    top = (char *) mem_heap_lo();
 
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
 
         case ALLOC: /* mm_alloc */
+        case MEMALIGN: /* mm_memalign */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1155,109 +2141,1354 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             /* Remember region and size */
             trace->blocks[index] = p;
             trace->block_sizes[index] = size;
+            raise_top(&top, p, size);
 
             total_size += size;
             break;
 
-        case REALLOC: /* mm_realloc */
+        case ALLOC_BATCH: /* mm_malloc_batch */
             index = trace->ops[i].index;
-            newsize = trace->ops[i].size;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count) {
+                app_error("trace %d: mm_malloc_batch failed in eval_mm_util",
+                          tracenum);
+            }
+            for (k = 0; k < count; k++) {
+                trace->block_sizes[index + k] = size;
+                raise_top(&top, trace->blocks[index + k], size);
+            }
+
+            total_size += size * count;
+            i += count - 1;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
             oldsize = trace->block_sizes[index];
 
-            oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
-                app_error("trace %d: mm_realloc failed in eval_mm_util",
-                          tracenum);
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+                app_error("trace %d: mm_realloc failed in eval_mm_util",
+                          tracenum);
+            }
+
+            /* A moved block had its payload copied */
+            if (oldp != NULL && newp != NULL && newp != oldp) {
+                stats->realloc_moves++;
+                stats->realloc_copied += (oldsize < newsize) ? oldsize : newsize;
+            }
+
+            /* Remember region and size */
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = newsize;
+            raise_top(&top, newp, newsize);
+
+            total_size += (newsize - oldsize);
+            break;
+
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            if (index < 0) {
+                size = 0;
+                p = 0;
+            } else {
+                size = trace->block_sizes[index];
+                p = trace->blocks[index];
+            }
+
+            if (sized_flag)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
+
+            total_size -= size;
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            for (k = 0; k < count; k++)
+                total_size -= trace->block_sizes[index + k];
+
+            mm_free_batch((void **) &trace->blocks[index], count);
+            i += count - 1;
+            break;
+
+        case ARENA_NEW: /* mm_arena_create */
+            arena = trace->ops[i].arena;
+            if ((trace->arenas[arena] = mm_arena_create(0)) == NULL) {
+                app_error("trace %d: mm_arena_create failed in eval_mm_util",
+                          tracenum);
+            }
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            arena = trace->ops[i].arena;
+            if ((p = mm_arena_alloc(trace->arenas[arena], size)) == NULL) {
+                app_error("trace %d: mm_arena_alloc failed in eval_mm_util",
+                          tracenum);
+            }
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            raise_top(&top, p, size);
+            total_size += size;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            arena = trace->ops[i].arena;
+            for (k = 0; k < trace->ops[i].count; k++) {
+                index = trace->arena_dead[trace->ops[i].dead + k];
+                total_size -= trace->block_sizes[index];
+            }
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[arena]);
+                trace->arenas[arena] = NULL;
+            }
+            break;
+
+        case CACHE_NEW: /* mm_cache_create */
+            cache = trace->ops[i].cache;
+            trace->caches[cache] = mm_cache_create(trace->ops[i].size,
+                                                   trace->ops[i].align);
+            if (trace->caches[cache] == NULL) {
+                app_error("trace %d: mm_cache_create failed in eval_mm_util",
+                          tracenum);
+            }
+            break;
+
+        case CACHE_ALLOC: /* mm_cache_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            cache = trace->ops[i].cache;
+            if ((p = mm_cache_alloc(trace->caches[cache])) == NULL) {
+                app_error("trace %d: mm_cache_alloc failed in eval_mm_util",
+                          tracenum);
+            }
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            raise_top(&top, p, size);
+            total_size += size;
+            break;
+
+        case CACHE_FREE: /* mm_cache_free */
+            index = trace->ops[i].index;
+            mm_cache_free(trace->caches[trace->ops[i].cache],
+                          trace->blocks[index]);
+            total_size -= trace->block_sizes[index];
+            break;
+
+        case CACHE_DESTROY: /* mm_cache_destroy */
+            cache = trace->ops[i].cache;
+            mm_cache_destroy(trace->caches[cache]);
+            trace->caches[cache] = NULL;
+            break;
+
+        default:
+            app_error("trace %d: Nonexistent request type in eval_mm_util",
+                      tracenum);
+        }
+
+        /* update the high-water mark */
+        max_total_size = (total_size > max_total_size) ?
+            total_size : max_total_size;
+    }
+
+    printf(".");
+
+    stats->overshoot = (char *) mem_heap_hi() + 1 - top;
+    return ((double)max_total_size / (double)mem_heap_peak());
+}
+
+/*
+ * raise_top - Raise *top to the end of the payload at p, if that is
+ *    higher and below the break (payloads in segments don't count)
+ */
+static void raise_top(char **top, char *p, size_t size)
+{
+    if (p + size > *top && p + size <= (char *) mem_heap_hi() + 1)
+        *top = p + size;
+}
+
+
+/*
+ * flush_heap - Evict the simulated heap from the cache, for -F, and add
+ *    the time it takes to flush_secs, so that it can be taken out of the
+ *    measured time.  Every line of the heap is flushed with clflush
+ *    where there is one; elsewhere a buffer larger than the cache is
+ *    read, which evicts the driver's data as well.
+ */
+static void flush_heap(void)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+#ifdef __SSE2__
+    char *p = (char *) mem_heap_lo();
+    char *hi = (char *) mem_heap_hi();
+    char *seg = NULL;
+    size_t len;
+    for (; p <= hi; p += FLUSH_LINE_BYTES)
+        __builtin_ia32_clflush(p);
+    while ((seg = mem_region_next_segment(mem_default_region(), seg, &len)) != NULL)
+        for (p = seg; p < seg + len; p += FLUSH_LINE_BYTES)
+            __builtin_ia32_clflush(p);
+    __builtin_ia32_mfence();
+#else
+    static char *flush_buf = NULL;
+    char sum = 0;
+    size_t off;
+    if (flush_buf == NULL && (flush_buf = calloc(FLUSH_SWEEP_BYTES, 1)) == NULL)
+        unix_error("calloc failed in flush_heap");
+    for (off = 0; off < FLUSH_SWEEP_BYTES; off += FLUSH_LINE_BYTES)
+        sum += flush_buf[off];
+    touch_sink = sum;
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    flush_secs += (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) * 1e-9;
+}
+
+/*
+ * eval_mm_speed - This is the function that is used by fcyc()
+ *    to measure the running time of the mm malloc package.
+ */
+static void eval_mm_speed(void *ptr)
+{
+    int i, index, count, arena, cache;
+    size_t size, newsize;
+    char *p, *newp, *oldp, *block;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    reinit_trace(trace);
+    flush_secs = 0;
+    speed_runs++;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_speed");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++) {
+        if (flush_period && i % flush_period == 0)
+            flush_heap();
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_malloc(size)) == NULL)
+                app_error("mm_malloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case MEMALIGN: /* mm_memalign */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if ((p = mm_memalign(trace->ops[i].align, size)) == NULL)
+                app_error("mm_memalign error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case ALLOC_BATCH: /* mm_malloc_batch */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+            if (mm_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count)
+                app_error("mm_malloc_batch error in eval_mm_speed");
+            i += count - 1;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            index = trace->ops[i].index;
+            newsize = trace->ops[i].size;
+            oldp = trace->blocks[index];
+            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+                app_error("mm_realloc error in eval_mm_speed");
+            trace->blocks[index] = newp;
+            break;
+
+        case FREE: /* mm_free */
+            index = trace->ops[i].index;
+            if (index < 0) {
+                block = 0;
+            } else {
+                block = trace->blocks[index];
+            }
+            if (sized_flag)
+                mm_free_sized(block, trace->ops[i].size);
+            else
+                mm_free(block);
+            break;
+
+        case FREE_BATCH: /* mm_free_batch */
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            mm_free_batch((void **) &trace->blocks[index], count);
+            i += count - 1;
+            break;
+
+        case ARENA_NEW: /* mm_arena_create */
+            arena = trace->ops[i].arena;
+            if ((trace->arenas[arena] = mm_arena_create(0)) == NULL)
+                app_error("mm_arena_create error in eval_mm_speed");
+            break;
+
+        case ARENA_ALLOC: /* mm_arena_alloc */
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            arena = trace->ops[i].arena;
+            if ((p = mm_arena_alloc(trace->arenas[arena], size)) == NULL)
+                app_error("mm_arena_alloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+            mm_arena_reset(trace->arenas[trace->ops[i].arena]);
+            break;
+
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            arena = trace->ops[i].arena;
+            mm_arena_destroy(trace->arenas[arena]);
+            trace->arenas[arena] = NULL;
+            break;
+
+        case CACHE_NEW: /* mm_cache_create */
+            cache = trace->ops[i].cache;
+            trace->caches[cache] = mm_cache_create(trace->ops[i].size,
+                                                   trace->ops[i].align);
+            if (trace->caches[cache] == NULL)
+                app_error("mm_cache_create error in eval_mm_speed");
+            break;
+
+        case CACHE_ALLOC: /* mm_cache_alloc */
+            index = trace->ops[i].index;
+            cache = trace->ops[i].cache;
+            if ((p = mm_cache_alloc(trace->caches[cache])) == NULL)
+                app_error("mm_cache_alloc error in eval_mm_speed");
+            trace->blocks[index] = p;
+            break;
+
+        case CACHE_FREE: /* mm_cache_free */
+            index = trace->ops[i].index;
+            mm_cache_free(trace->caches[trace->ops[i].cache],
+                          trace->blocks[index]);
+            break;
+
+        case CACHE_DESTROY: /* mm_cache_destroy */
+            cache = trace->ops[i].cache;
+            mm_cache_destroy(trace->caches[cache]);
+            trace->caches[cache] = NULL;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_speed");
+        }
+    }
+}
+
+/*
+ * eval_oracle - Compute how small a heap the trace could have run in.
+ *   Every block becomes a lifetime, from the op that allocates it to the
+ *   op that frees it, with its size rounded up to ALIGNMENT.  A realloc
+ *   ends the old lifetime one op after the new one starts, since the
+ *   data has to be copied from one to the other.  The best heap found by
+ *   the placement heuristics in oracle.c is an achievable target for
+ *   mm.c, unlike the peak of live bytes used by eval_mm_util.
+ */
+static void eval_oracle(trace_t *trace, stats_t *stats)
+{
+    int i, k;
+    int index;
+    size_t size;
+    size_t n = 0;
+    size_t total_size = 0;
+    size_t max_total_size = 0;
+    lifetime_t *lt;
+    long *open;
+
+    if ((lt = malloc((trace->num_ops + 1) * sizeof(lifetime_t))) == NULL)
+        unix_error("malloc 1 failed in eval_oracle");
+    if ((open = malloc((trace->num_ids + 1) * sizeof(long))) == NULL)
+        unix_error("malloc 2 failed in eval_oracle");
+    for (i = 0; i < trace->num_ids; i++) {
+        open[i] = -1;
+        trace->block_sizes[i] = 0;
+    }
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+        case ALLOC_BATCH:
+        case MEMALIGN:
+        case ARENA_ALLOC:
+        case CACHE_ALLOC:
+            lt[n].start = i;
+            lt[n].end = trace->num_ops;
+            lt[n].size = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+            open[index] = n++;
+            total_size += size;
+            break;
+
+        case REALLOC:
+            if (open[index] >= 0)
+                lt[open[index]].end = (size == 0) ? i : i + 1;
+            open[index] = -1;
+            if (size > 0) {
+                lt[n].start = i;
+                lt[n].end = trace->num_ops;
+                lt[n].size = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+                open[index] = n++;
+            }
+            total_size += size - trace->block_sizes[index];
+            break;
+
+        case FREE:
+        case FREE_BATCH:
+        case CACHE_FREE:
+            if (index < 0)
+                break;
+            if (open[index] >= 0)
+                lt[open[index]].end = i;
+            open[index] = -1;
+            total_size -= trace->block_sizes[index];
+            size = 0;
+            break;
+
+        case ARENA_RESET:
+        case ARENA_DESTROY:
+            for (k = 0; k < trace->ops[i].count; k++) {
+                int id = trace->arena_dead[trace->ops[i].dead + k];
+                if (open[id] >= 0)
+                    lt[open[id]].end = i;
+                open[id] = -1;
+                total_size -= trace->block_sizes[id];
+                trace->block_sizes[id] = 0;
+            }
+            break;
+
+        case ARENA_NEW:
+        case CACHE_NEW:
+        case CACHE_DESTROY:
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_oracle");
+        }
+        if (index >= 0)
+            trace->block_sizes[index] = size;
+
+        max_total_size = (total_size > max_total_size) ?
+            total_size : max_total_size;
+    }
+
+    stats->peak_bytes = max_total_size;
+    stats->bound_bytes = oracle_peak(lt, n);
+    stats->oracle_bytes = oracle_bestfit(lt, n);
+    size_t offline = oracle_offline(lt, n, ORACLE_MAX_WORK);
+    if (offline != 0 && offline < stats->oracle_bytes)
+        stats->oracle_bytes = offline;
+
+    free(lt);
+    free(open);
+}
+
+/* A range of cache lines or pages covered by one live payload */
+typedef struct {
+    unsigned long lo;
+    unsigned long hi;
+} span_t;
+
+static int cmp_span(const void *a, const void *b)
+{
+    const span_t *x = a, *y = b;
+    return (x->lo < y->lo) ? -1 : (x->lo > y->lo);
+}
+
+/*
+ * count_units - Number of distinct units of 2^shift bytes touched by the
+ *   live payloads of the trace.  Uses spans as scratch space.
+ */
+static size_t count_units(const trace_t *trace, span_t *spans, int shift)
+{
+    int i;
+    size_t n = 0, units = 0;
+    unsigned long end = 0;
+    size_t j;
+
+    for (i = 0; i < trace->num_ids; i++) {
+        if (trace->block_sizes[i] == 0)
+            continue;
+        unsigned long lo = (unsigned long) trace->blocks[i];
+        spans[n].lo = lo >> shift;
+        spans[n].hi = (lo + trace->block_sizes[i] - 1) >> shift;
+        n++;
+    }
+    qsort(spans, n, sizeof(span_t), cmp_span);
+    for (j = 0; j < n; j++) {
+        if (units == 0 || spans[j].lo > end) {
+            units += spans[j].hi - spans[j].lo + 1;
+            end = spans[j].hi;
+        } else if (spans[j].hi > end) {
+            units += spans[j].hi - end;
+            end = spans[j].hi;
+        }
+    }
+    return units;
+}
+
+/*
+ * eval_mm_locality - Replay the trace and measure how mm_malloc's
+ *   placement decisions would affect the cache behavior of a program
+ *   that uses the blocks:
+ *   - the distance between consecutively allocated blocks, and how
+ *     often the next block lands within the same page;
+ *   - how often an allocation reuses an address that was freed, and how
+ *     many ops earlier the free happened;
+ *   - at LOCALITY_SAMPLES points in the trace, the number of distinct
+ *     cache lines and pages that the live payloads cover.
+ */
+static void eval_mm_locality(trace_t *trace, stats_t *stats)
+{
+    int i, k, index;
+    size_t size;
+    char *p = NULL;
+    char *oldp = NULL;
+    char *last = NULL;
+    size_t nallocs = 0, nnear = 0, nreuse = 0;
+    double sumdist = 0, sumreuse = 0;
+    double sumlines = 0, sumpages = 0, sumlive = 0;
+    int nsamples = 0;
+    size_t live = 0;
+    int every = trace->num_ops / LOCALITY_SAMPLES;
+    tree_t *freed = tree_new();
+    span_t *spans;
+
+    if ((spans = malloc((trace->num_ids + 1) * sizeof(span_t))) == NULL)
+        unix_error("malloc failed in eval_mm_locality");
+    if (every == 0)
+        every = 1;
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_locality");
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        oldp = NULL;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+        case ALLOC_BATCH:
+        case MEMALIGN:
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else
+                p = mm_malloc(size);
+            if (p == NULL)
+                app_error("mm_malloc failed in eval_mm_locality");
+            break;
+
+        case ARENA_NEW:
+            p = NULL;
+            trace->arenas[trace->ops[i].arena] = mm_arena_create(0);
+            if (trace->arenas[trace->ops[i].arena] == NULL)
+                app_error("mm_arena_create failed in eval_mm_locality");
+            break;
+
+        case ARENA_ALLOC:
+            p = mm_arena_alloc(trace->arenas[trace->ops[i].arena], size);
+            if (p == NULL)
+                app_error("mm_arena_alloc failed in eval_mm_locality");
+            break;
+
+        case CACHE_NEW:
+            p = NULL;
+            trace->caches[trace->ops[i].cache] =
+                mm_cache_create(size, trace->ops[i].align);
+            if (trace->caches[trace->ops[i].cache] == NULL)
+                app_error("mm_cache_create failed in eval_mm_locality");
+            break;
+
+        case CACHE_ALLOC:
+            p = mm_cache_alloc(trace->caches[trace->ops[i].cache]);
+            if (p == NULL)
+                app_error("mm_cache_alloc failed in eval_mm_locality");
+            break;
+
+        case CACHE_DESTROY:
+            p = NULL;
+            mm_cache_destroy(trace->caches[trace->ops[i].cache]);
+            trace->caches[trace->ops[i].cache] = NULL;
+            break;
+
+        case ARENA_RESET:
+        case ARENA_DESTROY:
+            p = NULL;
+            for (k = 0; k < trace->ops[i].count; k++) {
+                int id = trace->arena_dead[trace->ops[i].dead + k];
+                live -= trace->block_sizes[id];
+                trace->blocks[id] = NULL;
+                trace->block_sizes[id] = 0;
+            }
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[trace->ops[i].arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[trace->ops[i].arena]);
+                trace->arenas[trace->ops[i].arena] = NULL;
+            }
+            break;
+
+        case REALLOC:
+            oldp = trace->blocks[index];
+            live -= trace->block_sizes[index];
+            p = mm_realloc(oldp, size);
+            if (p == NULL && size != 0)
+                app_error("mm_realloc failed in eval_mm_locality");
+            break;
+
+        case FREE:
+        case FREE_BATCH:
+        case CACHE_FREE:
+            p = NULL;
+            if (index < 0)
+                break;
+            oldp = trace->blocks[index];
+            live -= trace->block_sizes[index];
+            if (trace->ops[i].type == CACHE_FREE)
+                mm_cache_free(trace->caches[trace->ops[i].cache], oldp);
+            else
+                mm_free(oldp);
+            size = 0;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_locality");
+        }
+
+        /* Remember when each address was given back */
+        if (oldp != NULL && p != oldp) {
+            tree_remove(freed, (long) oldp);
+            tree_insert(freed, (long) oldp, (void *)(long) (i + 1));
+        }
+
+        /* Address of a newly placed block */
+        if (p != NULL && p != oldp) {
+            if (last != NULL) {
+                double dist = (p > last) ? p - last : last - p;
+                sumdist += dist;
+                if (dist < LOCALITY_PAGE)
+                    nnear++;
+            }
+            long freed_at = (long) tree_remove(freed, (long) p);
+            if (freed_at != 0) {
+                nreuse++;
+                sumreuse += i + 1 - freed_at;
+            }
+            last = p;
+            nallocs++;
+        }
+        if (index >= 0) {
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            live += size;
+        }
+
+        if (i % every == every - 1 && live > 0) {
+            sumlines += count_units(trace, spans, LOCALITY_LINE_BITS);
+            sumpages += count_units(trace, spans, LOCALITY_PAGE_BITS);
+            sumlive += live;
+            nsamples++;
+        }
+    }
+
+    stats->alloc_dist = nallocs > 1 ? sumdist / (nallocs - 1) : 0;
+    stats->alloc_near = nallocs > 1 ? (double) nnear / (nallocs - 1) : 0;
+    stats->reuse = nallocs > 0 ? (double) nreuse / nallocs : 0;
+    stats->reuse_dist = nreuse > 0 ? sumreuse / nreuse : 0;
+    stats->live_lines = nsamples > 0 ? sumlines / nsamples : 0;
+    stats->live_pages = nsamples > 0 ? sumpages / nsamples : 0;
+    stats->line_density = sumlines > 0 ?
+        sumlive / (sumlines * (1 << LOCALITY_LINE_BITS)) : 0;
+
+    tree_free(freed, NULL);
+    free(spans);
+}
+
+/*
+ * eval_mm_threads - Replay the trace on 1, 2, ... mt_threads threads (-M),
+ *    and record the time each takes.  With n threads, the requests made
+ *    by thread t of the trace (see the @ requests in read_trace) are made
+ *    by thread t % n; a trace without thread ids is dealt out by block
+ *    id instead, so that every block is allocated and freed by one
+ *    thread.  A request on a block that another thread allocated or
+ *    reallocated waits until that request has been made, so that frees
+ *    across threads happen in trace order.  The allocator must be thread
+ *    safe for more than one thread (see mdriver-mt in the Makefile), and
+ *    traces with arena or cache requests are left out.
+ *
+ *    With -X, each thread has a heap of its own instead, in a region of
+ *    its own, and mt_remote_pct percent of the frees, picked by a hash of
+ *    their position in the trace, are moved to another thread than the
+ *    one that made the block.  Those go to the block's heap through
+ *    mm_heap_free_remote.
+ *
+ *    With -B, mm.c's maintenance thread runs on the shared heap during
+ *    each replay, and is stopped before the heap is checked.  Every
+ *    MT_FREE_SAMPLE'th free of each thread is timed, to show how long
+ *    free takes with and without it.
+ */
+static void eval_mm_threads(trace_t *trace, stats_t *stats)
+{
+    int i, k, n, run, t;
+    int num_ops = trace->num_ops;
+    int *dep, *last, *owner, *ops;
+    char *done;
+    mm_heap_t **block_heap;
+    double *free_ns, *samples;
+    mt_thread_t *threads;
+    pthread_t *tids;
+    pthread_barrier_t start;
+    struct timespec t0, t1;
+
+    for (i = 0; i < num_ops; i++) {
+        switch (trace->ops[i].type) {
+        case ALLOC: case ALLOC_BATCH: case MEMALIGN: case REALLOC:
+        case FREE: case FREE_BATCH:
+            break;
+        default:
+            printf("Not replaying %s on threads: it has arena or cache requests\n",
+                   trace->filename);
+            return;
+        }
+    }
+
+    dep = malloc(num_ops * sizeof(int));
+    owner = malloc(num_ops * sizeof(int));
+    ops = malloc(num_ops * sizeof(int));
+    done = malloc(num_ops);
+    last = malloc(trace->num_ids * sizeof(int));
+    block_heap = calloc(trace->num_ids, sizeof(mm_heap_t *));
+    free_ns = malloc(num_ops * sizeof(double));
+    samples = malloc(num_ops * sizeof(double));
+    threads = calloc(mt_threads, sizeof(mt_thread_t));
+    tids = malloc(mt_threads * sizeof(pthread_t));
+    stats->mt = calloc(mt_threads, sizeof(mt_result_t));
+    if (!dep || !owner || !ops || !done || !last || !block_heap || !free_ns ||
+        !samples || !threads || !tids || !stats->mt)
+        unix_error("malloc failed in eval_mm_threads");
+
+    if (mt_remote_pct >= 0 && mt_regions == NULL) {
+        mt_regions = calloc(mt_threads, sizeof(mem_region_t *));
+        if (mt_regions == NULL)
+            unix_error("malloc failed in eval_mm_threads");
+        for (t = 0; t < mt_threads; t++) {
+            if ((mt_regions[t] = mem_region_create(false)) == NULL)
+                app_error("mem_region_create failed in eval_mm_threads\n");
+        }
+    }
+
+    /* Each request on a block waits for the one that last produced it */
+    for (i = 0; i < trace->num_ids; i++)
+        last[i] = -1;
+    for (i = 0; i < num_ops; i++) {
+        int index = trace->ops[i].index;
+        dep[i] = (index >= 0) ? last[index] : -1;
+        switch (trace->ops[i].type) {
+        case ALLOC: case ALLOC_BATCH: case MEMALIGN:
+            dep[i] = -1;
+            last[index] = i;
+            break;
+        case REALLOC:
+            last[index] = i;
+            break;
+        default:
+            break;
+        }
+    }
+
+    for (n = 1; n <= mt_threads; n++) {
+        mt_result_t *best = &stats->mt[n - 1];
+        int frees = 0, remote = 0;
+
+        /* Deal out the ops, keeping the ops of each thread together */
+        for (t = 0; t < n; t++)
+            threads[t].num_ops = 0;
+        for (i = 0; i < num_ops; i++) {
+            int index = trace->ops[i].index;
+            bool is_free = (trace->ops[i].type == FREE ||
+                            trace->ops[i].type == FREE_BATCH) && dep[i] >= 0;
+            unsigned hash = (unsigned) i * 2654435761u >> 8;
+            owner[i] = (trace->num_threads > 1) ? trace->ops[i].thread % n :
+                (index >= 0) ? index % n : 0;
+            if (is_free && n > 1 && (int) (hash % 100) < mt_remote_pct)
+                owner[i] = (owner[dep[i]] + 1 + hash / 100 % (n - 1)) % n;
+            if (is_free) {
+                frees++;
+                remote += (owner[i] != owner[dep[i]]);
+            }
+            threads[owner[i]].num_ops++;
+        }
+        best->remote = frees ? (double) remote / frees : 0;
+        for (t = 0, k = 0; t < n; t++) {
+            threads[t].ops = ops + k;
+            k += threads[t].num_ops;
+            threads[t].num_ops = 0;
+        }
+        for (i = 0; i < num_ops; i++) {
+            t = owner[i];
+            threads[t].ops[threads[t].num_ops++] = i;
+        }
+
+        best->secs = DBL_MAX;
+        for (run = 0; run < MT_RUNS; run++) {
+            reinit_trace(trace);
+            memset(done, 0, num_ops);
+            if (mt_remote_pct >= 0) {
+                for (t = 0; t < n; t++) {
+                    mem_region_reset_brk(mt_regions[t]);
+                    threads[t].heap = mm_heap_create(mt_regions[t]);
+                    if (threads[t].heap == NULL)
+                        app_error("mm_heap_create failed in eval_mm_threads\n");
+                }
+            } else {
+                mem_reset_brk();
+                if (!mm_init())
+                    app_error("mm_init failed in eval_mm_threads");
+                if (maint_pct > 0 && !mm_maint_start(maint_pct / 100.0))
+                    app_error("mm_maint_start failed in eval_mm_threads\n");
+            }
+
+            if (pthread_barrier_init(&start, NULL, n + 1) != 0)
+                app_error("pthread_barrier_init failed in eval_mm_threads");
+            for (t = 0; t < n; t++) {
+                threads[t].trace = trace;
+                threads[t].dep = dep;
+                threads[t].done = done;
+                threads[t].block_heap = block_heap;
+                threads[t].free_ns = free_ns + (threads[t].ops - ops);
+                threads[t].start = &start;
+                threads[t].failed = false;
+                if (pthread_create(&tids[t], NULL, mt_replay, &threads[t]) != 0)
+                    app_error("pthread_create failed in eval_mm_threads");
+            }
+            pthread_barrier_wait(&start);
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            for (t = 0; t < n; t++)
+                pthread_join(tids[t], NULL);
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            pthread_barrier_destroy(&start);
+            if (maint_pct > 0)
+                mm_maint_stop();
+
+            for (t = 0; t < n; t++) {
+                if (threads[t].failed)
+                    app_error("Request failed replaying %s on %d threads\n",
+                              trace->filename, n);
+                if (threads[t].heap ? !mm_heap_checkheap(threads[t].heap, __LINE__) :
+                    (t == 0 && !mm_checkheap(__LINE__)))
+                    app_error("Heap check failed replaying %s on %d threads\n",
+                              trace->filename, n);
+            }
+
+            double secs = timespec_secs(&t0, &t1);
+            if (secs < best->secs) {
+                int active = 0;
+                best->secs = secs;
+                best->heap_bytes = 0;
+                if (mt_remote_pct < 0)
+                    best->heap_bytes = mem_heapsize();
+                for (t = 0; mt_remote_pct >= 0 && t < n; t++)
+                    best->heap_bytes += mem_region_size(mt_regions[t]);
+                best->lat_mean = best->lat_max = 0;
+                best->free_mean = best->free_p99 = 0;
+                k = 0;
+                for (t = 0; t < n; t++) {
+                    memcpy(samples + k, threads[t].free_ns,
+                           threads[t].num_free_ns * sizeof(double));
+                    k += threads[t].num_free_ns;
+                }
+                if (k > 0) {
+                    qsort(samples, k, sizeof(double), cmp_double);
+                    for (i = 0; i < k; i++)
+                        best->free_mean += samples[i] / k;
+                    best->free_p99 = samples[(int) (0.99 * (k - 1))];
+                }
+                for (t = 0; t < n; t++) {
+                    double lat;
+                    if (threads[t].num_ops == 0)
+                        continue;
+                    lat = (threads[t].secs - threads[t].wait_secs) /
+                        threads[t].num_ops;
+                    best->lat_mean += lat;
+                    best->lat_max = (lat > best->lat_max) ? lat : best->lat_max;
+                    active++;
+                }
+                if (active > 0)
+                    best->lat_mean /= active;
+            }
+        }
+    }
+
+    free(dep);
+    free(owner);
+    free(ops);
+    free(done);
+    free(last);
+    free(block_heap);
+    free(free_ns);
+    free(samples);
+    free(threads);
+    free(tids);
+}
+
+/*
+ * mt_replay - Make the requests of one thread of a threaded replay.  The
+ *    time spent waiting for a request of another thread is kept apart,
+ *    so that it can be left out of the thread's latency.  A thread with a
+ *    heap of its own allocates from it, and hands blocks of other heaps
+ *    back with mm_heap_free_remote; reallocating one of them moves it to
+ *    its own heap.
+ */
+static void *mt_replay(void *ptr)
+{
+    mt_thread_t *self = (mt_thread_t *) ptr;
+    trace_t *trace = self->trace;
+    mm_heap_t *heap = self->heap;
+    struct timespec start, end, w0, w1, f0, f1;
+    int k, i, index, dep, frees = 0;
+    bool timed;
+    size_t size;
+    char *p;
+
+    self->secs = 0;
+    self->wait_secs = 0;
+    self->num_free_ns = 0;
+    pthread_barrier_wait(self->start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (k = 0; k < self->num_ops; k++) {
+        i = self->ops[k];
+        dep = self->dep[i];
+        if (dep >= 0 && !__atomic_load_n(&self->done[dep], __ATOMIC_ACQUIRE)) {
+            clock_gettime(CLOCK_MONOTONIC, &w0);
+            while (!__atomic_load_n(&self->done[dep], __ATOMIC_ACQUIRE))
+                sched_yield();
+            clock_gettime(CLOCK_MONOTONIC, &w1);
+            self->wait_secs += timespec_secs(&w0, &w1);
+        }
+
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* batches are made one block at a time */
+        case ALLOC_BATCH:
+            p = heap ? mm_heap_malloc(heap, size) : mm_malloc(size);
+            if (p == NULL)
+                self->failed = true;
+            trace->blocks[index] = p;
+            self->block_heap[index] = heap;
+            break;
+
+        case MEMALIGN:
+            p = heap ? mm_heap_memalign(heap, trace->ops[i].align, size) :
+                mm_memalign(trace->ops[i].align, size);
+            if (p == NULL)
+                self->failed = true;
+            trace->blocks[index] = p;
+            self->block_heap[index] = heap;
+            break;
+
+        case REALLOC:
+            p = trace->blocks[index];
+            if (heap == NULL) {
+                p = mm_realloc(p, size);
+            } else if (self->block_heap[index] == heap || p == NULL) {
+                p = mm_heap_realloc(heap, p, size);
+            } else {
+                char *newp = (size == 0) ? NULL : mm_heap_malloc(heap, size);
+                if (newp != NULL) {
+                    size_t old = mm_usable_size(p);
+                    memcpy(newp, p, (old < size) ? old : size);
+                }
+                if (newp != NULL || size == 0)
+                    mm_heap_free_remote(self->block_heap[index], p);
+                p = newp;
             }
+            if (p == NULL && size != 0)
+                self->failed = true;
+            trace->blocks[index] = p;
+            self->block_heap[index] = heap;
+            break;
 
-            /* Remember region and size */
-            trace->blocks[index] = newp;
-            trace->block_sizes[index] = newsize;
+        case FREE:
+        case FREE_BATCH:
+            p = (index < 0) ? NULL : trace->blocks[index];
+            timed = (frees++ % MT_FREE_SAMPLE == 0);
+            if (timed)
+                clock_gettime(CLOCK_MONOTONIC, &f0);
+            if (heap != NULL && p != NULL && self->block_heap[index] != heap)
+                mm_heap_free_remote(self->block_heap[index], p);
+            else if (heap != NULL && sized_flag)
+                mm_heap_free_sized(heap, p, size);
+            else if (heap != NULL)
+                mm_heap_free(heap, p);
+            else if (sized_flag)
+                mm_free_sized(p, size);
+            else
+                mm_free(p);
+            if (timed) {
+                clock_gettime(CLOCK_MONOTONIC, &f1);
+                self->free_ns[self->num_free_ns++] = timespec_secs(&f0, &f1) * 1e9;
+            }
+            break;
 
-            total_size += (newsize - oldsize);
+        default:
+            break;
+        }
+        __atomic_store_n(&self->done[i], 1, __ATOMIC_RELEASE);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    self->secs = timespec_secs(&start, &end);
+    return NULL;
+}
+
+/*
+ * cmp_double - Order doubles for qsort.
+ */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x < y) ? -1 : (x > y);
+}
+
+/*
+ * timespec_secs - Seconds from start to end.
+ */
+static double timespec_secs(const struct timespec *start,
+                            const struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) +
+        (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+/*
+ * eval_mm_speed_touch - Like eval_mm_speed, but also behaves like a
+ *    program that uses its memory.  Every block mm_malloc or mm_realloc
+ *    returns has one byte in every touch_stride bytes written, and every
+ *    TOUCH_PERIOD ops the payloads of TOUCH_BLOCKS randomly chosen live
+ *    blocks are read with the same stride.  The accesses are ordinary
+ *    loads and stores, so the measured time includes the cache and TLB
+ *    misses that mm.c's placement causes.  The live ids are kept in an
+ *    array, so that the read-back picks only blocks that are allocated.
+ */
+static void eval_mm_speed_touch(void *ptr)
+{
+    int i, j, index;
+    size_t size, off;
+    char *p, *block;
+    char sum = 0;
+    unsigned int seed = 1;
+    trace_t *trace = ((speed_t *)ptr)->trace;
+    int *live, *slot;   /* the live ids, and each id's place in live */
+    int nlive = 0;
+
+    if ((live = malloc((trace->num_ids + 1) * sizeof(int))) == NULL ||
+        (slot = calloc(trace->num_ids + 1, sizeof(int))) == NULL)
+        unix_error("malloc failed in eval_mm_speed_touch");
+    reinit_trace(trace);
+    flush_secs = 0;
+    speed_runs++;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (!mm_init())
+        app_error("mm_init failed in eval_mm_speed_touch");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++) {
+        if (flush_period && i % flush_period == 0)
+            flush_heap();
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+        case ALLOC_BATCH:
+        case MEMALIGN:
+        case ARENA_ALLOC:
+        case CACHE_ALLOC:
+            if (trace->ops[i].type == MEMALIGN)
+                p = mm_memalign(trace->ops[i].align, size);
+            else if (trace->ops[i].type == ARENA_ALLOC)
+                p = mm_arena_alloc(trace->arenas[trace->ops[i].arena], size);
+            else if (trace->ops[i].type == CACHE_ALLOC)
+                p = mm_cache_alloc(trace->caches[trace->ops[i].cache]);
+            else
+                p = mm_malloc(size);
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_speed_touch");
+            for (off = 0; off < size; off += touch_stride)
+                p[off] = (char) off;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            touch_live(live, slot, &nlive, index);
+            break;
+
+        case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(trace->blocks[index], size)) == NULL
+                && size != 0)
+                app_error("mm_realloc error in eval_mm_speed_touch");
+            for (off = 0; off < size; off += touch_stride)
+                p[off] = (char) off;
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            if (size == 0)
+                touch_dead(live, slot, &nlive, index);
+            else
+                touch_live(live, slot, &nlive, index);
             break;
 
         case FREE: /* mm_free */
-            index = trace->ops[i].index;
+        case FREE_BATCH:
             if (index < 0) {
-                size = 0;
-                p = 0;
+                block = 0;
             } else {
-                size = trace->block_sizes[index];
-                p = trace->blocks[index];
+                block = trace->blocks[index];
+                trace->block_sizes[index] = 0;
+                touch_dead(live, slot, &nlive, index);
             }
+            if (sized_flag && trace->ops[i].type == FREE)
+                mm_free_sized(block, trace->ops[i].size);
+            else
+                mm_free(block);
+            break;
 
-            mm_free(p);
+        case CACHE_FREE: /* mm_cache_free */
+            trace->block_sizes[index] = 0;
+            touch_dead(live, slot, &nlive, index);
+            mm_cache_free(trace->caches[trace->ops[i].cache],
+                          trace->blocks[index]);
+            break;
 
-            total_size -= size;
+        case CACHE_NEW: /* mm_cache_create */
+            trace->caches[trace->ops[i].cache] =
+                mm_cache_create(size, trace->ops[i].align);
+            if (trace->caches[trace->ops[i].cache] == NULL)
+                app_error("mm_cache_create error in eval_mm_speed_touch");
+            break;
+
+        case CACHE_DESTROY: /* mm_cache_destroy */
+            mm_cache_destroy(trace->caches[trace->ops[i].cache]);
+            trace->caches[trace->ops[i].cache] = NULL;
+            break;
+
+        case ARENA_NEW: /* mm_arena_create */
+            trace->arenas[trace->ops[i].arena] = mm_arena_create(0);
+            if (trace->arenas[trace->ops[i].arena] == NULL)
+                app_error("mm_arena_create error in eval_mm_speed_touch");
+            break;
+
+        case ARENA_RESET: /* mm_arena_reset */
+        case ARENA_DESTROY: /* mm_arena_destroy */
+            for (j = 0; j < trace->ops[i].count; j++) {
+                index = trace->arena_dead[trace->ops[i].dead + j];
+                trace->block_sizes[index] = 0;
+                touch_dead(live, slot, &nlive, index);
+            }
+            if (trace->ops[i].type == ARENA_RESET) {
+                mm_arena_reset(trace->arenas[trace->ops[i].arena]);
+            } else {
+                mm_arena_destroy(trace->arenas[trace->ops[i].arena]);
+                trace->arenas[trace->ops[i].arena] = NULL;
+            }
             break;
 
         default:
-            app_error("trace %d: Nonexistent request type in eval_mm_util",
-                      tracenum);
+            app_error("Nonexistent request type in eval_mm_speed_touch");
         }
 
-        /* update the high-water mark */
-        max_total_size = (total_size > max_total_size) ?
-            total_size : max_total_size;
+        /* Read back part of the working set */
+        if (i % TOUCH_PERIOD == 0 && nlive > 0) {
+            for (j = 0; j < TOUCH_BLOCKS; j++) {
+                seed = seed * 1103515245 + 12345;
+                index = live[(seed >> 8) % nlive];
+                block = trace->blocks[index];
+                size = trace->block_sizes[index];
+                for (off = 0; off < size; off += touch_stride)
+                    sum += block[off];
+            }
+        }
     }
+    touch_sink = sum;
+    free(live);
+    free(slot);
+}
 
-    printf(".");
+/*
+ * touch_live - Add index to the live ids of eval_mm_speed_touch, unless
+ *    it is already there.  slot[index] is index's place in live.
+ */
+static void touch_live(int *live, int *slot, int *nlive, int index)
+{
+    if (slot[index] < *nlive && live[slot[index]] == index)
+        return;
+    slot[index] = *nlive;
+    live[(*nlive)++] = index;
+}
+
+/*
+ * touch_dead - Remove index from the live ids of eval_mm_speed_touch by
+ *    moving the last live id into its place.
+ */
+static void touch_dead(int *live, int *slot, int *nlive, int index)
+{
+    int last;
+
+    if (!(slot[index] < *nlive && live[slot[index]] == index))
+        return;
+    last = live[--(*nlive)];
+    live[slot[index]] = last;
+    slot[last] = slot[index];
+}
+
+/*
+ * The null allocator hands out addresses from a small arena with a bump
+ * pointer that wraps around, and frees nothing.  It is never written
+ * through, since eval_null_speed only stores the pointers.  The
+ * functions are kept out of line so that each request still pays for a
+ * call, as it does with mm.c.
+ */
+static __attribute__((noinline)) void *null_malloc(size_t size)
+{
+    size_t asize = ALIGNMENT * ((size + ALIGNMENT - 1) / ALIGNMENT);
+    if (null_brk + asize > NULL_ARENA_BYTES)
+        null_brk = 0;
+    void *p = null_arena + (asize > NULL_ARENA_BYTES ? 0 : null_brk);
+    null_brk += asize;
+    return p;
+}
+
+static __attribute__((noinline)) void *null_realloc(void *ptr, size_t size)
+{
+    return (size == 0) ? NULL : null_malloc(size);
+}
+
+static __attribute__((noinline)) void null_free(void *ptr)
+{
+    __asm__ volatile("" : : "r"(ptr) : "memory");
+}
+
+static __attribute__((noinline)) size_t null_malloc_batch(size_t size, size_t n,
+                                                          void **out)
+{
+    size_t k;
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    for (k = 0; k < n; k++)
+        out[k] = null_malloc(size);
+    return n;
 }
 
+static __attribute__((noinline)) void null_free_batch(void **ptrs, size_t n)
+{
+    __asm__ volatile("" : : "r"(ptrs), "r"(n) : "memory");
+}
 
 /*
- * eval_mm_speed - This is the function that is used by fcyc()
- *    to measure the running time of the mm malloc package.
+ * eval_null_speed - The replay loop of eval_mm_speed, run against the
+ *    null allocator.  Its running time is the driver's share of the time
+ *    that eval_mm_speed reports.  Batches are dispatched as there, with
+ *    one call for the whole batch.
  */
-static void eval_mm_speed(void *ptr)
+static void eval_null_speed(void *ptr)
 {
-    int i, index;
+    int i, index, count;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
     reinit_trace(trace);
-
-    /* Reset the heap and initialize the mm package */
-    mem_reset_brk();
-    if (!mm_init())
-        app_error("mm_init failed in eval_mm_speed");
+    null_brk = 0;
 
     /* Interpret each trace request */
     for (i = 0;  i < trace->num_ops;  i++)
         switch (trace->ops[i].type) {
 
-        case ALLOC: /* mm_malloc */
+        case ALLOC:
+        case MEMALIGN:
+        case ARENA_ALLOC:
+        case CACHE_ALLOC:
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
-                app_error("mm_malloc error in eval_mm_speed");
+            if ((p = null_malloc(size)) == NULL)
+                app_error("null_malloc error in eval_null_speed");
             trace->blocks[index] = p;
             break;
 
-        case REALLOC: /* mm_realloc */
+        case ALLOC_BATCH:
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            count = trace->ops[i].count;
+            if (null_malloc_batch(size, count, (void **) &trace->blocks[index])
+                != (size_t) count)
+                app_error("null_malloc_batch error in eval_null_speed");
+            i += count - 1;
+            break;
+
+        case REALLOC:
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
-                app_error("mm_realloc error in eval_mm_speed");
+            if ((newp = null_realloc(oldp,newsize)) == NULL && newsize != 0)
+                app_error("null_realloc error in eval_null_speed");
             trace->blocks[index] = newp;
             break;
 
-        case FREE: /* mm_free */
+        case FREE:
+        case CACHE_FREE:
             index = trace->ops[i].index;
             if (index < 0) {
                 block = 0;
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            null_free(block);
+            break;
+
+        case FREE_BATCH:
+            index = trace->ops[i].index;
+            count = trace->ops[i].count;
+            null_free_batch((void **) &trace->blocks[index], count);
+            i += count - 1;
+            break;
+
+        case ARENA_NEW:
+        case ARENA_RESET:
+        case ARENA_DESTROY:
+        case CACHE_NEW:
+        case CACHE_DESTROY:
+            null_free(NULL);
             break;
 
         default:
-            app_error("Nonexistent request type in eval_mm_speed");
+            app_error("Nonexistent request type in eval_null_speed");
         }
 }
 
@@ -1269,7 +3500,7 @@ static void eval_mm_speed(void *ptr)
  */
 static bool eval_libc_valid(trace_t *trace)
 {
-    int i;
+    int i, k;
     size_t newsize;
     char *p, *newp, *oldp;
 
@@ -1279,6 +3510,8 @@ static bool eval_libc_valid(trace_t *trace)
         switch (trace->ops[i].type) {
 
         case ALLOC: /* malloc */
+        case ALLOC_BATCH:
+        case ARENA_ALLOC:
             if ((p = malloc(trace->ops[i].size)) == NULL) {
                 malloc_error(trace, i, "libc malloc failed");
                 unix_error("System message");
@@ -1286,6 +3519,16 @@ static bool eval_libc_valid(trace_t *trace)
             trace->blocks[trace->ops[i].index] = p;
             break;
 
+        case MEMALIGN: /* posix_memalign */
+        case CACHE_ALLOC:
+            if (posix_memalign((void **) &p, trace->ops[i].align,
+                               trace->ops[i].size) != 0) {
+                malloc_error(trace, i, "libc posix_memalign failed");
+                unix_error("System message");
+            }
+            trace->blocks[trace->ops[i].index] = p;
+            break;
+
         case REALLOC: /* realloc */
             newsize = trace->ops[i].size;
             oldp = trace->blocks[trace->ops[i].index];
@@ -1297,6 +3540,8 @@ static bool eval_libc_valid(trace_t *trace)
             break;
 
         case FREE: /* free */
+        case FREE_BATCH:
+        case CACHE_FREE:
             if (trace->ops[i].index >= 0) {
                 free(trace->blocks[trace->ops[i].index]);
             } else {
@@ -1304,6 +3549,17 @@ static bool eval_libc_valid(trace_t *trace)
             }
             break;
 
+        case ARENA_NEW: /* libc has no arenas or caches */
+        case CACHE_NEW:
+        case CACHE_DESTROY:
+            break;
+
+        case ARENA_RESET: /* so free every block */
+        case ARENA_DESTROY:
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[trace->arena_dead[trace->ops[i].dead + k]]);
+            break;
+
         default:
             app_error("invalid operation type  in eval_libc_valid");
         }
@@ -1319,7 +3575,7 @@ static bool eval_libc_valid(trace_t *trace)
  */
 static void eval_libc_speed(void *ptr)
 {
-    int i;
+    int i, k;
     int index;
     size_t size, newsize;
     char *p, *newp, *oldp, *block;
@@ -1330,6 +3586,8 @@ static void eval_libc_speed(void *ptr)
     for (i = 0;  i < trace->num_ops;  i++) {
         switch (trace->ops[i].type) {
         case ALLOC: /* malloc */
+        case ALLOC_BATCH:
+        case ARENA_ALLOC:
             index = trace->ops[i].index;
             size = trace->ops[i].size;
             if ((p = malloc(size)) == NULL)
@@ -1337,6 +3595,15 @@ static void eval_libc_speed(void *ptr)
             trace->blocks[index] = p;
             break;
 
+        case MEMALIGN: /* posix_memalign */
+        case CACHE_ALLOC:
+            index = trace->ops[i].index;
+            size = trace->ops[i].size;
+            if (posix_memalign((void **) &p, trace->ops[i].align, size) != 0)
+                unix_error("posix_memalign failed in eval_libc_speed");
+            trace->blocks[index] = p;
+            break;
+
         case REALLOC: /* realloc */
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
@@ -1348,6 +3615,8 @@ static void eval_libc_speed(void *ptr)
             break;
 
         case FREE: /* free */
+        case FREE_BATCH:
+        case CACHE_FREE:
             index = trace->ops[i].index;
             if (index >= 0) {
                 block = trace->blocks[index];
@@ -1356,6 +3625,17 @@ static void eval_libc_speed(void *ptr)
                 free(0);
             }
             break;
+
+        case ARENA_NEW: /* libc has no arenas or caches */
+        case CACHE_NEW:
+        case CACHE_DESTROY:
+            break;
+
+        case ARENA_RESET: /* so free every block */
+        case ARENA_DESTROY:
+            for (k = 0; k < trace->ops[i].count; k++)
+                free(trace->blocks[trace->arena_dead[trace->ops[i].dead + k]]);
+            break;
         }
     }
 }
@@ -1532,6 +3812,247 @@ static void printresults(int n, stats_t *stats, sum_stats_t *sumstats)
     }
 }
 
+/*
+ * printoracle - prints, for each trace, the utilization mm.c achieved,
+ *               the utilization of the best offline placement, and the
+ *               gap between the two in percentage points.
+ */
+static void printoracle(int n, stats_t *stats)
+{
+    int i;
+    double sumgap = 0;
+    int count = 0;
+
+    if (tab_mode) {
+        printf("heap\toracle\tbound\tutil\toracle\tgap\ttrace\n");
+    } else {
+        printf("Utilization headroom against offline placement:\n");
+        printf("  %10s%10s%10s %7s %7s %6s  %s\n",
+               "heap", "oracle", "bound", "util", "oracle", "gap", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].oracle_bytes == 0)
+            continue;
+        double util = stats[i].util * 100.0;
+        double outil = 100.0 * stats[i].peak_bytes / stats[i].oracle_bytes;
+        if (tab_mode) {
+            printf("%zu\t%zu\t%zu\t%.1f\t%.1f\t%.1f\t%s\n",
+                   stats[i].heap_bytes, stats[i].oracle_bytes,
+                   stats[i].bound_bytes, util, outil, outil - util,
+                   stats[i].filename);
+        } else {
+            printf("  %10zu%10zu%10zu %6.1f%% %6.1f%% %6.1f  %s\n",
+                   stats[i].heap_bytes, stats[i].oracle_bytes,
+                   stats[i].bound_bytes, util, outil, outil - util,
+                   stats[i].filename);
+        }
+        sumgap += outil - util;
+        count++;
+    }
+    if (count > 0 && !tab_mode)
+        printf("Average gap = %.1f points\n", sumgap / count);
+}
+
+/*
+ * printlocality - prints, for each trace, the locality of the blocks
+ *                 returned by mm_malloc (see eval_mm_locality).
+ */
+static void printlocality(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("dist\tnear\treuse\trdist\tlines\tpages\tdensity\ttrace\n");
+    } else {
+        printf("Placement locality:\n");
+        printf("  %10s %6s %6s %8s %9s %7s %6s  %s\n", "dist", "near",
+               "reuse", "rdist", "lines", "pages", "dens", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if (tab_mode) {
+            printf("%.0f\t%.1f\t%.1f\t%.0f\t%.0f\t%.0f\t%.1f\t%s\n",
+                   stats[i].alloc_dist, stats[i].alloc_near * 100.0,
+                   stats[i].reuse * 100.0, stats[i].reuse_dist,
+                   stats[i].live_lines, stats[i].live_pages,
+                   stats[i].line_density * 100.0, stats[i].filename);
+        } else {
+            printf("  %10.0f %5.1f%% %5.1f%% %8.0f %9.0f %7.0f %5.1f%%  %s\n",
+                   stats[i].alloc_dist, stats[i].alloc_near * 100.0,
+                   stats[i].reuse * 100.0, stats[i].reuse_dist,
+                   stats[i].live_lines, stats[i].live_pages,
+                   stats[i].line_density * 100.0, stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printoverhead - prints, for each trace, the time spent in the replay
+ *                 loop and the throughput with and without that time.
+ */
+static void printoverhead(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("msecs\tdriver\tshare\tKops\tKops-adj\ttrace\n");
+    } else {
+        printf("Driver overhead%s:\n",
+               subtract_flag ? " (subtracted from the results above)" : "");
+        printf("  %10s%10s %6s %8s %8s  %s\n",
+               "msecs", "driver", "share", "Kops", "adjusted", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        double raw = stats[i].raw_secs;
+        double adj = raw - stats[i].driver_secs;
+        if (adj < 0.01 * raw)
+            adj = 0.01 * raw;
+        if (tab_mode) {
+            printf("%.3f\t%.3f\t%.1f\t%.0f\t%.0f\t%s\n",
+                   raw * 1000.0, stats[i].driver_secs * 1000.0,
+                   100.0 * stats[i].driver_secs / raw,
+                   (stats[i].ops * 1e-3) / raw, (stats[i].ops * 1e-3) / adj,
+                   stats[i].filename);
+        } else {
+            printf("  %10.3f%10.3f %5.1f%% %8.0f %8.0f  %s\n",
+                   raw * 1000.0, stats[i].driver_secs * 1000.0,
+                   100.0 * stats[i].driver_secs / raw,
+                   (stats[i].ops * 1e-3) / raw, (stats[i].ops * 1e-3) / adj,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printscaling - prints, for each trace, the time and throughput of the
+ *                threaded replays (see eval_mm_threads), the speedup over
+ *                one thread, the mean and largest per-thread latency, the
+ *                share of frees made by another thread, the size the
+ *                heaps grew to, and the mean and 99th percentile time of
+ *                a free (in ns).
+ */
+static void printscaling(int n, stats_t *stats)
+{
+    int i, t;
+
+    if (tab_mode) {
+        printf("threads\tmsecs\tKops\tspeedup\tlat\tlatmax\tremote\theapKB\tfree\tfree99\ttrace\n");
+    } else {
+        printf("Scaling with threads (latencies in ns per op, %s):\n",
+               (mt_remote_pct >= 0) ? "heap per thread" : "shared heap");
+        printf("  %7s %10s %8s %7s %8s %8s %7s %8s %7s %7s  %s\n", "threads",
+               "msecs", "Kops", "speedup", "lat", "max", "remote", "heapKB",
+               "free", "free99", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].mt == NULL)
+            continue;
+        for (t = 0; t < mt_threads; t++) {
+            mt_result_t *r = &stats[i].mt[t];
+            double kops = (stats[i].ops * 1e-3) / r->secs;
+            double speedup = stats[i].mt[0].secs / r->secs;
+            if (tab_mode) {
+                printf("%d\t%.3f\t%.0f\t%.2f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%s\n",
+                       t + 1, r->secs * 1000.0, kops, speedup,
+                       r->lat_mean * 1e9, r->lat_max * 1e9, r->remote * 100.0,
+                       r->heap_bytes / 1024.0, r->free_mean, r->free_p99,
+                       stats[i].filename);
+            } else {
+                printf("  %7d %10.3f %8.0f %7.2f %8.1f %8.1f %6.1f%% %8.0f %7.1f %7.1f  %s\n",
+                       t + 1, r->secs * 1000.0, kops, speedup,
+                       r->lat_mean * 1e9, r->lat_max * 1e9, r->remote * 100.0,
+                       r->heap_bytes / 1024.0, r->free_mean, r->free_p99,
+                       stats[i].filename);
+            }
+        }
+    }
+}
+
+/*
+ * printfaults - prints, for each trace, the minor page faults taken while
+ *               mapping the heap, during the correctness and utilization
+ *               runs, and during the timing runs, in total and per run.
+ *               The faults of the process as a whole are counted, so
+ *               the driver's own allocations show up too.
+ */
+static void printfaults(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("init\tfirst\ttimed\tperrun\ttrace\n");
+    } else {
+        printf("Minor page faults (heap in %s):\n", pages_name);
+        printf("  %8s %8s %8s %8s  %s\n", "init", "first", "timed",
+               "per run", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        double per_run;
+        if (!stats[i].valid)
+            continue;
+        per_run = stats[i].timed_runs ?
+            (double) stats[i].flt_timed / stats[i].timed_runs : 0;
+        if (tab_mode) {
+            printf("%ld\t%ld\t%ld\t%.1f\t%s\n", stats[i].flt_init,
+                   stats[i].flt_first, stats[i].flt_timed, per_run,
+                   stats[i].filename);
+        } else {
+            printf("  %8ld %8ld %8ld %8.1f  %s\n", stats[i].flt_init,
+                   stats[i].flt_first, stats[i].flt_timed, per_run,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * printgrowth - prints, for each trace, how many times the heap was grown
+ *               in the utilization run, its peak size, how many bytes
+ *               of it lay past the highest payload at the end (overshoot),
+ *               and how many reallocs moved their block, copying how much
+ */
+static void printgrowth(int n, stats_t *stats)
+{
+    int i;
+
+    if (tab_mode) {
+        printf("sbrks\theapKB\tovershoot\tmoves\tcopiedKB\ttrace\n");
+    } else {
+        printf("Heap growth:\n");
+        printf("  %8s %10s %10s %8s %10s  %s\n", "sbrks", "heapKB", "overshoot",
+               "moves", "copiedKB", "trace");
+    }
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        if (tab_mode) {
+            printf("%zu\t%.1f\t%zu\t%zu\t%.1f\t%s\n", stats[i].sbrk_calls,
+                   stats[i].heap_bytes / 1024.0, stats[i].overshoot,
+                   stats[i].realloc_moves, stats[i].realloc_copied / 1024.0,
+                   stats[i].filename);
+        } else {
+            printf("  %8zu %10.1f %10zu %8zu %10.1f  %s\n", stats[i].sbrk_calls,
+                   stats[i].heap_bytes / 1024.0, stats[i].overshoot,
+                   stats[i].realloc_moves, stats[i].realloc_copied / 1024.0,
+                   stats[i].filename);
+        }
+    }
+}
+
+/*
+ * minor_faults - Minor page faults the process has taken so far.
+ */
+static long minor_faults(void)
+{
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return usage.ru_minflt;
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1580,6 +4101,8 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(char *prog)
 {
+    size_t i;
+
     fprintf(stderr, "Usage: %s [-hlVdD] [-f <file>]\n", prog);
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-p         Calculate Checkpoint Score.\n");
@@ -1594,4 +4117,23 @@ static void usage(char *prog)
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-T         Print diagnostics in tab mode\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file\n");
+    fprintf(stderr, "\t-o         Compare utilization to offline placement.\n");
+    fprintf(stderr, "\t-L         Report locality of the returned blocks.\n");
+    fprintf(stderr, "\t-P <n>     Write and read every n'th payload byte when timing.\n");
+    fprintf(stderr, "\t-C         Measure the driver's own share of the time.\n");
+    fprintf(stderr, "\t-S         Like -C, and subtract it from the throughput.\n");
+    fprintf(stderr, "\t-z         Free blocks with mm_free_sized.\n");
+    fprintf(stderr, "\t-F <n>     Evict the heap from the cache every n ops when timing.\n");
+    fprintf(stderr, "\t-M <n>     Replay each trace on 1 to n threads.\n");
+    fprintf(stderr, "\t-X <pct>   With -M, give each thread a heap, and free pct%% of blocks\n");
+    fprintf(stderr, "\t           from another thread.\n");
+    fprintf(stderr, "\t-R         Cache small blocks per thread, not per CPU (mdriver-percpu).\n");
+    fprintf(stderr, "\t-B <pct>   With -M, run the maintenance thread on pct%% of a CPU.\n");
+    fprintf(stderr, "\t-H <pages> Back the heap with none (base pages), thp or populate,\n");
+    fprintf(stderr, "\t           and report minor page faults.\n");
+    fprintf(stderr, "\t-G         Report how often and how far the heap grew,\n");
+    fprintf(stderr, "\t           and what reallocs copied.\n");
+    fprintf(stderr, "\t-k <k>=<v> Override a config.h setting, as can MDRIVER_<K>=<v>:\n");
+    for (i = 0; i < NUM_SETTINGS; i++)
+        fprintf(stderr, "\t           %-13s %s\n", settings[i].key, settings[i].help);
 }
@@ -23,109 +23,93 @@
 typedef struct MBLK {
     size_t id;                             /* Page ID.  Counts number of pages from start of heap */
     struct MBLK *next;                     /* Link for hash table */
-    unsigned char bytes[SPARSE_PAGE_SIZE]; /* Page contents */
+    unsigned char bytes[];                 /* Page contents, sparse_page_size of them */
 } mem_block_t;
 
+/* A segment of a dense heap, mapped apart from the break */
+typedef struct mem_segment {
+    unsigned char *start;                   /* First byte */
+    size_t length;                          /* Bytes mapped */
+    struct mem_segment *next;               /* Segment mapped before this one */
+} mem_segment_t;
+
+/* A simulated heap, and the pages that back it in sparse mode */
+struct mem_region {
+    bool sparse;                            /* Use sparse memory emulation */
+    unsigned char *heap;                    /* Starting address of heap */
+    unsigned char *mem_brk;                 /* Current position of break */
+    unsigned char *mem_max_addr;            /* Maximum allowable heap address */
+    size_t mmap_length;                     /* Number of bytes allocated by mmap */
+    bool stats_printed;                     /* Has information been printed about allocation */
+    mem_segment_t *segments;                /* Segments, most recently mapped first */
+    size_t segment_bytes;                   /* Bytes in segments */
+    size_t peak_bytes;                      /* Most bytes the heap held at once */
+    size_t sbrk_calls;                      /* Calls that grew the heap */
+
+    /* Sparse memory representation */
+    mem_block_t *next_free_page;            /* Next free page */
+    size_t num_pages;                       /* Total number of pages */
+    size_t num_free_pages;                  /* Number of free pages */
+    mem_block_t **page_table;               /* Hash table from page ID to page */
+    size_t num_buckets;                     /* Number of buckets in page table */
+};
+
 /* private global variables */
-static bool sparse = false;                 /* Use sparse memory emulation */
-static unsigned char *heap;                 /* Starting address of heap */
-static unsigned char *mem_brk;              /* Current position of break */
-static unsigned char *mem_max_addr;         /* Maximum allowable heap address */
-static size_t mmap_length = MAX_DENSE_HEAP; /* Number of bytes allocated by mmap */
+static mem_region_t default_region;         /* Region behind the mem_* functions */
+static mem_region_t *sparse_region = NULL;  /* The sparse region, if any.  There
+					       is one, since its addresses are fixed */
 static bool show_stats = false;             /* Should program print allocation information? */
-static bool stats_printed = false;          /* Has information been printed about allocation */
+static mem_pages_t page_mode = MEM_PAGES_DEFAULT; /* Backing of dense heaps */
 
-/* Sparse memory representation */
-static mem_block_t *next_free_page = NULL;  /* Next free page */
-static size_t num_pages = 0;                /* Total number of pages */
-static size_t num_free_pages = 0;           /* Number of free pages */
-static mem_block_t **page_table = NULL;     /* Hash table from page ID to page */
-static size_t num_buckets = 0;              /* Number of buckets in page table */
+/* Limits and layout of heaps set up from now on; config.h has the defaults */
+static size_t dense_heap_max = MAX_DENSE_HEAP;          /* Bytes reserved per heap */
+static void *dense_heap_start = TRY_DENSE_HEAP_START;   /* Where the default heap goes */
+static size_t sparse_page_size = SPARSE_PAGE_SIZE;      /* Bytes per emulated page */
+static unsigned sparse_page_shift = __builtin_ctzl(SPARSE_PAGE_SIZE); /* log2 of it */
+static double hash_load = HASH_LOAD;                    /* Pages per page table bucket */
 
 /*
  * Forward declarations
  */
+static bool region_init(mem_region_t *r, bool sparse, void *start);
 static size_t page_id(const void *addr);
 static void *page_start(size_t id);
-static void *get_mem(const void *addr);
-static void print_stats();
+static void *get_mem(mem_region_t *r, const void *addr);
+static void print_stats(mem_region_t *r);
+static size_t page_bytes(void);
+static void *map_heap(void *start, size_t length, bool dense);
+static void note_peak(mem_region_t *r);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(bool do_sparse){
-    sparse = do_sparse;
-    if (sparse) {
-	/* Want sparse total allocation to approximately match the dense heap size */
-	/* Account for both page itself and its amortized contribution to the page table */
-	double fbytes_per_page = sizeof(mem_block_t) + sizeof(mem_block_t *) / HASH_LOAD;
-	num_pages = (size_t) (MAX_DENSE_HEAP / fbytes_per_page);
-	num_buckets = num_pages / HASH_LOAD;
-	mmap_length =
-	    num_buckets * sizeof(mem_block_t *) +  // Page table
-	    num_pages * sizeof(mem_block_t) +      // Pages
-	    sizeof(uint64_t);                      // Padding
-    } else {
-	/* Dense allocation */
-	next_free_page = NULL;
-	num_pages = 0;
-	page_table = NULL;
-	num_buckets = 0;
-	mmap_length = MAX_DENSE_HEAP;
-    }
-
-    int dev_zero = open("/dev/zero", O_RDWR);
-    void *start = sparse ? NULL : TRY_DENSE_HEAP_START;
-    void *addr = mmap(start,        /* suggested start*/
-		      mmap_length,  /* length */
-		      PROT_WRITE,   /* permissions */
-		      MAP_PRIVATE,  /* private or shared? */
-		      dev_zero,	    /* fd */
-		      0);	    /* offset */
-    if (addr == MAP_FAILED) {
-	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
+    if (!region_init(&default_region, do_sparse, dense_heap_start))
 	exit(1);
-    }
-    if (sparse) {
-	/* Use initial space for page table */
-	page_table = (mem_block_t **) addr;
-	heap = SPARSE_HEAP_START;
-	mem_max_addr = heap + MAX_SPARSE_HEAP;
-    } else {
-	heap = addr;
-	mem_max_addr = heap + MAX_DENSE_HEAP;
-    }
-    stats_printed = false;
-    mem_brk = heap;
-    mem_reset_brk();
 }
 
 /* 
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-    print_stats();
-    munmap(heap, mmap_length);
-    next_free_page = NULL;
-    num_free_pages = 0;
-    page_table = NULL;
-    num_buckets = 0;
+    print_stats(&default_region);
+    while (default_region.segments != NULL)
+	mem_region_segment_release(&default_region, default_region.segments->start);
+    munmap(default_region.sparse ? (void *) default_region.page_table : default_region.heap,
+	   default_region.mmap_length);
+    if (sparse_region == &default_region)
+	sparse_region = NULL;
+    default_region.next_free_page = NULL;
+    default_region.num_free_pages = 0;
+    default_region.page_table = NULL;
+    default_region.num_buckets = 0;
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
-    print_stats();
-    if (sparse) {
-	/* Clear page table */
-	size_t ptb = num_buckets * sizeof(mem_block_t *);
-	memset((void *) page_table, 0, ptb);
-	/* First page is just beyond page table */
-	next_free_page = (mem_block_t *) ((unsigned char *) page_table + ptb);
-	num_free_pages = num_pages;
-    }
-    mem_brk = heap;
+    mem_region_reset_brk(&default_region);
 }
 
 /* 
@@ -134,22 +118,199 @@ void mem_reset_brk(){
  *		this model, the heap cannot be shrunk.
  */
 void *mem_sbrk(intptr_t incr) {
-    unsigned char *old_brk = mem_brk;
+    return mem_region_sbrk(&default_region, incr);
+}
+
+/*
+ * mem_heap_lo - return address of the first heap byte
+ */
+void *mem_heap_lo(){
+    return mem_region_lo(&default_region);
+}
+
+/* 
+ * mem_heap_hi - return address of last heap byte
+ */
+void *mem_heap_hi(){
+    return mem_region_hi(&default_region);
+}
+
+/*
+ * mem_heapsize() - returns the heap size in bytes
+ */
+size_t mem_heapsize() {
+    return mem_region_size(&default_region);
+}
+
+/*
+ * mem_heap_peak() - returns the largest size of the heap since the last
+ *		reset, in bytes
+ */
+size_t mem_heap_peak() {
+    return mem_region_peak(&default_region);
+}
+
+/*
+ * mem_sbrk_calls() - returns the number of times the heap has been grown,
+ *		by mem_sbrk or by a new segment, since the last reset
+ */
+size_t mem_sbrk_calls() {
+    return mem_region_sbrk_calls(&default_region);
+}
+
+/*
+ * mem_heap_contains - is [p, p+len) within the heap, below the break or
+ *		in one of its segments?
+ */
+bool mem_heap_contains(const void *p, size_t len) {
+    return mem_region_contains(&default_region, p, len);
+}
+
+/*
+ * mem_pagesize() - returns the page size of the system
+ */
+size_t mem_pagesize(){
+    return (size_t) getpagesize();
+}
+
+/*
+ * mem_set_pages - choose how the pages of dense heaps set up from now on
+ *		are backed: base pages faulted in on first touch (the
+ *		default), transparent huge pages, or base pages all faulted
+ *		in when the heap is mapped.
+ */
+void mem_set_pages(mem_pages_t pages) {
+    page_mode = pages;
+}
+
+/*
+ * mem_set_heap_max - set the most bytes a heap set up from now on can
+ *		hold.  Dense heaps reserve this much address space, but
+ *		memory is only committed as the heap grows into it.
+ *		Returns false if bytes is not a positive multiple of the page size.
+ */
+bool mem_set_heap_max(size_t bytes) {
+    if (bytes == 0 || bytes % mem_pagesize() != 0)
+	return false;
+    dense_heap_max = bytes;
+    return true;
+}
+
+/*
+ * mem_set_heap_start - set the address the default dense heap is mapped
+ *		at, if the system allows.  NULL lets the system choose.
+ */
+void mem_set_heap_start(void *start) {
+    dense_heap_start = start;
+}
+
+/*
+ * mem_set_sparse_page - set the size of the pages that sparse heaps set
+ *		up from now on are emulated with.  Returns false if bytes is
+ *		not a power of two of at least 16, or a sparse heap exists.
+ */
+bool mem_set_sparse_page(size_t bytes) {
+    if (bytes < 16 || (bytes & (bytes - 1)) != 0 || sparse_region != NULL)
+	return false;
+    sparse_page_size = bytes;
+    sparse_page_shift = __builtin_ctzl(bytes);
+    return true;
+}
+
+/*
+ * mem_set_hash_load - set the target number of pages per bucket of the
+ *		page table of sparse heaps set up from now on.  Returns false
+ *		if load is not positive.
+ */
+bool mem_set_hash_load(double load) {
+    if (!(load > 0))
+	return false;
+    hash_load = load;
+    return true;
+}
+
+/*************** Regions  *******************/
+
+/*
+ * mem_default_region - return the region used by the mem_* functions
+ */
+mem_region_t *mem_default_region(void) {
+    return &default_region;
+}
+
+/*
+ * mem_region_create - create a region with a heap of its own.  Only one
+ *		sparse region can exist at a time.  Returns NULL on failure.
+ */
+mem_region_t *mem_region_create(bool sparse) {
+    mem_region_t *r = malloc(sizeof(mem_region_t));
+    if (r == NULL)
+	return NULL;
+    if (!region_init(r, sparse, NULL)) {
+	free(r);
+	return NULL;
+    }
+    return r;
+}
+
+/*
+ * mem_region_destroy - free a region made by mem_region_create, and its heap
+ */
+void mem_region_destroy(mem_region_t *r) {
+    if (r == NULL)
+	return;
+    print_stats(r);
+    while (r->segments != NULL)
+	mem_region_segment_release(r, r->segments->start);
+    munmap(r->sparse ? (void *) r->page_table : r->heap, r->mmap_length);
+    if (sparse_region == r)
+	sparse_region = NULL;
+    free(r);
+}
+
+/*
+ * mem_region_reset_brk - reset the break of a region, and unmap its
+ *		segments, to make an empty heap
+ */
+void mem_region_reset_brk(mem_region_t *r){
+    print_stats(r);
+    while (r->segments != NULL)
+	mem_region_segment_release(r, r->segments->start);
+    r->peak_bytes = 0;
+    r->sbrk_calls = 0;
+    if (r->sparse) {
+	/* Clear page table */
+	size_t ptb = r->num_buckets * sizeof(mem_block_t *);
+	memset((void *) r->page_table, 0, ptb);
+	/* First page is just beyond page table */
+	r->next_free_page = (mem_block_t *) ((unsigned char *) r->page_table + ptb);
+	r->num_free_pages = r->num_pages;
+    }
+    r->mem_brk = r->heap;
+}
+
+/*
+ * mem_region_sbrk - mem_sbrk on a region
+ */
+void *mem_region_sbrk(mem_region_t *r, intptr_t incr) {
+    unsigned char *old_brk = r->mem_brk;
 
     bool ok = true;
     if (incr < 0) {
 	ok = false;
 	fprintf(stderr, "ERROR: mem_sbrk failed.  Attempt to expand heap by negative value %ld\n", (long) incr);
-    } else if (mem_brk + incr > mem_max_addr) {
+    } else if (r->mem_brk + incr > r->mem_max_addr) {
 	ok = false;
-	size_t alloc = mem_brk - heap + incr;
+	size_t alloc = r->mem_brk - r->heap + incr;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory.  Would require heap size of %zd (0x%zx) bytes\n", alloc, alloc);
-    } else if (!sparse && sbrk(incr) == (void*) -1) {
+    } else if (!r->sparse && sbrk(incr) == (void*) -1) {
 	ok = false;
 	fprintf(stderr, "ERROR: mem_sbrk failed.  Could not allocate more heap space\n");
     }
     if (ok) {
-	mem_brk += incr;
+	r->mem_brk += incr;
+	r->sbrk_calls++;
+	note_peak(r);
 	return (void *) old_brk;
     } else {
 	errno = ENOMEM;
@@ -158,31 +319,169 @@ void *mem_sbrk(intptr_t incr) {
 }
 
 /*
- * mem_heap_lo - return address of the first heap byte
+ * mem_region_trim - shrink the heap of a region by decr bytes.  The whole
+ *		pages past the new break of a dense region are given back to
+ *		the system, and read as zeros if the heap grows over them again.
+ *		Returns false, leaving the heap alone, if decr is more than
+ *		the heap holds.
  */
-void *mem_heap_lo(){
-    return (void *) heap;
+bool mem_region_trim(mem_region_t *r, size_t decr) {
+    if (decr > (size_t) (r->mem_brk - r->heap))
+	return false;
+    r->mem_brk -= decr;
+    if (!r->sparse) {
+	uintptr_t page = (uintptr_t) getpagesize();
+	uintptr_t lo = ((uintptr_t) r->mem_brk + page - 1) & ~(page - 1);
+	uintptr_t hi = (uintptr_t) (r->mem_brk + decr) & ~(page - 1);
+	if (hi > lo)
+	    madvise((void *) lo, hi - lo, MADV_DONTNEED);
+    }
+    return true;
 }
 
-/* 
- * mem_heap_hi - return address of last heap byte
+/*
+ * mem_region_room - the number of bytes the break of a region can still
+ *		grow by
  */
-void *mem_heap_hi(){
-    return (void *)(mem_brk - 1);
+size_t mem_region_room(mem_region_t *r) {
+    return (size_t) (r->mem_max_addr - r->mem_brk);
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_region_segment - map a segment of at least size bytes for the heap
+ *		of a dense region, apart from the break, as a process does once
+ *		sbrk runs into another mapping.  The segment is page aligned,
+ *		and placed above the region's reservation and any earlier
+ *		segment, with at least a page left unmapped in front of it.
+ *		Where the system puts it lower, because something else is
+ *		mapped there, it tries again further up.  Returns NULL on failure.
  */
-size_t mem_heapsize() {
-    return (size_t)(mem_brk - heap);
+void *mem_region_segment(mem_region_t *r, size_t size) {
+    size_t page = mem_pagesize();
+    unsigned char *hint = r->heap + r->mmap_length;
+    size_t gap;
+    mem_segment_t *seg;
+
+    if (r->sparse || size == 0)
+	return NULL;
+    for (seg = r->segments; seg != NULL; seg = seg->next)
+	if (seg->start + seg->length > hint)
+	    hint = seg->start + seg->length;
+    size = (size + page - 1) & ~(page - 1);
+    if ((seg = malloc(sizeof(mem_segment_t))) == NULL)
+	return NULL;
+    seg->start = NULL;
+    for (gap = page; gap <= SEGMENT_MAX_GAP; gap <<= 1) {
+	seg->start = map_heap(hint + gap, size, true);
+	if (seg->start == NULL || seg->start > hint)
+	    break;
+	munmap(seg->start, size);
+	seg->start = NULL;
+    }
+    if (seg->start == NULL) {
+	free(seg);
+	return NULL;
+    }
+    seg->length = size;
+    seg->next = r->segments;
+    r->segments = seg;
+    r->segment_bytes += size;
+    r->sbrk_calls++;
+    note_peak(r);
+    return seg->start;
 }
 
 /*
- * mem_pagesize() - returns the page size of the system
+ * mem_region_segment_release - unmap the segment of a region that starts
+ *		at start.  Returns false if there is none.
  */
-size_t mem_pagesize(){
-    return (size_t) getpagesize();
+bool mem_region_segment_release(mem_region_t *r, void *start) {
+    mem_segment_t **link = &r->segments;
+
+    while (*link != NULL && (*link)->start != start)
+	link = &(*link)->next;
+    if (*link == NULL)
+	return false;
+    mem_segment_t *seg = *link;
+    *link = seg->next;
+    r->segment_bytes -= seg->length;
+    munmap(seg->start, seg->length);
+    free(seg);
+    return true;
+}
+
+/*
+ * mem_region_next_segment - return the start of the segment of a region
+ *		mapped before the one that starts at start, or the most recent
+ *		one if start is NULL, and put its length in *length.  Returns
+ *		NULL after the last one.
+ */
+void *mem_region_next_segment(mem_region_t *r, const void *start, size_t *length) {
+    mem_segment_t *seg = r->segments;
+
+    if (start != NULL) {
+	while (seg != NULL && seg->start != start)
+	    seg = seg->next;
+	if (seg != NULL)
+	    seg = seg->next;
+    }
+    if (seg == NULL)
+	return NULL;
+    *length = seg->length;
+    return seg->start;
+}
+
+/*
+ * mem_region_contains - is [p, p+len) within the heap of a region, below
+ *		the break or in one of its segments?
+ */
+bool mem_region_contains(mem_region_t *r, const void *p, size_t len) {
+    const unsigned char *lo = p;
+    mem_segment_t *seg;
+
+    if (lo >= r->heap && lo + len <= r->mem_brk)
+	return true;
+    for (seg = r->segments; seg != NULL; seg = seg->next)
+	if (lo >= seg->start && lo + len <= seg->start + seg->length)
+	    return true;
+    return false;
+}
+
+/*
+ * mem_region_lo - return address of the first heap byte of a region
+ */
+void *mem_region_lo(mem_region_t *r){
+    return (void *) r->heap;
+}
+
+/*
+ * mem_region_hi - return address of the last heap byte of a region
+ */
+void *mem_region_hi(mem_region_t *r){
+    return (void *)(r->mem_brk - 1);
+}
+
+/*
+ * mem_region_size - returns the heap size of a region in bytes, counting
+ *		its segments
+ */
+size_t mem_region_size(mem_region_t *r) {
+    return (size_t)(r->mem_brk - r->heap) + r->segment_bytes;
+}
+
+/*
+ * mem_region_peak - returns the largest heap size of a region since its
+ *		break was last reset, in bytes
+ */
+size_t mem_region_peak(mem_region_t *r) {
+    return r->peak_bytes;
+}
+
+/*
+ * mem_region_sbrk_calls - mem_sbrk_calls on a region
+ */
+size_t mem_region_sbrk_calls(mem_region_t *r) {
+    return r->sbrk_calls;
 }
 
 /*************** Memory emulation  *******************/
@@ -204,23 +503,24 @@ void mem_write128(void* addr, __int128 val)
 /* Read len bytes and return value zero-extended to 64 bits */
 uint64_t mem_read(const void *addr, size_t len) {
     uint64_t rdata;
-    if (sparse &&
-	(unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    mem_region_t *r = sparse_region;
+    if (r != NULL &&
+	(unsigned char *) addr >= r->heap && (unsigned char *) addr+len <= r->mem_brk) {
 	/* Heap read.  Check if it crosses page boundary */
 	size_t id = page_id(addr);
-	void *paddr = get_mem(addr);
+	void *paddr = get_mem(r, addr);
 	rdata =  *(uint64_t *) paddr;
 	/* Check for split pages */
 	void *maddr = (void *) ((unsigned char *) addr + len - 1);
 	if (id != page_id(maddr)) {
 	    void *saddr = page_start(id);
 	    size_t offset = (unsigned char *) addr - (unsigned char *) saddr;
-	    size_t llen = SPARSE_PAGE_SIZE - offset;
+	    size_t llen = sparse_page_size - offset;
 	    /* Must zero out upper bytes of data */
 	    uint64_t mask = ((uint64_t) 1 << (8 * llen)) - 1;
 	    rdata &= mask;
 	    void *haddr = (void *) ((unsigned char *) addr + llen);
-	    void *hpaddr = get_mem(haddr);
+	    void *hpaddr = get_mem(r, haddr);
 	    uint64_t hdata = *(uint64_t *) hpaddr;
 	    rdata = rdata | (hdata << (8 * llen));
 	}
@@ -237,20 +537,21 @@ uint64_t mem_read(const void *addr, size_t len) {
 
 /* Write lower order len bytes of val to address */
 void mem_write(void *addr, uint64_t val, size_t len) {
-    if (sparse &&
-	(unsigned char *) addr >= heap && (unsigned char *) addr+len <= mem_brk) {
+    mem_region_t *r = sparse_region;
+    if (r != NULL &&
+	(unsigned char *) addr >= r->heap && (unsigned char *) addr+len <= r->mem_brk) {
 	/* Heap write.  Check to see if it crosses page boundary */
 	size_t id = page_id(addr);
-	void *paddr = get_mem(addr);
+	void *paddr = get_mem(r, addr);
 	void *saddr = page_start(id);
 	size_t offset = (unsigned char *) addr - (unsigned char *) saddr;
-	size_t llen = SPARSE_PAGE_SIZE - offset;
+	size_t llen = sparse_page_size - offset;
 	if (llen < len) {
 	    /* Two page write */
 	    memcpy(paddr, (void *) &val, llen);
 	    size_t ulen = len - llen;
 	    void *haddr = (void *) ((unsigned char *) addr + llen);
-	    void *hpaddr = get_mem(haddr);
+	    void *hpaddr = get_mem(r, haddr);
 	    unsigned char *src = (unsigned char *) &val + llen;
 	    memcpy(hpaddr, (void *) src, ulen);
 	} else {
@@ -310,53 +611,153 @@ void *mem_memset(void *dst, int c, size_t n) {
 
 /*************** Private Functions *******************/
 
+/*
+ * region_init - set up a region, with its heap mapped at start if possible.
+ *		Returns false, after printing why, on failure.
+ */
+static bool region_init(mem_region_t *r, bool sparse, void *start) {
+    if (sparse && sparse_region != NULL && sparse_region != r) {
+	fprintf(stderr, "FAILURE.  Only one sparse heap can exist at a time\n");
+	return false;
+    }
+    r->sparse = sparse;
+    if (sparse) {
+	/* Want sparse total allocation to approximately match the dense heap size */
+	/* Account for both page itself and its amortized contribution to the page table */
+	double fbytes_per_page = page_bytes() + sizeof(mem_block_t *) / hash_load;
+	r->num_pages = (size_t) (dense_heap_max / fbytes_per_page);
+	r->num_buckets = r->num_pages / hash_load;
+	if (r->num_buckets == 0)
+	    r->num_buckets = 1;
+	r->mmap_length =
+	    r->num_buckets * sizeof(mem_block_t *) +  // Page table
+	    r->num_pages * page_bytes() +             // Pages
+	    sizeof(uint64_t);                         // Padding
+    } else {
+	/* Dense allocation */
+	r->next_free_page = NULL;
+	r->num_pages = 0;
+	r->page_table = NULL;
+	r->num_buckets = 0;
+	r->mmap_length = dense_heap_max;
+    }
 
-static void print_stats() {
-    size_t vbytes = mem_heapsize();
-    if (!show_stats || vbytes == 0 || stats_printed)
-	return;
+    void *addr = map_heap(sparse ? NULL : start, r->mmap_length, !sparse);
+    if (addr == NULL) {
+	fprintf(stderr, "FAILURE.  mmap couldn't allocate space for heap\n");
+	return false;
+    }
     if (sparse) {
-	size_t ppages = num_pages - num_free_pages;
-	size_t pbytes = ppages * SPARSE_PAGE_SIZE;
+	/* Use initial space for page table */
+	r->page_table = (mem_block_t **) addr;
+	r->heap = SPARSE_HEAP_START;
+	r->mem_max_addr = r->heap + MAX_SPARSE_HEAP;
+	sparse_region = r;
+    } else {
+	r->heap = addr;
+	r->mem_max_addr = r->heap + dense_heap_max;
+    }
+    r->stats_printed = false;
+    r->mem_brk = r->heap;
+    r->segments = NULL;
+    r->segment_bytes = 0;
+    mem_region_reset_brk(r);
+    return true;
+}
+
+/*
+ * map_heap - map length bytes for a heap, at start if possible, backed as
+ *		page_mode says if it is dense.  Returns NULL on failure.
+ */
+static void *map_heap(void *start, size_t length, bool dense) {
+    /* Only what the heap grows into is committed, so reserving more is cheap */
+    int flags = MAP_PRIVATE | MAP_NORESERVE;
+#ifdef MAP_POPULATE
+    if (dense && page_mode == MEM_PAGES_POPULATE)
+	flags |= MAP_POPULATE;
+#endif
+    int dev_zero = open("/dev/zero", O_RDWR);
+    void *addr = mmap(start,           /* suggested start*/
+		      length,          /* length */
+		      PROT_WRITE,      /* permissions */
+		      flags,           /* private or shared? */
+		      dev_zero,	       /* fd */
+		      0);	       /* offset */
+    close(dev_zero);
+    if (addr == MAP_FAILED)
+	return NULL;
+    if (dense && page_mode == MEM_PAGES_HUGE) {
+	/* A private mapping of /dev/zero is anonymous memory, so THP applies */
+#ifdef MADV_HUGEPAGE
+	if (madvise(addr, length, MADV_HUGEPAGE) != 0)
+	    fprintf(stderr, "WARNING.  No transparent huge pages for heap: %s\n",
+		    strerror(errno));
+#else
+	fprintf(stderr, "WARNING.  No transparent huge pages on this system\n");
+#endif
+    }
+    return addr;
+}
+
+/* Raise the peak size of a region to its size, if that is larger */
+static void note_peak(mem_region_t *r) {
+    size_t bytes = mem_region_size(r);
+    if (bytes > r->peak_bytes)
+	r->peak_bytes = bytes;
+}
+
+static void print_stats(mem_region_t *r) {
+    size_t vbytes = mem_region_size(r);
+    if (!show_stats || vbytes == 0 || r->stats_printed)
+	return;
+    if (r->sparse) {
+	size_t ppages = r->num_pages - r->num_free_pages;
+	size_t pbytes = ppages * sparse_page_size;
 	printf("Allocated %zu/%zu pages (%zu bytes) to cover %zu heap bytes (%.4f%% density).  Max address = %p\n",
-	       ppages, num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes, mem_brk);
+	       ppages, r->num_pages, pbytes, vbytes, 100.0 * pbytes / vbytes, r->mem_brk);
     } else {
 	printf("Allocated %zu heap bytes.  Max address = %p\n",
-	       vbytes, mem_brk);
+	       vbytes, r->mem_brk);
     }
-    stats_printed = true;
+    r->stats_printed = true;
+}
+
+/* Bytes taken by an emulated page, with its header */
+static size_t page_bytes(void) {
+    return sizeof(mem_block_t) + sparse_page_size;
 }
 
 /* Given an address, compute the ID  of its page */
 static size_t page_id(const void *addr) {
     size_t offset = (unsigned char *) addr - (unsigned char *) SPARSE_HEAP_START;
-    return offset / SPARSE_PAGE_SIZE;
+    return offset >> sparse_page_shift;
 }
 
 /* Given a page ID, compute its starting address */
 static void *page_start(size_t id) {
-    size_t offset = id * SPARSE_PAGE_SIZE;
+    size_t offset = id << sparse_page_shift;
     return (void *) ((unsigned char *) SPARSE_HEAP_START + offset);
 }
 
 /* Get memory to store value.  Allocate page if necessary */
-static void *get_mem(const void *addr) {
+static void *get_mem(mem_region_t *r, const void *addr) {
     size_t id = page_id(addr);
-    size_t b = id % num_buckets; // A very simple hash function
-    mem_block_t *block = page_table[b];
+    size_t b = id % r->num_buckets; // A very simple hash function
+    mem_block_t *block = r->page_table[b];
     while (block && block->id != id)
 	block = block->next;
     if (!block) {
 	/* Need to allocate a new block */
-	if (num_free_pages == 0) {
+	if (r->num_free_pages == 0) {
 	    fprintf(stderr, "FAILURE.  Ran out of memory\n");
 	    exit(1);
 	}
-	block = next_free_page++;
-	num_free_pages--;
+	block = r->next_free_page;
+	r->next_free_page = (mem_block_t *) ((unsigned char *) block + page_bytes());
+	r->num_free_pages--;
 	block->id = id;
-	block->next = page_table[b];
-	page_table[b] = block;
+	block->next = r->page_table[b];
+	r->page_table[b] = block;
     }
     void *saddr = page_start(id);
     size_t offset = (unsigned char *) addr - (unsigned char *) saddr;
@@ -9,8 +9,49 @@ void mem_reset_brk(void);
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_heap_peak(void);
+size_t mem_sbrk_calls(void);
+bool mem_heap_contains(const void *p, size_t len);
 size_t mem_pagesize(void);
 
+/* How the pages of a dense heap are backed */
+typedef enum {
+    MEM_PAGES_DEFAULT,      /* base pages, faulted in on first touch */
+    MEM_PAGES_HUGE,         /* transparent huge pages (MADV_HUGEPAGE) */
+    MEM_PAGES_POPULATE      /* base pages, prefaulted by mmap (MAP_POPULATE) */
+} mem_pages_t;
+
+void mem_set_pages(mem_pages_t pages);
+
+/* Limits and layout of heaps set up from now on; config.h has the defaults */
+bool mem_set_heap_max(size_t bytes);
+void mem_set_heap_start(void *start);
+bool mem_set_sparse_page(size_t bytes);
+bool mem_set_hash_load(double load);
+
+/* Regions: simulated heaps of their own, for more than one heap per process */
+typedef struct mem_region mem_region_t;
+
+mem_region_t *mem_default_region(void);
+mem_region_t *mem_region_create(bool sparse);
+void mem_region_destroy(mem_region_t *region);
+void *mem_region_sbrk(mem_region_t *region, intptr_t incr);
+void mem_region_reset_brk(mem_region_t *region);
+bool mem_region_trim(mem_region_t *region, size_t decr);
+size_t mem_region_room(mem_region_t *region);
+void *mem_region_lo(mem_region_t *region);
+void *mem_region_hi(mem_region_t *region);
+size_t mem_region_size(mem_region_t *region);
+size_t mem_region_peak(mem_region_t *region);
+size_t mem_region_sbrk_calls(mem_region_t *region);
+
+/* Segments: parts of a dense heap mapped apart from the break */
+void *mem_region_segment(mem_region_t *region, size_t size);
+bool mem_region_segment_release(mem_region_t *region, void *start);
+void *mem_region_next_segment(mem_region_t *region, const void *start,
+			      size_t *length);
+bool mem_region_contains(mem_region_t *region, const void *p, size_t len);
+
 /* Functions used for memory emulation */
 
 /* Read len bytes and return value zero-extended to 64 bits */
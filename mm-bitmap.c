@@ -0,0 +1,1612 @@
+/*
+*   mm-bitmap.c
+*   64-bit headerless segregated free list memory allocator, with the block
+*   boundaries and allocation bits kept in side bitmaps
+*
+*  ************************************************************************
+*                               DOCUMENTATION
+*
+*  ** STRUCTURE. **
+*
+*  The heap is cut into granules of 16 bytes, and every block is a whole
+*  number of granules. Blocks have no header and no footer: an allocated
+*  block is all payload, and a 16-byte request takes a 16-byte block.
+*  Instead, two bitmaps describe the granules:
+*
+*  START BITS: 1 for the first granule of every block, free or allocated.
+*              The size of a block is the distance to the next start bit,
+*              found with a bit scan, and the block before it starts at
+*              the previous start bit.
+*
+*  ALLOC BITS: 1 for the first granule of an allocated block. The bits of
+*              the other granules are always 0.
+*
+*  Free blocks keep their size and their links in their first granule:
+*                    block     block+4     block+8           block+size
+*  Unallocated blocks: |  NEXT  |  PREV  |  SIZE  | ... (empty) ... |
+*  The links are 4-byte offsets from the start of the heap in units of 16
+*  bytes, as in mm.c. Two free blocks are never next to each other.
+*
+*  SEGREGATED LIST: There are 12 segregated lists. List i holds the free
+*                   blocks of 16 << i up to 32 << i bytes, and the last one
+*                   holds everything larger.
+*
+*  ************************************************************************
+*  ** SEGMENTS. **
+*
+*  mem_sbrk only grows the heap, so bitmaps at the base of the heap can't
+*  grow with it. The heap is a series of segments instead, each covering a
+*  fixed number of granules, twice as many as the one before it:
+*                  seg    seg+48                  base               limit
+*  Segment:         | SEG_T | START BITS | ALLOC BITS | ... granules ... |
+*  The bitmaps take 1/64 of the granules they cover. Only the last segment
+*  grows; the heap is extended a chunk at a time up to its limit, and then
+*  a new segment is started at the break. Blocks never cross a segment.
+*
+*  ************************************************************************
+*  ** INITIALIZATION. **
+*
+*      start    start+12    start+44
+*  - From start to start+12 the heads of the segregated lists are stored.
+*  - From start+12 to start+44 pointers to the segments are stored.
+*  The first segment is started by the first extension of the heap.
+*
+*  ************************************************************************
+*  ** BLOCK ALLOCATION. **
+*
+*  A request of size S takes a block of S rounded up to 16 bytes. The
+*  first block that fits is taken from the list of its size, or the head
+*  of any larger list, which fits by construction; only the last list is
+*  searched. If nothing fits, the heap is extended. The rest of the block
+*  is split off as a free block by setting a start bit.
+*
+*  free clears the alloc bit, and looks at the start bits on either side
+*  of the block to coalesce it with free neighbours.
+*
+*  The other entry points (batches, sizes, aligned blocks, arenas and
+*  object caches) follow mm.c, on top of the blocks described above.
+*
+*  ************************************************************************
+*  ** HEAPS. **
+*
+*  There is only the default heap, and no maintenance thread. The
+*  mm_heap_* functions of mm.h are stubs: mm_heap_create and
+*  mm_maint_start fail, so mdriver's -X and -B report an error instead of
+*  the build failing to link, and the rest do nothing.
+*/
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "mm.h"
+#include "memlib.h"
+
+/*
+ * If you want debugging output, uncomment the following.  Be sure not
+ * to have debugging enabled in your final submission
+ */
+//#define DEBUG
+
+#ifdef DEBUG
+/* When debugging is enabled, the underlying functions get called */
+#define dbg_printf(...) printf(__VA_ARGS__)
+#define dbg_assert(...) assert(__VA_ARGS__)
+#define dbg_requires(...) assert(__VA_ARGS__)
+#define dbg_ensures(...) assert(__VA_ARGS__)
+#define dbg_checkheap(...) mm_checkheap(__VA_ARGS__)
+#else
+/* When debugging is disabled, no code gets generated */
+#define dbg_printf(...)
+#define dbg_assert(...)
+#define dbg_requires(...)
+#define dbg_ensures(...)
+#define dbg_checkheap(...)
+#endif
+
+/* do not change the following! */
+#ifdef DRIVER
+/* create aliases for driver tests */
+#define malloc mm_malloc
+#define free mm_free
+#define realloc mm_realloc
+#define calloc mm_calloc
+#define memalign mm_memalign
+#define aligned_alloc mm_aligned_alloc
+#define posix_memalign mm_posix_memalign
+#define memset mem_memset
+#define memcpy mem_memcpy
+#endif /* def DRIVER */
+
+/* What is the correct alignment? */
+#define ALIGNMENT 16
+
+/* Basic constants */
+typedef uint64_t word_t;
+static const size_t wsize = sizeof(word_t);   // word size
+static const size_t dsize = 2*wsize;          // granule size
+static const int seg_list_count = 12;         // Number of segregated lists
+static const size_t chunksize = (1 << 11);    // Least heap extension
+static const int segment_max = 32;            // Number of segment pointers
+static const size_t segment_min_size = (1 << 15); // Granule bytes of the first
+
+/* A free block; an allocated block is all payload */
+typedef struct block
+{
+    uint32_t next;             // Next free block in the same list
+    uint32_t prev;             // Previous free block in the same list
+    word_t size;               // Size of the block in bytes
+} block_t;
+
+/* A segment of the heap, at the start of its bitmaps */
+typedef struct segment
+{
+    word_t *start_bits;        // One bit per granule, set at block starts
+    word_t *alloc_bits;        // Set at the starts of allocated blocks
+    char *base;                // First granule
+    char *top;                 // End of the granules in use
+    char *limit;               // End of the granules the bitmaps cover
+    size_t pad;                // Keeps the bitmaps 16-byte aligned
+} segment_t;
+
+/* Chunk of an arena, followed by its data */
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;  // Chunk allocated before this one
+    size_t size;               // Bytes of data that follow
+} arena_chunk_t;
+
+/* An arena, allocated with malloc */
+struct mm_arena
+{
+    arena_chunk_t *chunks;     // Most recently allocated chunk
+    arena_chunk_t *current;    // Chunk the bump pointer is in
+    char *bump;                // Next free byte of the current chunk
+    char *end;                 // End of the current chunk
+    size_t chunk_size;         // Bytes of data in a standard chunk
+};
+
+/* Default size of the data in an arena chunk */
+static const size_t arena_chunk_size = (1 << 14);
+
+/* Slab of a cache, at the start of a block aligned to the slab size */
+typedef struct cache_slab
+{
+    struct cache_slab *next;   // Next slab in the same list of the cache
+    struct cache_slab *prev;   // Previous slab in the same list
+    void *free;                // LIFO list of freed objects
+    char *bump;                // First object never handed out
+    char *end;                 // End of the last object that fits
+    size_t inuse;              // Objects handed out and not freed
+} cache_slab_t;
+
+/* An object cache, allocated with malloc */
+struct mm_cache
+{
+    cache_slab_t *partial;     // Slabs with both free and used objects
+    cache_slab_t *full;        // Slabs with no free objects
+    cache_slab_t *empty;       // Slabs with no used objects
+    size_t objsize;            // Distance between objects
+    size_t align;              // Alignment of the objects
+    size_t slab_size;          // Size and alignment of a slab
+    struct mm_cache *next;     // Next cache, for reaping under pressure
+};
+
+/* Smallest slab, and the least number of objects a slab holds */
+static const size_t slab_min_size = (1 << 14);
+static const size_t slab_min_objects = 8;
+
+/* Global variables */
+
+/* Start of the heap, from which free list links are offsets */
+static char *heap_base = NULL;
+
+/* Pointer to the address where the heads of the segregated lists are stored */
+static block_t **freeListPtr = NULL;
+
+/* Pointer to the address where the segment pointers are stored */
+static segment_t **segments = NULL;
+
+/* Number of segments started so far */
+static int segment_count = 0;
+
+/* Every cache created since mm_init */
+static mm_cache_t *cache_list = NULL;
+
+
+/* Function prototypes for internal helper routines */
+static int find_free_list (size_t size);
+static void insert_free_block (block_t *block, size_t size);
+static void remove_block (block_t *block);
+static block_t *get_next_free (block_t *block);
+static block_t *get_prev_free (block_t *block);
+static void set_next_free (block_t *block, block_t *next);
+static void set_prev_free (block_t *block, block_t *prev);
+static bool test_bit (const word_t *map, size_t i);
+static void set_bit (word_t *map, size_t i);
+static void clear_bit (word_t *map, size_t i);
+static size_t granule_count (const segment_t *seg, const char *end);
+static size_t next_start (const segment_t *seg, size_t g);
+static size_t prev_start (const segment_t *seg, size_t g);
+static segment_t *find_segment (const void *p);
+static segment_t *new_segment (size_t size);
+static block_t *extend_heap (size_t size, segment_t **segp);
+static block_t *find_fit (size_t asize, segment_t **segp);
+static void place (segment_t *seg, block_t *block, size_t asize);
+static size_t block_size (const segment_t *seg, const void *bp);
+static void free_block (segment_t *seg, char *bp, size_t size);
+static size_t adjust_size (size_t size);
+static size_t max(size_t x, size_t y);
+static size_t align(size_t x);
+static bool is_power_of_two (size_t x);
+static arena_chunk_t *arena_new_chunk (mm_arena_t *arena, size_t size);
+static void slab_unlink (cache_slab_t **list, cache_slab_t *slab);
+static void slab_push (cache_slab_t **list, cache_slab_t *slab);
+static size_t reap_caches (void);
+bool mm_checkheap(int lineno);
+
+/*
+ * mm_init: initializes the heap with the list heads and the segment
+ *          pointers; the first segment is started by the first extension.
+ */
+bool mm_init(void)
+{
+    word_t *start = (word_t *)(mem_sbrk((seg_list_count + segment_max) * wsize));
+
+    if (start == (void *)-1)
+    {
+        return false;
+    }
+
+    heap_base = (char *) start;
+    freeListPtr = (block_t **) &(start[0]);
+    segments = (segment_t **) &(start[seg_list_count]);
+    segment_count = 0;
+    cache_list = NULL;
+
+    for (int i = 0; i < seg_list_count; i ++)
+    {
+        freeListPtr[i] = NULL;
+    }
+    for (int i = 0; i < segment_max; i ++)
+    {
+        segments[i] = NULL;
+    }
+    return true;
+}
+
+/*
+ * malloc: allocates a block of size rounded up to 16 bytes, from the first
+ *         free block that fits, or from a heap extension. Returns NULL on
+ *         failure.
+ */
+void *malloc(size_t size)
+{
+    size_t asize;
+    segment_t *seg;
+    block_t *block;
+
+    if (heap_base == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+
+    if (size == 0 || size > SIZE_MAX - dsize) // Ignore spurious request
+    {
+        return NULL;
+    }
+
+    asize = adjust_size (size);
+    block = find_fit(asize, &seg);
+    if (block == NULL && cache_list != NULL && reap_caches() > 0)
+    {
+        // Empty slabs were given back; search again before growing
+        block = find_fit(asize, &seg);
+    }
+    if (block == NULL)
+    {
+        block = extend_heap(asize, &seg);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+    }
+    place(seg, block, asize);
+    dbg_checkheap(__LINE__);
+    return block;
+}
+
+/*
+ * free: clears the alloc bit of the block and coalesces it with its free
+ *       neighbours.
+ */
+void free(void *bp)
+{
+    segment_t *seg;
+
+    if (bp == NULL)
+    {
+        return;
+    }
+    seg = find_segment (bp);
+    free_block (seg, bp, block_size (seg, bp));
+    dbg_checkheap(__LINE__);
+}
+
+/*
+ * mm_free_sized: frees a block whose size the caller knows: either the size
+ *                passed to malloc, or the usable size reported for it. If
+ *                a block does not start right after that many bytes (a
+ *                small remainder was absorbed into the block when it was
+ *                placed), the size is found with a bit scan as usual.
+ */
+void mm_free_sized(void *bp, size_t size)
+{
+    segment_t *seg;
+    size_t asize;
+    size_t g;
+
+    if (bp == NULL)
+    {
+        return;
+    }
+    seg = find_segment (bp);
+    asize = adjust_size (size);
+    g = granule_count (seg, (char *) bp + asize);
+
+    if ((char *) bp + asize > seg -> top ||
+        ((char *) bp + asize < seg -> top && !test_bit (seg -> start_bits, g)))
+    {
+        asize = block_size (seg, bp);
+    }
+    free_block (seg, bp, asize);
+}
+
+/*
+ * mm_usable_size: returns the number of bytes that may be used at bp, which
+ *                 is the whole block.
+ */
+size_t mm_usable_size(void *bp)
+{
+    if (bp == NULL)
+    {
+        return 0;
+    }
+    return block_size (find_segment (bp), bp);
+}
+
+/*
+ * mm_malloc_usable: like malloc, but also stores the usable size of the
+ *                   new block in *usable (0 if the allocation fails).
+ */
+void *mm_malloc_usable(size_t size, size_t *usable)
+{
+    void *bp = malloc(size);
+
+    if (usable != NULL)
+    {
+        *usable = (bp == NULL) ? 0 : mm_usable_size(bp);
+    }
+    return bp;
+}
+
+/*
+ * mm_malloc_batch: allocates n blocks of size bytes each and stores their
+ *                  pointers in out. Returns n, or 0 if the heap could not
+ *                  be extended, in which case the blocks already
+ *                  allocated are freed again.
+ */
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t done;
+
+    if (size == 0)
+    {
+        return 0;
+    }
+    for (done = 0; done < n; done ++)
+    {
+        out[done] = malloc(size);
+        if (out[done] == NULL)
+        {
+            mm_free_batch(out, done);
+            return 0;
+        }
+    }
+    return n;
+}
+
+/*
+ * mm_free_batch: frees the n blocks in ptrs, in order, leaving ptrs as it
+ *                was. Adjacent blocks are coalesced as each one is freed.
+ *                NULL pointers are ignored.
+ */
+void mm_free_batch(void **ptrs, size_t n)
+{
+    for (size_t i = 0; i < n; i ++)
+    {
+        free(ptrs[i]);
+    }
+}
+
+/*
+ * realloc: returns a pointer to an allocated region of at least size bytes:
+ *          if ptr is NULL, then call malloc(size);
+ *          if size == 0, then call free(ptr) and returns NULL;
+ *          else allocates new region of memory, copies old data to new memory,
+ *          and then free old block. Returns NULL, leaving the old block
+ *          untouched, if the new one can't be allocated.
+ */
+void *realloc(void *ptr, size_t size)
+{
+    size_t copysize;
+    void *newptr;
+
+    if (size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (ptr == NULL)
+    {
+        return malloc(size);
+    }
+
+    newptr = malloc(size);
+    if (!newptr)
+    {
+        return NULL;
+    }
+
+    copysize = mm_usable_size(ptr);
+    if (size < copysize)
+    {
+        copysize = size;
+    }
+    memcpy(newptr, ptr, copysize);
+    free(ptr);
+    return newptr;
+}
+
+/*
+ * calloc: allocates nmemb * size bytes through malloc, and sets them to 0.
+ *         Returns NULL on failure.
+ */
+void *calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+    size_t asize = nmemb * size;
+
+    if (nmemb != 0 && asize / nmemb != size)
+    {
+        // Multiplication overflowed
+        return NULL;
+    }
+    bp = malloc(asize);
+    if (bp == NULL)
+    {
+        return NULL;
+    }
+    memset(bp, 0, asize);
+    return bp;
+}
+
+/*
+ * memalign: allocates size bytes whose address is a multiple of alignment,
+ *           which must be a power of two. The granules in front of the
+ *           aligned address are split off as a free block. Returns NULL
+ *           on failure.
+ */
+void *memalign(size_t alignment, size_t size)
+{
+    size_t asize;
+    size_t need;       // Size of free block that surely holds an aligned fit
+    size_t lead;       // Bytes in front of the aligned block
+    size_t csize;
+    segment_t *seg;
+    block_t *block;
+    char *bp;
+
+    if (!is_power_of_two (alignment))
+    {
+        return NULL;
+    }
+    if (alignment <= ALIGNMENT)
+    {
+        return malloc(size);
+    }
+
+    if (heap_base == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+
+    if (size == 0 || size > SIZE_MAX - 2 * alignment)
+    {
+        return NULL;
+    }
+
+    asize = adjust_size (size);
+    need = asize + alignment - dsize;
+
+    block = find_fit(need, &seg);
+    if (block == NULL)
+    {
+        block = extend_heap(need, &seg);
+        if (block == NULL)
+        {
+            return NULL;
+        }
+    }
+
+    bp = (char *) block;
+    lead = (((uintptr_t) bp + alignment - 1) & ~(uintptr_t) (alignment - 1))
+           - (uintptr_t) bp;
+    if (lead > 0)
+    {
+        // The block in front stays free, and its neighbour before it is
+        // allocated, or it would have been coalesced with the whole block
+        csize = block -> size;
+        set_bit (seg -> start_bits, granule_count (seg, bp + lead));
+        insert_free_block (block, lead);
+        block = (block_t *) (bp + lead);
+        block -> size = csize - lead;
+    }
+    place(seg, block, asize);
+    dbg_checkheap(__LINE__);
+    return block;
+}
+
+/*
+ * aligned_alloc: C11 interface to memalign.
+ */
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+/*
+ * posix_memalign: POSIX interface to memalign. Stores the block in *memptr
+ *                 and returns 0, or returns EINVAL if alignment is not a
+ *                 power of two multiple of sizeof(void *), or ENOMEM.
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (!is_power_of_two (alignment) || alignment % sizeof(void *) != 0)
+    {
+        return EINVAL;
+    }
+    bp = memalign(alignment, size);
+    if (bp == NULL && size != 0)
+    {
+        return ENOMEM;
+    }
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_arena_create: returns a new, empty arena whose chunks hold chunk_size
+ *                  bytes (or a default if chunk_size is 0), or NULL.
+ */
+mm_arena_t *mm_arena_create(size_t chunk_size)
+{
+    mm_arena_t *arena = malloc(sizeof(mm_arena_t));
+
+    if (arena == NULL)
+    {
+        return NULL;
+    }
+    arena -> chunks = NULL;
+    arena -> current = NULL;
+    arena -> bump = NULL;
+    arena -> end = NULL;
+    arena -> chunk_size = (chunk_size == 0) ? arena_chunk_size : align(chunk_size);
+    return arena;
+}
+
+/*
+ * mm_arena_alloc: returns size bytes from the arena, aligned like malloc,
+ *                 or NULL if a new chunk is needed and can't be allocated.
+ *                 The block lives until the arena is reset or destroyed.
+ */
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
+{
+    char *bp;
+    arena_chunk_t *chunk;
+
+    if (size == 0 || size > SIZE_MAX - ALIGNMENT) // Would wrap when aligned
+    {
+        return NULL;
+    }
+    size = align(size);
+
+    if (size <= (size_t) (arena -> end - arena -> bump)) // Common case
+    {
+        bp = arena -> bump;
+        arena -> bump += size;
+        return bp;
+    }
+
+    // Big requests get their own chunk and leave the current one alone
+    if (size > arena -> chunk_size / 4)
+    {
+        chunk = arena_new_chunk (arena, size);
+        return (chunk == NULL) ? NULL : (void *) (chunk + 1);
+    }
+
+    chunk = arena_new_chunk (arena, arena -> chunk_size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    arena -> current = chunk;
+    arena -> bump = (char *) (chunk + 1) + size;
+    arena -> end = (char *) (chunk + 1) + chunk -> size;
+    return chunk + 1;
+}
+
+/*
+ * mm_arena_reset: releases every block in the arena. All chunks but the
+ *                 current one are freed; the current one is kept for the
+ *                 next round of allocations.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    arena_chunk_t *chunk = arena -> chunks;
+    arena_chunk_t *next;
+
+    while (chunk != NULL)
+    {
+        next = chunk -> next;
+        if (chunk != arena -> current)
+        {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    chunk = arena -> current;
+    arena -> chunks = chunk;
+    if (chunk != NULL)
+    {
+        chunk -> next = NULL;
+        arena -> bump = (char *) (chunk + 1);
+    }
+}
+
+/*
+ * mm_arena_destroy: releases every block in the arena and the arena itself.
+ */
+void mm_arena_destroy(mm_arena_t *arena)
+{
+    if (arena == NULL)
+    {
+        return;
+    }
+    mm_arena_reset(arena);
+    free(arena -> current);
+    free(arena);
+}
+
+/*
+ * mm_cache_create: returns a new cache of objects of objsize bytes, aligned
+ *                  to align bytes (a power of two; 0 means as malloc), or
+ *                  NULL on failure.
+ */
+mm_cache_t *mm_cache_create(size_t objsize, size_t align)
+{
+    mm_cache_t *cache;
+    size_t slab_size = slab_min_size;
+
+    if (align == 0)
+    {
+        align = ALIGNMENT;
+    }
+    if (!is_power_of_two (align) || objsize == 0 ||
+        objsize > SIZE_MAX / (4 * slab_min_objects) ||
+        align > SIZE_MAX / (4 * slab_min_objects))
+    {
+        return NULL;
+    }
+    if (align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+    objsize = (max(objsize, sizeof(void *)) + align - 1) & ~(align - 1);
+
+    // A slab holds its header and at least slab_min_objects objects
+    while (slab_size < sizeof(cache_slab_t) + align +
+                       slab_min_objects * objsize)
+    {
+        slab_size *= 2;
+    }
+
+    cache = malloc(sizeof(mm_cache_t));
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    cache -> partial = NULL;
+    cache -> full = NULL;
+    cache -> empty = NULL;
+    cache -> objsize = objsize;
+    cache -> align = align;
+    cache -> slab_size = slab_size;
+    cache -> next = cache_list;
+    cache_list = cache;
+    return cache;
+}
+
+/*
+ * mm_cache_alloc: returns an object from the cache, or NULL on failure.
+ */
+void *mm_cache_alloc(mm_cache_t *cache)
+{
+    cache_slab_t *slab = cache -> partial;
+    void *obj;
+
+    if (slab == NULL)
+    {
+        slab = cache -> empty;
+        if (slab != NULL)
+        {
+            slab_unlink (&(cache -> empty), slab);
+        }
+        else
+        {
+            // Blocks have no header, so slabs fill their slab_size exactly
+            size_t bytes = cache -> slab_size;
+            uintptr_t first = (uintptr_t) (slab = memalign(cache -> slab_size,
+                                                            bytes));
+            if (slab == NULL)
+            {
+                return NULL;
+            }
+            // Objects start at the first aligned address after the header
+            first = (first + sizeof(cache_slab_t) + cache -> align - 1)
+                        & ~(uintptr_t) (cache -> align - 1);
+            slab -> free = NULL;
+            slab -> bump = (char *) first;
+            slab -> end = (char *) slab + bytes;
+            slab -> inuse = 0;
+        }
+        slab_push (&(cache -> partial), slab);
+    }
+
+    if (slab -> free != NULL) // Most recently freed object first
+    {
+        obj = slab -> free;
+        slab -> free = *(void **) obj;
+    }
+    else
+    {
+        obj = slab -> bump;
+        slab -> bump += cache -> objsize;
+    }
+    slab -> inuse ++;
+
+    if (slab -> free == NULL &&
+        (size_t) (slab -> end - slab -> bump) < cache -> objsize)
+    {
+        slab_unlink (&(cache -> partial), slab);
+        slab_push (&(cache -> full), slab);
+    }
+    return obj;
+}
+
+/*
+ * mm_cache_free: returns obj, which came from mm_cache_alloc on the same
+ *                cache, to the cache.
+ */
+void mm_cache_free(mm_cache_t *cache, void *obj)
+{
+    cache_slab_t *slab;
+    bool was_full;
+
+    if (obj == NULL)
+    {
+        return;
+    }
+    slab = (cache_slab_t *) ((uintptr_t) obj & ~(uintptr_t) (cache -> slab_size - 1));
+    was_full = (slab -> free == NULL &&
+                (size_t) (slab -> end - slab -> bump) < cache -> objsize);
+
+    *(void **) obj = slab -> free;
+    slab -> free = obj;
+    slab -> inuse --;
+
+    if (slab -> inuse == 0)
+    {
+        slab_unlink (was_full ? &(cache -> full) : &(cache -> partial), slab);
+        slab_push (&(cache -> empty), slab);
+    }
+    else if (was_full)
+    {
+        slab_unlink (&(cache -> full), slab);
+        slab_push (&(cache -> partial), slab);
+    }
+}
+
+/*
+ * mm_cache_reap: gives the empty slabs of the cache back to the heap, and
+ *                returns how many there were.
+ */
+size_t mm_cache_reap(mm_cache_t *cache)
+{
+    size_t n = 0;
+    cache_slab_t *slab;
+
+    while ((slab = cache -> empty) != NULL)
+    {
+        cache -> empty = slab -> next;
+        free(slab);
+        n ++;
+    }
+    return n;
+}
+
+/*
+ * mm_cache_destroy: gives every slab of the cache back to the heap, along
+ *                   with the cache itself. Objects still in use are lost.
+ */
+void mm_cache_destroy(mm_cache_t *cache)
+{
+    mm_cache_t **iter;
+    cache_slab_t *slab;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+    for (iter = &cache_list; *iter != NULL; iter = &((*iter) -> next))
+    {
+        if (*iter == cache)
+        {
+            *iter = cache -> next;
+            break;
+        }
+    }
+
+    mm_cache_reap(cache);
+    while ((slab = cache -> partial) != NULL)
+    {
+        cache -> partial = slab -> next;
+        free(slab);
+    }
+    while ((slab = cache -> full) != NULL)
+    {
+        cache -> full = slab -> next;
+        free(slab);
+    }
+    free(cache);
+}
+
+/******** The remaining content below are helper and debug routines ********/
+
+/*
+ * find_free_list: returns the index of the segregated list for blocks of
+ *                 size bytes: the position of the highest bit of the
+ *                 number of granules, up to the last list.
+ */
+static int find_free_list (size_t size)
+{
+    int i = 63 - __builtin_clzll(size / dsize);
+
+    return (i < seg_list_count) ? i : seg_list_count - 1;
+}
+
+/*
+ * insert_free_block: writes the size into a free block and inserts it at
+ *                    the start of its segregated list.
+ */
+static void insert_free_block (block_t *block, size_t size)
+{
+    int i = find_free_list (size);
+    block_t *head = freeListPtr[i];
+
+    block -> size = size;
+    set_prev_free (block, NULL);
+    set_next_free (block, head);
+    if (head != NULL)
+    {
+        set_prev_free (head, block);
+    }
+    freeListPtr[i] = block;
+}
+
+/*
+ * remove_block: unlinks a free block from its segregated list.
+ */
+static void remove_block (block_t *block)
+{
+    block_t *next = get_next_free (block);
+    block_t *prev = get_prev_free (block);
+
+    if (prev == NULL)
+    {
+        freeListPtr[find_free_list (block -> size)] = next;
+    }
+    else
+    {
+        set_next_free (prev, next);
+    }
+    if (next != NULL)
+    {
+        set_prev_free (next, prev);
+    }
+}
+
+/*
+ * get_next_free: returns the free block after block in its list, or NULL.
+ */
+static block_t *get_next_free (block_t *block)
+{
+    uint32_t link = block -> next;
+
+    return (link == 0) ? NULL : (block_t *) (heap_base + ((size_t) link << 4));
+}
+
+/*
+ * get_prev_free: returns the free block before block in its list, or NULL.
+ */
+static block_t *get_prev_free (block_t *block)
+{
+    uint32_t link = block -> prev;
+
+    return (link == 0) ? NULL : (block_t *) (heap_base + ((size_t) link << 4));
+}
+
+/*
+ * set_next_free: links next (or NULL) after block.
+ */
+static void set_next_free (block_t *block, block_t *next)
+{
+    block -> next = (next == NULL) ? 0 : (uint32_t) (((char *) next - heap_base) >> 4);
+}
+
+/*
+ * set_prev_free: links prev (or NULL) before block.
+ */
+static void set_prev_free (block_t *block, block_t *prev)
+{
+    block -> prev = (prev == NULL) ? 0 : (uint32_t) (((char *) prev - heap_base) >> 4);
+}
+
+/*
+ * test_bit: returns bit i of the bitmap.
+ */
+static bool test_bit (const word_t *map, size_t i)
+{
+    return (map[i >> 6] >> (i & 63)) & 1;
+}
+
+/*
+ * set_bit: sets bit i of the bitmap.
+ */
+static void set_bit (word_t *map, size_t i)
+{
+    map[i >> 6] |= (word_t) 1 << (i & 63);
+}
+
+/*
+ * clear_bit: clears bit i of the bitmap.
+ */
+static void clear_bit (word_t *map, size_t i)
+{
+    map[i >> 6] &= ~((word_t) 1 << (i & 63));
+}
+
+/*
+ * granule_count: returns the index of the granule at end in the segment,
+ *                which is the number of granules before it.
+ */
+static size_t granule_count (const segment_t *seg, const char *end)
+{
+    return (size_t) (end - seg -> base) / dsize;
+}
+
+/*
+ * next_start: returns the first granule after granule g that starts a
+ *             block, or the granule at the top of the segment. The bits
+ *             past the top are all 0.
+ */
+static size_t next_start (const segment_t *seg, size_t g)
+{
+    size_t top = granule_count (seg, seg -> top);
+    size_t i = g + 1;
+    size_t w = i >> 6;
+    word_t bits;
+
+    if (i >= top)
+    {
+        return top;
+    }
+    bits = seg -> start_bits[w] & (~(word_t) 0 << (i & 63));
+    while (bits == 0)
+    {
+        w ++;
+        if ((w << 6) >= top)
+        {
+            return top;
+        }
+        bits = seg -> start_bits[w];
+    }
+    return (w << 6) + __builtin_ctzll(bits);
+}
+
+/*
+ * prev_start: returns the last granule before granule g (which is not the
+ *             first) that starts a block. The first granule of a segment
+ *             always starts a block, so the scan ends there.
+ */
+static size_t prev_start (const segment_t *seg, size_t g)
+{
+    size_t i = g - 1;
+    size_t w = i >> 6;
+    word_t bits = seg -> start_bits[w];
+
+    if ((i & 63) != 63)
+    {
+        bits &= ((word_t) 1 << ((i & 63) + 1)) - 1;
+    }
+    while (bits == 0)
+    {
+        bits = seg -> start_bits[-- w];
+    }
+    return (w << 6) + 63 - __builtin_clzll(bits);
+}
+
+/*
+ * find_segment: returns the segment that holds p. Most blocks are in the
+ *               last segments, which are the largest, so the search
+ *               starts from the end.
+ */
+static segment_t *find_segment (const void *p)
+{
+    int i = segment_count - 1;
+
+    while (i > 0 && (const char *) p < segments[i] -> base)
+    {
+        i --;
+    }
+    return segments[i];
+}
+
+/*
+ * new_segment: starts a segment at the break, with bitmaps for at least
+ *              size bytes of granules and twice as many as the segment
+ *              before it. Returns NULL if the heap can't be extended.
+ */
+static segment_t *new_segment (size_t size)
+{
+    size_t bytes = segment_min_size;
+    size_t map_size;
+    segment_t *seg;
+
+    if (segment_count == segment_max || size > SIZE_MAX / 2) // bytes would wrap
+    {
+        return NULL;
+    }
+    if (segment_count > 0)
+    {
+        segment_t *last = segments[segment_count - 1];
+        bytes = 2 * (size_t) (last -> limit - last -> base);
+    }
+    while (bytes < size)
+    {
+        bytes *= 2;
+    }
+
+    // One bit per granule in each of the two bitmaps
+    map_size = bytes / dsize / 8;
+    seg = mem_sbrk(sizeof(segment_t) + 2 * map_size);
+    if (seg == (void *)-1)
+    {
+        return NULL;
+    }
+    seg -> start_bits = (word_t *) (seg + 1);
+    seg -> alloc_bits = (word_t *) ((char *) (seg + 1) + map_size);
+    seg -> base = (char *) (seg + 1) + 2 * map_size;
+    seg -> top = seg -> base;
+    seg -> limit = seg -> base + bytes;
+    memset(seg + 1, 0, 2 * map_size);
+    segments[segment_count ++] = seg;
+    return seg;
+}
+
+/*
+ * extend_heap: extends the last segment by at least size bytes (or starts
+ *              a new one if it is full) and returns the free block at the
+ *              top, which is merged with a free block that was already
+ *              there. The block is not on any list. Returns NULL if the
+ *              heap can't be extended.
+ */
+static block_t *extend_heap (size_t size, segment_t **segp)
+{
+    segment_t *seg = (segment_count == 0) ? NULL : segments[segment_count - 1];
+    block_t *block;
+    size_t tail = 0;   // Size of the free block at the top
+    size_t top;
+    size_t grow;
+
+    if (seg != NULL && seg -> top > seg -> base)
+    {
+        top = granule_count (seg, seg -> top);
+        size_t last = prev_start (seg, top);
+        if (!test_bit (seg -> alloc_bits, last))
+        {
+            tail = (top - last) * dsize;
+        }
+    }
+
+    grow = max(size - tail, chunksize);
+    if (seg == NULL || grow > (size_t) (seg -> limit - seg -> top))
+    {
+        // The rest of the segment, if it is enough, or a new one
+        grow = size - tail;
+        if (seg == NULL || grow > (size_t) (seg -> limit - seg -> top))
+        {
+            seg = new_segment (max(size, chunksize));
+            if (seg == NULL)
+            {
+                return NULL;
+            }
+            tail = 0;
+            grow = max(size, chunksize);
+        }
+    }
+
+    if (mem_sbrk(grow) == (void *)-1)
+    {
+        return NULL;
+    }
+    if (tail > 0)
+    {
+        block = (block_t *) (seg -> top - tail);
+        remove_block (block);
+    }
+    else
+    {
+        block = (block_t *) seg -> top;
+        set_bit (seg -> start_bits, granule_count (seg, seg -> top));
+    }
+    seg -> top += grow;
+    block -> size = tail + grow;
+    *segp = seg;
+    return block;
+}
+
+/*
+ * find_fit: returns the first free block of at least asize bytes in the
+ *           list for its size, or the head of a larger list, which fits
+ *           by construction. The block is removed from its list. Returns
+ *           NULL if nothing fits.
+ */
+static block_t *find_fit (size_t asize, segment_t **segp)
+{
+    int i = find_free_list (asize);
+    block_t *block;
+
+    for (block = freeListPtr[i]; block != NULL; block = get_next_free (block))
+    {
+        if (block -> size >= asize)
+        {
+            break;
+        }
+    }
+    for (i ++; block == NULL && i < seg_list_count; i ++)
+    {
+        block = freeListPtr[i];
+        // The last list holds blocks of any larger size
+        while (i == seg_list_count - 1 && block != NULL && block -> size < asize)
+        {
+            block = get_next_free (block);
+        }
+    }
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    remove_block (block);
+    *segp = find_segment (block);
+    return block;
+}
+
+/*
+ * place: marks a free block, which is not on any list, allocated, and
+ *        splits whatever is left past asize bytes off as a free block.
+ */
+static void place (segment_t *seg, block_t *block, size_t asize)
+{
+    size_t csize = block -> size;
+    size_t g = granule_count (seg, (char *) block);
+
+    if (csize > asize)
+    {
+        set_bit (seg -> start_bits, g + asize / dsize);
+        insert_free_block ((block_t *) ((char *) block + asize), csize - asize);
+    }
+    set_bit (seg -> alloc_bits, g);
+}
+
+/*
+ * block_size: returns the size of the block at bp, from the distance to
+ *             the next start bit.
+ */
+static size_t block_size (const segment_t *seg, const void *bp)
+{
+    size_t g = granule_count (seg, bp);
+
+    return (next_start (seg, g) - g) * dsize;
+}
+
+/*
+ * free_block: frees the allocated block of size bytes at bp, coalesces it
+ *             with a free block on either side, and inserts the result.
+ */
+static void free_block (segment_t *seg, char *bp, size_t size)
+{
+    size_t g = granule_count (seg, bp);
+    size_t end = g + size / dsize;
+    block_t *block = (block_t *) bp;
+
+    dbg_requires(test_bit (seg -> alloc_bits, g));
+    clear_bit (seg -> alloc_bits, g);
+
+    if (bp + size < seg -> top && !test_bit (seg -> alloc_bits, end))
+    {
+        block_t *next = (block_t *) (bp + size);
+        remove_block (next);
+        clear_bit (seg -> start_bits, end);
+        size += next -> size;
+    }
+    if (g > 0)
+    {
+        size_t p = prev_start (seg, g);
+        if (!test_bit (seg -> alloc_bits, p))
+        {
+            block = (block_t *) (seg -> base + p * dsize);
+            remove_block (block);
+            clear_bit (seg -> start_bits, g);
+            size += block -> size;
+        }
+    }
+    insert_free_block (block, size);
+}
+
+/*
+ * adjust_size: rounds a request up to a whole number of granules.
+ */
+static size_t adjust_size (size_t size)
+{
+    return align(size);
+}
+
+/*
+ * max: returns x if x > y, and y otherwise.
+ */
+static size_t max(size_t x, size_t y)
+{
+    return (x > y) ? x : y;
+}
+
+/*
+ * align: rounds up to the nearest multiple of ALIGNMENT.
+ */
+static size_t align(size_t x)
+{
+    return ALIGNMENT * ((x+ALIGNMENT-1)/ALIGNMENT);
+}
+
+/*
+ * is_power_of_two: returns true if x is a power of two.
+ */
+static bool is_power_of_two (size_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+/*
+ * arena_new_chunk: allocates a chunk of size bytes of data for the arena
+ *                  and puts it at the head of its chunk list.
+ */
+static arena_chunk_t *arena_new_chunk (mm_arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk;
+
+    if (size > SIZE_MAX - sizeof(arena_chunk_t)) // Chunk size overflows
+    {
+        return NULL;
+    }
+    chunk = malloc(sizeof(arena_chunk_t) + size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    chunk -> size = size;
+    chunk -> next = arena -> chunks;
+    arena -> chunks = chunk;
+    return chunk;
+}
+
+/*
+ * slab_unlink: removes slab from the list it is on.
+ */
+static void slab_unlink (cache_slab_t **list, cache_slab_t *slab)
+{
+    if (slab -> prev == NULL)
+    {
+        *list = slab -> next;
+    }
+    else
+    {
+        slab -> prev -> next = slab -> next;
+    }
+    if (slab -> next != NULL)
+    {
+        slab -> next -> prev = slab -> prev;
+    }
+}
+
+/*
+ * slab_push: puts slab at the head of list.
+ */
+static void slab_push (cache_slab_t **list, cache_slab_t *slab)
+{
+    slab -> prev = NULL;
+    slab -> next = *list;
+    if (*list != NULL)
+    {
+        (*list) -> prev = slab;
+    }
+    *list = slab;
+}
+
+/*
+ * reap_caches: gives the empty slabs of every cache back to the heap, and
+ *              returns how many there were.
+ */
+static size_t reap_caches (void)
+{
+    size_t n = 0;
+
+    for (mm_cache_t *cache = cache_list; cache != NULL; cache = cache -> next)
+    {
+        n += mm_cache_reap(cache);
+    }
+    return n;
+}
+
+/*
+ * mm_maint_start: there is no maintenance thread; always returns false.
+ */
+bool mm_maint_start(double cpu_share)
+{
+    (void) cpu_share;
+    return false;
+}
+
+/*
+ * mm_maint_stop: does nothing, as no maintenance thread is ever started.
+ */
+void mm_maint_stop(void)
+{
+}
+
+/*
+ * mm_heap_create: heaps of their own are not supported; returns NULL.
+ */
+mm_heap_t *mm_heap_create(struct mem_region *region)
+{
+    (void) region;
+    return NULL;
+}
+
+/*
+ * The functions below take a heap that mm_heap_create never returns, so
+ * they are only there to link: they fail, or do nothing.
+ */
+void *mm_heap_malloc(mm_heap_t *heap, size_t size)
+{
+    (void) heap;
+    (void) size;
+    return NULL;
+}
+
+void mm_heap_free(mm_heap_t *heap, void *ptr)
+{
+    (void) heap;
+    (void) ptr;
+}
+
+void mm_heap_free_sized(mm_heap_t *heap, void *ptr, size_t size)
+{
+    (void) heap;
+    (void) ptr;
+    (void) size;
+}
+
+void mm_heap_free_remote(mm_heap_t *heap, void *ptr)
+{
+    (void) heap;
+    (void) ptr;
+}
+
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size)
+{
+    (void) heap;
+    (void) ptr;
+    (void) size;
+    return NULL;
+}
+
+void *mm_heap_calloc(mm_heap_t *heap, size_t nmemb, size_t size)
+{
+    (void) heap;
+    (void) nmemb;
+    (void) size;
+    return NULL;
+}
+
+void *mm_heap_memalign(mm_heap_t *heap, size_t alignment, size_t size)
+{
+    (void) heap;
+    (void) alignment;
+    (void) size;
+    return NULL;
+}
+
+size_t mm_heap_malloc_batch(mm_heap_t *heap, size_t size, size_t n, void **out)
+{
+    (void) heap;
+    (void) size;
+    (void) n;
+    (void) out;
+    return 0;
+}
+
+void mm_heap_free_batch(mm_heap_t *heap, void **ptrs, size_t n)
+{
+    (void) heap;
+    (void) ptrs;
+    (void) n;
+}
+
+mm_arena_t *mm_heap_arena_create(mm_heap_t *heap, size_t chunk_size)
+{
+    (void) heap;
+    (void) chunk_size;
+    return NULL;
+}
+
+mm_cache_t *mm_heap_cache_create(mm_heap_t *heap, size_t objsize, size_t align)
+{
+    (void) heap;
+    (void) objsize;
+    (void) align;
+    return NULL;
+}
+
+bool mm_heap_checkheap(mm_heap_t *heap, int lineno)
+{
+    (void) heap;
+    (void) lineno;
+    return false;
+}
+
+/*
+ * mm_checkheap: walks every segment by its start bits and checks that
+ *               - segments are back to back, with their tops in bounds,
+ *               - no bits are set past the top of a segment,
+ *               - alloc bits are only set where blocks start,
+ *               - free blocks know their size and are never adjacent,
+ *               - free list links agree, and every block is on the list
+ *                 for its size, with as many on the lists as in the heap.
+ *               Returns false and prints the problem if one is found.
+ */
+bool mm_checkheap(int lineno)
+{
+    size_t heap_free = 0;
+    size_t list_free = 0;
+
+    if (heap_base == NULL)
+    {
+        return true;
+    }
+
+    for (int s = 0; s < segment_count; s ++)
+    {
+        segment_t *seg = segments[s];
+        size_t top = granule_count (seg, seg -> top);
+        size_t words = granule_count (seg, seg -> limit) / 64;
+        bool prev_free = false;
+
+        if (seg -> top < seg -> base || seg -> top > seg -> limit ||
+            (s + 1 < segment_count && (char *) segments[s + 1] != seg -> top) ||
+            (s + 1 == segment_count && seg -> top != (char *) mem_heap_hi() + 1))
+        {
+            printf("Line %d: segment %d at %p has a bad top %p\n", lineno, s, (void *) seg, (void *) seg -> top);
+            return false;
+        }
+        for (size_t w = 0; w < words; w ++)
+        {
+            word_t start = seg -> start_bits[w];
+            word_t used = ((w << 6) + 64 <= top) ? ~(word_t) 0 :
+                          ((w << 6) >= top) ? 0 : (((word_t) 1 << (top & 63)) - 1);
+
+            if ((start & ~used) != 0 || (seg -> alloc_bits[w] & ~start) != 0)
+            {
+                printf("Line %d: segment %d has stray bits in word %zu\n", lineno, s, w);
+                return false;
+            }
+        }
+        if (top > 0 && !test_bit (seg -> start_bits, 0))
+        {
+            printf("Line %d: segment %d does not start with a block\n", lineno, s);
+            return false;
+        }
+
+        for (size_t g = 0; g < top; g = next_start (seg, g))
+        {
+            size_t size = (next_start (seg, g) - g) * dsize;
+            block_t *block = (block_t *) (seg -> base + g * dsize);
+
+            if (test_bit (seg -> alloc_bits, g))
+            {
+                prev_free = false;
+                continue;
+            }
+            if (prev_free)
+            {
+                printf("Line %d: free blocks next to each other at %p\n", lineno, (void *) block);
+                return false;
+            }
+            if (block -> size != size)
+            {
+                printf("Line %d: free block %p has size %zu, not %zu\n", lineno, (void *) block, (size_t) block -> size, size);
+                return false;
+            }
+            prev_free = true;
+            heap_free ++;
+        }
+    }
+
+    for (int i = 0; i < seg_list_count; i ++)
+    {
+        block_t *prev = NULL;
+
+        for (block_t *block = freeListPtr[i]; block != NULL; block = get_next_free (block))
+        {
+            if (get_prev_free (block) != prev)
+            {
+                printf("Line %d: free block %p has a bad prev link\n", lineno, (void *) block);
+                return false;
+            }
+            if (find_free_list (block -> size) != i)
+            {
+                printf("Line %d: free block %p of size %zu is on list %d\n", lineno, (void *) block, (size_t) block -> size, i);
+                return false;
+            }
+            if (++ list_free > heap_free)
+            {
+                printf("Line %d: list %d has more blocks than the heap, or a cycle\n", lineno, i);
+                return false;
+            }
+            prev = block;
+        }
+    }
+    if (list_free != heap_free)
+    {
+        printf("Line %d: %zu free blocks in the heap, %zu on the lists\n", lineno, heap_free, list_free);
+        return false;
+    }
+    return true;
+}
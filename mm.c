@@ -18,19 +18,33 @@ Andrew Id : mshaheer*/
 *            block in memory. If the seconf last bit is 1 it means that the 
 *            previous
 *            block is allocated.                                                 
-*          - The whole 8-byte value with the last two bits set to 0 
+*          - The third last bit is 1 when the previous block is a free mini
+*            block, which has no footer. It is only meaningful when the
+*            previous block is free.
+*          - The fourth last bit is 1 on an allocated block that realloc
+*            has grown (see REALLOC below).
+*          - The whole 8-byte value with the last four bits set to 0 
 *            represents the size of the block as a size_t                    
 *            The size of a block includes the header and footer. 
 
 *  FOOTER: 8-byte, aligned to 0th byte of an 16-byte aligned heap. It        
 *          contains the exact copy of the block's header. It is only present in 
-*          the free blocks inside the segregated list
+*          the free blocks inside the segregated list, other than mini blocks
 
-*  SEGREGATED LIST: There are 11 segregated lists in total and each stores free
+*  LINKS: The next and previous links of a free block are 4-byte offsets
+*         from the start of the heap, in units of 16 bytes, so they reach
+*         64 GB of heap, segments included, and fit in the 8 bytes after
+*         the header. Built with
+*         WIDE_LINKS defined, the links are 8-byte pointers instead, for
+*         sparse heaps larger than that.
+
+*  SEGREGATED LIST: There are 12 segregated lists in total. The first holds
+*                   the mini blocks, and each of the others stores free
 *                   blocks according to powers of 2 according to the buddy 
 *                   system as mentioned in the book.
 *                  
-*  The minimum blocksize is 32 bytes.                                        
+*  The minimum blocksize is 16 bytes (32 bytes with WIDE_LINKS). A 16-byte 
+*  block is a mini block: a free one holds only its header and its links.  
 *                                                                            
 *  Allocated blocks contain the following:                                   
 *  HEADER, as defined above.                                                 
@@ -39,8 +53,10 @@ Andrew Id : mshaheer*/
 *                                                                            
 *  Free blocks contain the following:                                        
 *  HEADER, as defined above.                                                 
-*  FOOTER, as defined above.                                                 
-*  The size of an unallocated block is at least 32 bytes.                    
+*  FOOTER, as defined above, except in a free mini block, which has no    
+*  room for one; the next block's header marks it as mini instead.          
+*  The size of an unallocated block is at least 16 bytes (32 bytes with    
+*  WIDE_LINKS).                                                             
 *                                                                            
 *  Block Visualization.                                                      
 *                    block     block+8            block+size      
@@ -52,15 +68,21 @@ Andrew Id : mshaheer*/
 *  ************************************************************************  
 *  ** INITIALIZATION. **                                                     
 *                                                                            
-*  The following visualization reflects the beginning of the heap.           
-*      start    start+11    start+22    start+23    start+24  
-*  - From start to start+11 pointers to segregated lists are stored
-*  - From start+11 to start+22 pointers to start index of segregated lists are
+*  The heap begins with its struct mm_heap, which holds the state of the
+*  heap and pointers into the words that follow it, from start on.
+*  The following visualization reflects the words after the struct.
+*      start    start+12    start+24    start+32    start+44    start+56  start+57
+*  - From start to start+12 pointers to segregated lists are stored
+*  - From start+12 to start+24 pointers to start index of segregated lists are
 *    stored since next fit policy is implemented.                                                       
-*  PROLOGUE_FOOTER (From start+22): 
+*  - From start+24 to start+32 pointers to the fast bins are stored.
+*  - From start+32 to start+44 pointers to the free block directories are
+*    stored.
+*  - From start+44 to start+56 the lengths of the segregated lists are stored.
+*  PROLOGUE_FOOTER (From start+56): 
                     8-byte footer, as defined above, that simulates the      
 *                   end of an allocated block. Also serves as padding.      
-*  EPILOGUE_HEADER: (From start+23)
+*  EPILOGUE_HEADER: (From start+57)
                     8-byte block indicating the end of the heap.             
 *                   It simulates the beginning of an allocated block         
 *                   The epilogue header is moved when the heap is extended.  
@@ -81,6 +103,200 @@ Andrew Id : mshaheer*/
 *  greater than the minimum block size it is stored in the segrgated list
 *  accordingly.
 *
+*  ************************************************************************
+*  ** HEAP GROWTH. **
+*
+*  When nothing fits, the heap is extended by at least chunksize. If the
+*  last block is free and at least a quarter of the request, extend_heap
+*  coalesces the extension with it, so only the shortfall is asked for;
+*  a smaller free tail is kept for small requests instead. A heap that
+*  has been extended grow_streak_min times in a row, with no block freed
+*  in between, is in a growth phase, and is extended by at least 1/64 of
+*  its size, so the number of extensions grows with the log of the heap
+*  rather than its size. Any free that reaches the heap ends the phase,
+*  whether it coalesces, goes to a fast bin or comes in a batch. A block
+*  kept in a CPU cache, or queued for the maintenance thread, counts once
+*  it reaches the heap: those frees take no lock, so they leave the heap
+*  alone.
+*
+*  ************************************************************************  
+*  ** FREE BLOCK DIRECTORY. **                                              
+*                                                                            
+*  Every segregated list but the first, once it is dir_min_list blocks      
+*  long, gets a directory: an allocated block holding a packed array of     
+*  the sizes of the free blocks on the list, in units of 16 bytes, and a    
+*  parallel array of their links. A free block keeps its slot in the        
+*  directory in the 4 bytes after its links, and a removed block's slot is  
+*  filled with the last entry. Only the list for the requested size can     
+*  hold blocks that are too small, so find_fit scans the sizes in its       
+*  directory, 8 at a time with SSE2 compares where available, and touches   
+*  only the block it picks. A directory that fills up is marked stale and   
+*  ignored until the next search, which first replaces it with one twice    
+*  the length of the list and refills it from the list. The directories     
+*  use the 32-bit links, so a WIDE_LINKS build does without them and walks  
+*  the lists.                                                               
+*
+*  ************************************************************************  
+*  ** PREFETCHING. **                                                      
+*                                                                            
+*  Built with PREFETCH defined (make mdriver-prefetch), the list walk in   
+*  find_fit prefetches the next block on the list while it checks the     
+*  size of the current one, remove_block prefetches both neighbours on the 
+*  list before it unlinks the block, and free prefetches the next block's  
+*  header, and coalesce the previous block's, before they are needed.      
+*
+*  ************************************************************************  
+*  ** FAST BINS. **                                                         
+*                                                                            
+*  Blocks of the eight smallest sizes are not coalesced when they are freed.
+*  They keep their allocated header and go on a singly linked fast bin of  
+*  blocks of exactly their size, with the link in the payload, and malloc  
+*  pops a block of the right size from its bin before searching the        
+*  segregated lists. The blocks in the bins look allocated to the rest of  
+*  the heap, so their neighbours don't coalesce with them. All of them are 
+*  freed for real (coalesced and inserted) by consolidate_fastbins, which  
+*  runs when a search for a fit fails, before the heap is extended, and    
+*  when the bins hold more than fastbin_limit bytes.                       
+*
+*  ************************************************************************  
+*  ** BATCHES. **                                                           
+*                                                                            
+*  mm_malloc_batch carves n blocks of the same size back to back out of each
+*  free block it finds (or out of a single heap extension), so the search, 
+*  removal and split are paid once per free block used rather than once per
+*  object. mm_free_batch sorts the pointers by address and frees each run   
+*  of adjacent blocks as a single block, so that every run is coalesced    
+*  and inserted into the segregated lists once.                             
+*
+*  ************************************************************************  
+*  ** SIZES. **                                                             
+*                                                                            
+*  A block holds size - 8 bytes of payload, which is usually more than was  
+*  asked for. mm_usable_size and mm_malloc_usable report it, so callers can 
+*  grow into it without a realloc. mm_free_sized takes the size from the
+*  caller, so that the address of the next block does not wait on the
+*  header load; place splits off even a mini block, so that the size the
+*  caller knows is the block's, and the header is only read for the
+*  prev_alloc bit (and checked against the size in debug builds).
+*
+*  ************************************************************************
+*  ** REALLOC. **
+*
+*  realloc grows a block in place into the free block after it, and only
+*  copies it when that is not free or too small. A block it grows is
+*  marked in its header, if it is at least realloc_grown_min bytes. When a
+*  marked block has to move again, it is taken to be growing step by step,
+*  as a string or a vector being built, and is placed at the start of a
+*  free block 1/8 larger than asked for. The rest stays a free block right
+*  after it, for its next growth: so the copies shrink geometrically, but
+*  the room is not held, and any malloc may take it if the block stops
+*  growing. Only free blocks are used for the room; the heap is not
+*  extended for it.
+*
+*  ************************************************************************
+*  ** ALIGNED BLOCKS. **                                                 
+*                                                                            
+*  memalign looks for a free block with room for the request plus the      
+*  alignment, and places the block at the first aligned payload address    
+*  that leaves either no gap or at least a minimum sized block in front of  
+*  it. The gap is put back on the segregated list as a free block, and the  
+*  tail is split off by place as usual, so nothing is lost to the padding.  
+*
+*  ************************************************************************  
+*  ** ARENAS. **                                                            
+*                                                                            
+*  An arena hands out blocks by bumping a pointer through chunks that are   
+*  allocated from the heap with malloc. Arena blocks have no headers and    
+*  cannot be freed one by one; mm_arena_reset gives every chunk but one     
+*  back to the segregated lists with a single free each, and rewinds the    
+*  pointer to the start of the one it keeps. Requests larger than a quarter 
+*  of a chunk get a chunk of their own, so they don't waste the rest of the 
+*  current one.                                                             
+*
+*  ************************************************************************  
+*  ** OBJECT CACHES. **                                                     
+*                                                                            
+*  A cache hands out objects of one size from slabs. A slab is a block     
+*  from memalign that is aligned to its own size, so the slab an object    
+*  belongs to is found by masking its address, and objects need no header. 
+*  Each slab keeps a LIFO list of its free objects, plus a bump pointer     
+*  through the objects never handed out. A cache allocates from its list   
+*  of partial slabs, and keeps slabs that become empty for reuse. When     
+*  malloc finds no fit, it first gives the empty slabs of every cache back 
+*  to the heap and searches again, before extending the heap.              
+*
+*  ************************************************************************
+*  ** HEAPS. **
+*
+*  All the state of a heap is in its struct mm_heap, at the start of the
+*  memlib region the heap grows in, and every routine takes the heap it
+*  works on. mm_heap_create makes a heap in any empty region, so a process
+*  can have as many heaps as regions. malloc, free and the rest of the
+*  interface without a heap argument use the default heap, which mm_init
+*  makes in the default region. Heaps share nothing, and a block must be
+*  freed to the heap it came from.
+*  A heap belongs to one thread, but any thread may give a block back to
+*  it with mm_heap_free_remote, which pushes the block on a lock-free
+*  queue in the heap with a single compare and swap (more if another
+*  push races with it). The owner takes the whole queue with one atomic
+*  exchange at the start of its next malloc and frees the blocks into
+*  its lists, so the only state the threads share is the queue head.
+*  Built with MM_THREADSAFE defined (make mdriver-mt), the default interface
+*  holds a lock on the default heap during each call, so threads can share
+*  it.
+*
+*  ************************************************************************
+*  ** SEGMENTS. **
+*
+*  A heap need not be contiguous. Once the region's break can't grow by
+*  what extend_heap needs, the heap gets a segment from memlib instead, of
+*  at least segment_min_size bytes, mapped wherever memlib can place it
+*  above the heap. A segment starts with a heap_segment_t, which links it
+*  into the heap's list of segments, followed by a prologue footer, its
+*  blocks and an epilogue header, so coalescing stops at its ends as it
+*  does at the ends of the brk part. The brk part keeps last_block; a
+*  segment has no tail to extend. The list of segments is what in_heap and
+*  mm_checkheap walk. When a free leaves a segment a single free block, the
+*  segment is unmapped if another segment is already empty; otherwise its
+*  block stays on the lists, so a heap that shrinks and grows back across
+*  a segment reuses it rather than mapping a new one. The maintenance
+*  thread unmaps that last empty segment as well.
+*
+*  ************************************************************************
+*  ** MAINTENANCE THREAD. **
+*
+*  In an MM_THREADSAFE build, mm_maint_start starts a thread that takes
+*  bookkeeping off the critical path of the default heap. While it runs,
+*  free only pushes the block on the heap's queue of remote frees, with no
+*  lock, and malloc leaves the queue alone unless it would otherwise grow
+*  the heap. The queue is the thread's work: every maint_period_ns, or
+*  sooner after a busy round, it frees the queued blocks, coalescing them
+*  and consolidating the fast bins as free would, a slice at a time under
+*  the lock; when nothing was queued, it empties the fast bins instead. It
+*  then trims a free tail larger than trim_threshold, and any empty
+*  segment, handing them back to memlib. After each round it sleeps in
+*  proportion to the CPU time the round took, so it uses no more than the
+*  share of a CPU it was given. The object caches belong to their threads,
+*  and the CPU caches are only changed in restartable sequences, so it
+*  leaves both alone.
+*
+*  ************************************************************************
+*  ** CPU CACHES. **
+*
+*  Built with MM_PERCPU defined as well (make mdriver-percpu), malloc and
+*  free keep up to cpu_cache_depth free blocks of each of the eight sizes
+*  from 32 to 144 bytes in a cache for each CPU, and go to the locked heap
+*  only when it is empty or full. A cache is changed in a restartable
+*  sequence (rseq): the CPU number is read, the list of that CPU updated,
+*  and the change committed with a single store, and if the thread is
+*  preempted or migrated before the store the kernel restarts it. So the
+*  fast path takes no lock and does no atomic operation, and the memory
+*  held in caches grows with the number of CPUs rather than of threads.
+*  Where rseq is not available (other than x86-64 Linux, or the C library
+*  did not register the thread), or mm_set_cpu_caches(false) was called,
+*  each thread has caches of its own instead, which it gives back to the
+*  heap when it exits.
+*
 *  NOTE: Please excuse the extraa long printf statements in the mm_checkheap ()
 *        function. I tried to move them to the next line but the compiler complained 
 */
@@ -91,8 +307,21 @@ Andrew Id : mshaheer*/
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef MM_THREADSAFE
+#include <pthread.h>
+#include <time.h>
+#endif
+#if defined(MM_PERCPU) && defined(__x86_64__) && defined(__linux__)
+#define MM_RSEQ
+#include <sys/rseq.h>
+#endif
 #include "mm.h"
 #include "memlib.h"
 
@@ -108,7 +337,7 @@ Andrew Id : mshaheer*/
 #define dbg_assert(...) assert(__VA_ARGS__)
 #define dbg_requires(...) assert(__VA_ARGS__)
 #define dbg_ensures(...) assert(__VA_ARGS__) 
-#define dbg_checkheap(...) mm_checkheap(__VA_ARGS__)
+#define dbg_checkheap(...) mm_heap_checkheap(heap, __VA_ARGS__)
 #define dbg_printheap(...) print_heap(__VA_ARGS__)
 #else
 /* When debugging is disabled, no code gets generated */
@@ -127,6 +356,9 @@ Andrew Id : mshaheer*/
 #define free mm_free
 #define realloc mm_realloc
 #define calloc mm_calloc
+#define memalign mm_memalign
+#define aligned_alloc mm_aligned_alloc
+#define posix_memalign mm_posix_memalign
 #define memset mem_memset
 #define memcpy mem_memcpy
 #endif /* def DRIVER */
@@ -138,8 +370,34 @@ Andrew Id : mshaheer*/
 typedef uint64_t word_t;
 static const size_t wsize = sizeof(word_t);   // word, header, footer size
 static const size_t dsize = 2*wsize;          // double word size 
+#ifdef WIDE_LINKS
 static const size_t min_block_size = 2*dsize; // Minimum block size
-static const size_t chunksize = (1 << 11);    // requires
+#else
+static const size_t min_block_size = dsize;   // Minimum block size
+#endif
+static const int seg_list_count = 12;         // Number of segregated lists
+static const size_t chunksize = (1 << 11);    // Least the heap is extended by
+
+/* Heap growth beyond chunksize (see grow_size) */
+static const size_t shortfall_share = 4;      // Tail share of a request that is grown
+static const int grow_streak_min = 4;         // Extensions in a row before growing faster
+static const int grow_shift = 6;              // Then extend by at least heap / 64
+
+/* Blocks that realloc grows (see mm_heap_realloc) */
+static const size_t realloc_grown_min = (1 << 8); // Smallest block marked grown
+static const size_t realloc_room_share = 8;       // Room left to grow is size / this
+
+/* Fast bins, one per block size from min_block_size up in steps of dsize */
+static const int fastbin_count = 8;
+static const size_t fastbin_limit = (1 << 10); // Bytes held before consolidating
+
+/* Free block directories, which need the 32-bit links */
+#ifdef WIDE_LINKS
+static const bool dir_enabled = false;
+#else
+static const bool dir_enabled = true;
+#endif
+static const size_t dir_min_list = 32;        // Shortest list with a directory
 
 typedef struct block
 {
@@ -155,6 +413,7 @@ typedef struct block
         /* data */
         char payload[0];
         struct block *ptrArr[2];
+        uint32_t links[3];     // prev, next, and slot in the directory
     } d;
     /*
      * We can't declare the footer as part of the struct, since its starting
@@ -163,29 +422,171 @@ typedef struct block
 } block_t;
 
 
-/* Global variables */
+/* Directory of a segregated list, in the payload of an allocated block */
+typedef struct free_dir
+{
+    uint32_t count;            // Entries in use
+    uint32_t cap;              // Entries that fit
+    uint32_t entries[];        // cap sizes, then cap links
+} free_dir_t;
+
+/* Chunk of an arena, followed by its data */
+typedef struct arena_chunk
+{
+    struct arena_chunk *next;  // Chunk allocated before this one
+    size_t size;               // Bytes of data that follow
+} arena_chunk_t;
+
+/* An arena, allocated with malloc */
+struct mm_arena
+{
+    struct mm_heap *heap;      // Heap the chunks are allocated from
+    arena_chunk_t *chunks;     // Most recently allocated chunk
+    char *bump;                // Next free byte of the current chunk
+    char *end;                 // End of the current chunk, which is the
+                               // one of chunk_size bytes the bump pointer
+                               // is in, or NULL if there is none
+    size_t chunk_size;         // Bytes of data in a standard chunk
+};
+
+/* Default size of the data in an arena chunk */
+static const size_t arena_chunk_size = (1 << 14);
+
+/* Slab of a cache, at the start of a block aligned to the slab size */
+typedef struct cache_slab
+{
+    struct cache_slab *next;   // Next slab in the same list of the cache
+    struct cache_slab *prev;   // Previous slab in the same list
+    void *free;                // LIFO list of freed objects
+    char *bump;                // First object never handed out
+    char *end;                 // End of the last object that fits
+    size_t inuse;              // Objects handed out and not freed
+} cache_slab_t;
+
+/* An object cache, allocated with malloc */
+struct mm_cache
+{
+    struct mm_heap *heap;      // Heap the slabs are allocated from
+    cache_slab_t *partial;     // Slabs with both free and used objects
+    cache_slab_t *full;        // Slabs with no free objects
+    cache_slab_t *empty;       // Slabs with no used objects
+    size_t objsize;            // Distance between objects
+    size_t align;              // Alignment of the objects
+    size_t slab_size;          // Size and alignment of a slab
+    struct mm_cache *next;     // Next cache, for reaping under pressure
+};
+
+/*
+ * Caches of free blocks in front of the default heap (MM_PERCPU), one per
+ * CPU or one per thread, with a list per block size from
+ * cpu_cache_min_size up in steps of dsize. A cached block keeps its
+ * allocated header; its payload holds the link to the next block and the
+ * length of the list from it down.
+ */
+typedef struct cpu_cache
+{
+    void *bins[8];             // One list per size, cpu_cache_count of them
+} cpu_cache_t;
+
+#ifdef MM_PERCPU
+static const int cpu_cache_count = 8;
+static const size_t cpu_cache_min_size = 2*dsize; // Room for link and length
+static const size_t cpu_cache_depth = 8;          // Blocks kept per size
+#endif
+
+/* Maintenance of the default heap in the background (MM_THREADSAFE) */
+#ifdef MM_THREADSAFE
+static const long maint_period_ns = 1000000;   // Longest wait for work
+static const int maint_slice = 256;           // Frees per hold of the lock
+#endif
+static const size_t trim_threshold = (1 << 16); // Free tail that is trimmed
+
+/*
+ * A segment of the heap, mapped by memlib apart from the region's break.
+ * It is followed by a prologue footer, its blocks, and an epilogue header.
+ */
+typedef struct heap_segment
+{
+    struct heap_segment *next; // Segment added before this one
+    size_t size;               // Bytes mapped, from the start of this struct
+} heap_segment_t;
+
+/* Smallest segment, and the bytes of a segment that hold no block */
+static const size_t segment_min_size = (1 << 20);
+static const size_t segment_overhead = sizeof(heap_segment_t) + dsize;
 
-/* Pointer to first block */
-static block_t *heap_listp = NULL;
+/* Smallest slab, and the least number of objects a slab holds */
+static const size_t slab_min_size = (1 << 14);
+static const size_t slab_min_objects = 8;
+
+/* A heap, in the first bytes of the region it grows in */
+struct mm_heap
+{
+    mem_region_t *region;      // Region the heap is extended in
+    block_t *heap_listp;       // First block
+    block_t *last_block;       // Last block in the heap
+    mm_cache_t *cache_list;    // Every cache created on this heap
+    block_t **freeListPtr;     // Heads of the segregated lists
+    block_t **startIndex;      // Where the next fit search of each list starts
+    struct heap_segment *segments; // Segments, most recently added first
+    block_t **fastBins;        // Heads of the fast bins
+    free_dir_t **freeDirs;     // Free block directories
+    size_t *freeCounts;        // Lengths of the segregated lists
+    block_t *remote_free;      // Blocks freed by other threads, not yet freed
+    uint32_t fastbin_bytes;    // Total size of the blocks in the fast bins
+    uint16_t dir_stale;        // Bit i is set when directory i must be rebuilt
+    uint8_t maintained;        // Set while a maintenance thread runs; atomic
+    uint8_t grow_streak;       // Heap extensions in a row with no free between
+};
+
+/* Global variables */
 
-/* Pointer to last block in heap */
-static block_t *last_block = NULL;
+/* Heap behind malloc, free and the rest of the default interface */
+static mm_heap_t *default_heap = NULL;
 
+#ifdef MM_THREADSAFE
+/* Held by the default interface while it works on the default heap */
+static pthread_mutex_t default_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
 
-/* Pointer to the address where the address of segregated lists are stored */
-static block_t **freeListPtr = NULL;
+#ifdef MM_THREADSAFE
+/* The maintenance thread, and what it is told */
+static pthread_t maint_thread;
+static pthread_cond_t maint_cond = PTHREAD_COND_INITIALIZER;
+static bool maint_running = false;      // Between mm_maint_start and stop
+static bool maint_stopping = false;     // Set by mm_maint_stop
+static double maint_share = 0;          // Share of a CPU it may use
+#endif
 
-/* Pointer to the address where the starting addresses for all the segregated
-list are stored. This is required for next fit search*/
-static block_t **startIndex = NULL;
+#ifdef MM_PERCPU
+static bool percpu_wanted = true;       // Use rseq if the kernel has it
+static cpu_cache_t *percpu_caches = NULL; // One per CPU, or NULL if unused
+static unsigned percpu_count = 0;       // Number of CPUs cached for
+static unsigned long cache_epoch = 0;   // Bumped by mm_init
+static pthread_key_t thread_cache_key;  // Flushes a thread's caches at exit
+static pthread_once_t thread_cache_once = PTHREAD_ONCE_INIT;
+static __thread cpu_cache_t thread_cache; // Used where rseq is not
+static __thread unsigned long thread_cache_epoch; // Epoch thread_cache is of
+#endif
 
 
 /* Function prototypes for internal helper routines */
-static void insert_free_block (block_t *block);
-static block_t *extend_heap(size_t size);
-static void place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
+static void insert_free_block (mm_heap_t *heap, block_t *block);
+static block_t *extend_heap(mm_heap_t *heap, size_t size);
+static block_t *add_segment(mm_heap_t *heap, size_t size);
+static size_t grow_size(mm_heap_t *heap, size_t asize);
+static bool release_segment(mm_heap_t *heap, block_t *block);
+static block_t *segment_block(heap_segment_t *seg);
+static bool segment_empty(heap_segment_t *seg);
+static size_t trim_segments(mm_heap_t *heap);
+static bool realloc_in_place(mm_heap_t *heap, block_t *block, size_t asize);
+static void mark_grown(block_t *block, bool grown);
+static void *realloc_fit(mm_heap_t *heap, size_t asize, size_t room);
+static int check_blocks(block_t *block, int lineno);
+static char *link_base(mm_heap_t *heap);
+static void place(mm_heap_t *heap, block_t *block, size_t asize);
+static block_t *find_fit(mm_heap_t *heap, size_t asize);
+static block_t *coalesce(mm_heap_t *heap, block_t *block);
 static int find_free_list (size_t size);
 static size_t max(size_t x, size_t y);
 static word_t pack(size_t size, bool alloc, bool prev_alloc);
@@ -203,120 +604,467 @@ static void *header_to_payload(block_t *block);
 static block_t *find_next(block_t *block);
 static word_t *find_prev_footer(block_t *block);
 static block_t *find_prev(block_t *block);
-static bool in_heap(const void *p);
+static bool in_heap(mm_heap_t *heap, const void *p);
 static size_t align(size_t x);
 static bool aligned(const void *p);
-static void remove_block (block_t *block);
-static bool is_acyclic (block_t *block);
-bool mm_checkheap(int lineno);
+static void remove_block (mm_heap_t *heap, block_t *block);
+static bool is_acyclic (mm_heap_t *heap, block_t *block);
 static void change_alloc_next_block (block_t *block, bool alloc);
+static size_t adjust_size (size_t size);
+static size_t carve_batch (mm_heap_t *heap, block_t *block, size_t asize, size_t n, void **out);
+static int compare_address (const void *a, const void *b);
+static void free_runs (mm_heap_t *heap, void **ptrs, size_t n);
+static void free_block (mm_heap_t *heap, block_t *block, word_t header, size_t size);
+static void settle_free_block (mm_heap_t *heap, block_t *block);
+static bool is_power_of_two (size_t x);
+static arena_chunk_t *arena_new_chunk (mm_arena_t *arena, size_t size);
+static arena_chunk_t *arena_current (mm_arena_t *arena);
+static void slab_unlink (cache_slab_t **list, cache_slab_t *slab);
+static void slab_push (cache_slab_t **list, cache_slab_t *slab);
+static size_t reap_caches (mm_heap_t *heap);
+static bool fastbin_push (mm_heap_t *heap, block_t *block, size_t size);
+static block_t *fastbin_pop (mm_heap_t *heap, size_t asize);
+static bool consolidate_fastbins (mm_heap_t *heap);
+static block_t *find_fit_or_consolidate (mm_heap_t *heap, size_t asize);
+static block_t *get_next_free (mm_heap_t *heap, block_t *block);
+static block_t *get_prev_free (mm_heap_t *heap, block_t *block);
+static void set_next_free (mm_heap_t *heap, block_t *block, block_t *next);
+static void set_prev_free (mm_heap_t *heap, block_t *block, block_t *prev);
+static block_t *search_fit (mm_heap_t *heap, size_t asize);
+static uint32_t block_link (mm_heap_t *heap, block_t *block);
+static block_t *link_block (mm_heap_t *heap, uint32_t link);
+static bool dir_usable (mm_heap_t *heap, int ind);
+static void dir_insert (mm_heap_t *heap, block_t *block, int ind, size_t size);
+static void dir_remove (mm_heap_t *heap, block_t *block, int ind);
+static uint32_t dir_search (const free_dir_t *dir, uint32_t want);
+static void grow_directories (mm_heap_t *heap);
+static void grow_directory (mm_heap_t *heap, int ind);
+static void prefetch_block (const void *p);
+static void drain_remote_frees (mm_heap_t *heap);
+static size_t trim_heap (mm_heap_t *heap);
+static bool maint_work (mm_heap_t *heap);
+static void *maint_main (void *arg);
+static bool cache_init (void);
+static void *cache_pop (size_t size);
+static bool cache_push (void *bp);
+static bool rseq_usable (void);
+#ifdef MM_RSEQ
+static struct rseq *rseq_area (void);
+#endif
+static void *rseq_pop (int ind);
+static bool rseq_push (void *bp, int ind);
+static cpu_cache_t *thread_cache_get (void);
+static void thread_cache_make_key (void);
+static void thread_cache_flush (void *arg);
+static void lock_default (void);
+static void unlock_default (void);
 
 /*
- * mm_init: initializes the heap; it is run once when heap_start == NULL.
- *          prior to any extend_heap operation, this is the heap:
- *              start            start+8           start+16
- *          INIT: | PROLOGUE_FOOTER | EPILOGUE_HEADER |
+ * mm_heap_create: makes a new, empty heap in the region, which must be
+ *                 empty too, and returns it, or NULL on failure. The heap
+ *                 lives in the region, and goes away when it is reset or
+ *                 destroyed. Prior to any extend_heap operation, this is
+ *                 the region:
+ *              heap              start            start+56         start+57
+ *          INIT: | struct mm_heap | (list heads) | PROLOGUE_FOOTER | EPILOGUE_HEADER |
  * heap_listp ends up pointing to the epilogue header.
  */
-bool mm_init(void) 
+mm_heap_t *mm_heap_create(mem_region_t *region)
 {
     // Create the initial empty heap 
-    word_t *start = (word_t *)(mem_sbrk(24 * wsize));
+    size_t hsize = align(sizeof(mm_heap_t));
+    mm_heap_t *heap = (mm_heap_t *)(mem_region_sbrk(region, hsize + 58 * wsize));
+    word_t *start = (word_t *)((char *) heap + hsize);
 
-    if (start == (void *)-1) 
+    if (heap == (void *)-1) 
     {
-        return false;
+        return NULL;
     }
 
-    start[22] = pack(0, true, true); // Prologue footer
-    start[23] = pack(0, true, true); // Epilogue header
+    start[56] = pack(0, true, true); // Prologue footer
+    start[57] = pack(0, true, true); // Epilogue header
     // Heap starts with first block header (epilogue)
-    last_block = (block_t *) &(start[22]);
-    heap_listp = (block_t *) &(start[23]);
-
-    freeListPtr = (block_t **) &(start[0]);
-    startIndex = (block_t **) &(start[11]);
+    heap -> region = region;
+    heap -> last_block = (block_t *) &(start[56]);
+    heap -> heap_listp = (block_t *) &(start[57]);
+
+    heap -> segments = NULL;
+    heap -> freeListPtr = (block_t **) &(start[0]);
+    heap -> startIndex = (block_t **) &(start[12]);
+    heap -> fastBins = (block_t **) &(start[24]);
+    heap -> freeDirs = (free_dir_t **) &(start[32]);
+    heap -> freeCounts = (size_t *) &(start[44]);
+    heap -> fastbin_bytes = 0;
+    heap -> dir_stale = 0;
+    heap -> cache_list = NULL;
+    heap -> remote_free = NULL;
+    heap -> maintained = 0;
+    heap -> grow_streak = 0;
 
 
     /* Initialising pointers to segregated list*/
-    for (int i = 0; i < 11; i ++)
+    for (int i = 0; i < seg_list_count; i ++)
     {
-        freeListPtr[i] = NULL;
-        startIndex[i] = NULL;
+        heap -> freeListPtr[i] = NULL;
+        heap -> startIndex[i] = NULL;
+        heap -> freeDirs[i] = NULL;
+        heap -> freeCounts[i] = 0;
+    }
+    for (int i = 0; i < fastbin_count; i ++)
+    {
+        heap -> fastBins[i] = NULL;
     }
 
     // Extend the empty heap with a free block of chunksize bytes
-    block_t *newBlock = extend_heap (chunksize);
+    block_t *newBlock = extend_heap (heap, chunksize);
     if (newBlock == NULL)
     {
-        return false;
+        return NULL;
     }
-    insert_free_block (newBlock);
-    return true;
+    insert_free_block (heap, newBlock);
+    return heap;
+}
+
+/*
+ * mm_init: makes the default heap, the one behind malloc and the rest of
+ *          the interface without a heap argument, in the default region.
+ *          It is run by malloc if it hasn't been run yet.
+ */
+bool mm_init(void) 
+{
+    default_heap = mm_heap_create(mem_default_region());
+    return default_heap != NULL && cache_init ();
+}
+
+/*
+ * mm_set_cpu_caches: in a build with MM_PERCPU defined, chooses whether
+ *                    default heaps made by later calls to mm_init cache
+ *                    small blocks per CPU, which needs rseq, or per
+ *                    thread. Returns true if they will be per CPU.
+ */
+bool mm_set_cpu_caches(bool percpu)
+{
+#ifdef MM_PERCPU
+    percpu_wanted = percpu;
+    return percpu && rseq_usable ();
+#else
+    (void) percpu;
+    return false;
+#endif
+}
+
+/*
+ * mm_maint_start: in a build with MM_THREADSAFE defined, starts a thread
+ *                 that does the deferred work of the default heap, using
+ *                 at most cpu_share (0 to 1) of a CPU. While it runs,
+ *                 free only queues blocks for it. Returns false if it
+ *                 could not be started, or is running already.
+ */
+bool mm_maint_start(double cpu_share)
+{
+#ifdef MM_THREADSAFE
+    bool ok = false;
+
+    lock_default ();
+    if (default_heap == NULL)
+    {
+        mm_init();
+    }
+    if (default_heap != NULL && !maint_running && cpu_share > 0)
+    {
+        maint_share = (cpu_share < 1) ? cpu_share : 1;
+        maint_stopping = false;
+        ok = pthread_create(&maint_thread, NULL, maint_main, default_heap) == 0;
+        maint_running = ok;
+        __atomic_store_n(&default_heap -> maintained, ok, __ATOMIC_RELEASE);
+    }
+    unlock_default ();
+    return ok;
+#else
+    (void) cpu_share;
+    return false;
+#endif
+}
+
+/*
+ * mm_maint_stop: stops the maintenance thread, if it runs, and frees the
+ *                blocks still queued for it.
+ */
+void mm_maint_stop(void)
+{
+#ifdef MM_THREADSAFE
+    lock_default ();
+    if (!maint_running)
+    {
+        unlock_default ();
+        return;
+    }
+    __atomic_store_n(&maint_stopping, true, __ATOMIC_RELEASE);
+    pthread_cond_signal(&maint_cond);
+    unlock_default ();
+    pthread_join(maint_thread, NULL);
+
+    lock_default ();
+    maint_running = false;
+    __atomic_store_n(&default_heap -> maintained, 0, __ATOMIC_RELEASE);
+    drain_remote_frees (default_heap);
+    unlock_default ();
+#endif
+}
+
+/*
+ * The default interface: each of these calls its mm_heap_ counterpart on
+ * the default heap, initializing it first if it allocates. In a build with
+ * MM_THREADSAFE defined, they hold the lock of the default heap while
+ * they do; arenas and caches are still meant for one thread each. With
+ * MM_PERCPU defined too, malloc and free try the per-CPU or per-thread
+ * caches first, without the lock.
+ */
+void *malloc(size_t size)
+{
+    void *bp = cache_pop (size);
+
+    if (bp != NULL)
+    {
+        return bp;
+    }
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    bp = mm_heap_malloc(default_heap, size);
+    unlock_default ();
+    return bp;
+}
+
+void free(void *bp)
+{
+    if (bp != NULL && cache_push (bp))
+    {
+        return;
+    }
+    if (bp != NULL &&
+        __atomic_load_n(&default_heap -> maintained, __ATOMIC_ACQUIRE))
+    {
+        mm_heap_free_remote(default_heap, bp);
+        return;
+    }
+    lock_default ();
+    mm_heap_free(default_heap, bp);
+    unlock_default ();
+}
+
+void mm_free_sized(void *bp, size_t size)
+{
+    if (bp != NULL && cache_push (bp))
+    {
+        return;
+    }
+    if (bp != NULL &&
+        __atomic_load_n(&default_heap -> maintained, __ATOMIC_ACQUIRE))
+    {
+        mm_heap_free_remote(default_heap, bp);
+        return;
+    }
+    lock_default ();
+    mm_heap_free_sized(default_heap, bp, size);
+    unlock_default ();
+}
+
+size_t mm_malloc_batch(size_t size, size_t n, void **out)
+{
+    size_t done;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    done = mm_heap_malloc_batch(default_heap, size, n, out);
+    unlock_default ();
+    return done;
+}
+
+void mm_free_batch(void **ptrs, size_t n)
+{
+    lock_default ();
+    mm_heap_free_batch(default_heap, ptrs, n);
+    unlock_default ();
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    void *newptr;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    newptr = mm_heap_realloc(default_heap, ptr, size);
+    unlock_default ();
+    return newptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *bp;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    bp = mm_heap_calloc(default_heap, nmemb, size);
+    unlock_default ();
+    return bp;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *bp;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    bp = mm_heap_memalign(default_heap, alignment, size);
+    unlock_default ();
+    return bp;
+}
+
+mm_arena_t *mm_arena_create(size_t chunk_size)
+{
+    mm_arena_t *arena;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    arena = mm_heap_arena_create(default_heap, chunk_size);
+    unlock_default ();
+    return arena;
+}
+
+mm_cache_t *mm_cache_create(size_t objsize, size_t align)
+{
+    mm_cache_t *cache;
+
+    lock_default ();
+    if (default_heap == NULL) // Initialize heap if it isn't initialized
+    {
+        mm_init();
+    }
+    cache = mm_heap_cache_create(default_heap, objsize, align);
+    unlock_default ();
+    return cache;
+}
+
+bool mm_checkheap(int lineno)
+{
+    bool ok;
+
+    lock_default ();
+    ok = mm_heap_checkheap(default_heap, lineno);
+    unlock_default ();
+    return ok;
 }
 
 /*
- * malloc: allocates a block with (size - wsize) rounded to nearest 16 bytes 
+ * mm_heap_malloc: allocates a block with (size - wsize) rounded to nearest 16 bytes 
  *         and d size bytes added later. The minimum size returned is (2*dsize).
  *         Seeks a sufficiently-large unallocated block on the heap to be allocated.
- *         If no such block is found, extends heap by the maximum between
- *         chunksize and ((size - wsize)rounded to 16 bytes + dsize)
+ *         If no such block is found, extends heap as grow_size decides,
+ *         by at least what the free tail block lacks of
+ *         ((size - wsize)rounded to 16 bytes + dsize)
  *         and then attempts to allocate all, or a part of, that memory.
  *         Returns NULL on failure, otherwise returns a pointer to such block.
  *         The allocated block will not be used for further allocations until
  *         freed.
  */
-void *malloc(size_t size) 
+void *mm_heap_malloc(mm_heap_t *heap, size_t size) 
 {
     size_t asize;      // Adjusted block size
     size_t extendsize; // Amount to extend heap if no fit is found
     block_t *block;
     void *bp = NULL;
 
-    if (heap_listp == NULL) // Initialize heap if it isn't initialized
+    if (size == 0) // Ignore spurious request
     {
-        mm_init();
+        return bp;
     }
-
-    if (size == 0) // Ignore spurious request
+    if (size > SIZE_MAX - chunksize) // adjust_size or grow_size would wrap
     {
         return bp;
     }
 
+    // Take back the blocks other threads have freed, unless the
+    // maintenance thread will
+    if (!__atomic_load_n(&heap -> maintained, __ATOMIC_ACQUIRE) &&
+        __atomic_load_n(&heap -> remote_free, __ATOMIC_RELAXED) != NULL)
+    {
+        drain_remote_frees (heap);
+    }
+
     // Adjust block size to include overhead and to meet alignment requirements
-    asize = max (32, align (size - wsize) + dsize);
+    asize = adjust_size (size);
+
+    // A freed block of exactly this size is already marked allocated
+    block = fastbin_pop (heap, asize);
+    if (block != NULL)
+    {
+        return header_to_payload(block);
+    }
 
     // Search the free list for a fit
-    block = find_fit(asize);
+    block = find_fit_or_consolidate(heap, asize);
 
-    // If no fit is found, request more memory, and then and place the block
     if (block == NULL)
     {  
-        extendsize = max(asize, chunksize);
-        block = extend_heap(extendsize);
+        // Give empty slabs and deferred frees back before growing the heap
+        if (heap -> cache_list != NULL && reap_caches(heap) > 0)
+        {
+            block = find_fit(heap, asize);
+        }
+        if (block == NULL &&
+            __atomic_load_n(&heap -> maintained, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&heap -> remote_free, __ATOMIC_RELAXED) != NULL)
+        {
+            drain_remote_frees (heap);
+            block = find_fit_or_consolidate(heap, asize);
+        }
+    }
+    // If no fit is found, request more memory, and then and place the block
+    if (block == NULL)
+    {
+        extendsize = grow_size(heap, asize);
+        block = extend_heap(heap, extendsize);
         if (block == NULL) // extend_heap returns an error
         {
             return bp;
         }
+        change_alloc_next_block (block, true);
     }
     /* If fit is found, remove the block and change alloc status of next block*/
     else
     {
-        remove_block (block);
+        remove_block (heap, block);
         change_alloc_next_block (block, true);
     }
-    place(block, asize);
+    place(heap, block, asize);
     bp = header_to_payload(block);
     return bp;
 } 
 
 /*
- * free: Frees the block such that it is no longer allocated while still
+ * mm_heap_free: Frees the block such that it is no longer allocated while still
  *       maintaining its size. Block will be available for use on malloc.
  */
-void free(void *bp)
+void mm_heap_free(mm_heap_t *heap, void *bp)
 {
-    block_t *newBlock;
     if (bp == NULL)
     {
         return;
@@ -325,44 +1073,263 @@ void free(void *bp)
     block_t *block = payload_to_header(bp);
     size_t size = get_size(block);
 
-    write_header(block, size, false, get_prev_alloc (block));
-    write_footer(block, size, false, get_prev_alloc (block));
-
-    newBlock = coalesce(block);
-    change_alloc_next_block (newBlock, false);
-    insert_free_block (newBlock);
+    if (!fastbin_push (heap, block, size))
+    {
+        free_block (heap, block, block -> header, size);
+    }
     return;
 }
 
 /*
- * realloc: returns a pointer to an allocated region of at least size bytes:
- *          if ptrv is NULL, then call malloc(size);
- *          if size == 0, then call free(ptr) and returns NULL;
- *          else allocates new region of memory, copies old data to new memory,
- *          and then free old block. Returns old block if realloc fails or
- *          returns new pointer on success.
+ * mm_heap_free_sized: frees a block whose size the caller knows: either the size
+ *                it was last allocated or reallocated with, or the usable
+ *                size reported for it. Blocks are placed at exactly their
+ *                adjusted size, so the block size, and with it the next
+ *                block, comes from size without waiting on the header,
+ *                which is only read for the prev_alloc bit. With
+ *                WIDE_LINKS, where a 16-byte remainder may have been given
+ *                to the block, the size in the header is used instead.
  */
-void *realloc(void *ptr, size_t size)
+void mm_heap_free_sized(mm_heap_t *heap, void *bp, size_t size)
 {
-    block_t *block = payload_to_header(ptr);
-    size_t copysize;
-    void *newptr;
-
-    // If size == 0, then free block and return NULL
-    if (size == 0)
+    if (bp == NULL)
     {
-        free(ptr);
-        return NULL;
+        return;
     }
 
-    // If ptr is NULL, then equivalent to malloc
-    if (ptr == NULL)
+    block_t *block = payload_to_header(bp);
+    word_t header = block -> header;
+    size_t asize = adjust_size (size);
+
+    if (min_block_size > dsize)
     {
-        return malloc(size);
+        asize = extract_size(header);
+    }
+    dbg_assert(extract_size(header) == asize);
+    if (!fastbin_push (heap, block, asize))
+    {
+        free_block (heap, block, header, asize);
+    }
+}
+
+/*
+ * mm_heap_free_remote: frees a block on behalf of a thread that does not
+ *                      own the heap. It may be called from any thread, at
+ *                      the same time as the owner works on the heap: the
+ *                      block is pushed on the heap's queue of remote frees
+ *                      with a compare and swap, linked through its payload,
+ *                      and the owner frees it for real on its next malloc.
+ */
+void mm_heap_free_remote(mm_heap_t *heap, void *bp)
+{
+    if (bp == NULL)
+    {
+        return;
+    }
+
+    block_t *block = payload_to_header(bp);
+    block_t *head = __atomic_load_n(&heap -> remote_free, __ATOMIC_RELAXED);
+
+    do
+    {
+        block -> d.ptrArr[0] = head;
+    } while (!__atomic_compare_exchange_n(&heap -> remote_free, &head, block,
+                                          true, __ATOMIC_RELEASE,
+                                          __ATOMIC_RELAXED));
+}
+
+/*
+ * mm_usable_size: returns the number of bytes that may be used at bp, which
+ *                 is at least the size it was allocated with.
+ */
+size_t mm_usable_size(void *bp)
+{
+    if (bp == NULL)
+    {
+        return 0;
+    }
+    return get_payload_size(payload_to_header(bp));
+}
+
+/*
+ * mm_malloc_usable: like malloc, but also stores the usable size of the
+ *                   new block in *usable (0 if the allocation fails).
+ */
+void *mm_malloc_usable(size_t size, size_t *usable)
+{
+    void *bp = malloc(size);
+
+    if (usable != NULL)
+    {
+        *usable = (bp == NULL) ? 0 : get_payload_size(payload_to_header(bp));
+    }
+    return bp;
+}
+
+/*
+ * mm_heap_malloc_batch: allocates n blocks of size bytes each and stores their
+ *                  payload pointers in out. A free block that holds the
+ *                  rest of the batch is searched for first, then one that
+ *                  holds a single block, and whichever is found is carved
+ *                  into as many of the blocks as it holds, back to back,
+ *                  so a batch costs one search per free block used rather
+ *                  than one per object. If nothing fits, the heap is
+ *                  extended once for the rest of the batch. Returns n, or
+ *                  0 if the heap could not be extended, in which case the
+ *                  blocks already allocated are freed again.
+ */
+size_t mm_heap_malloc_batch(mm_heap_t *heap, size_t size, size_t n, void **out)
+{
+    size_t asize;      // Adjusted size of each block
+    size_t done = 0;   // Number of blocks allocated so far
+    block_t *block;
+
+    if (size == 0 || n == 0) // Ignore spurious request
+    {
+        return 0;
+    }
+
+    // Take back the blocks other threads have freed, unless the
+    // maintenance thread will, as mm_heap_malloc does
+    if (!__atomic_load_n(&heap -> maintained, __ATOMIC_ACQUIRE) &&
+        __atomic_load_n(&heap -> remote_free, __ATOMIC_RELAXED) != NULL)
+    {
+        drain_remote_frees (heap);
+    }
+
+    asize = adjust_size (size);
+    if (n > SIZE_MAX / asize) // Combined size overflows
+    {
+        return 0;
+    }
+
+    while (done < n)
+    {
+        block = find_fit(heap, (n - done) * asize);
+        if (block == NULL)
+        {
+            block = find_fit_or_consolidate(heap, asize);
+        }
+        if (block == NULL &&
+            __atomic_load_n(&heap -> maintained, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&heap -> remote_free, __ATOMIC_RELAXED) != NULL)
+        {
+            // The queued frees may hold a fit; take them before growing
+            drain_remote_frees (heap);
+            block = find_fit_or_consolidate(heap, asize);
+        }
+        if (block == NULL)
+        {
+            // Extend by what the free tail block, if any, lacks
+            block = extend_heap(heap, grow_size(heap, (n - done) * asize));
+            if (block == NULL)
+            {
+                mm_heap_free_batch(heap, out, done);
+                return 0;
+            }
+        }
+        else
+        {
+            remove_block (heap, block);
+        }
+        done += carve_batch (heap, block, asize, n - done, out + done);
+    }
+    dbg_checkheap(__LINE__);
+    return n;
+}
+
+/*
+ * mm_heap_free_batch: frees the n blocks whose payload pointers are in ptrs.
+ *                The pointers are copied, a few hundred at a time, and
+ *                sorted by address, leaving ptrs as it was, and every run
+ *                of blocks that are adjacent in the heap is merged and
+ *                freed as a single block, so each run is coalesced with
+ *                its neighbours and inserted into the segregated lists
+ *                only once. NULL pointers are ignored.
+ */
+void mm_heap_free_batch(mm_heap_t *heap, void **ptrs, size_t n)
+{
+    void *sorted[1 << 8];
+    size_t chunk = sizeof(sorted) / sizeof(sorted[0]);
+
+    for (size_t first = 0; first < n; first += chunk)
+    {
+        size_t count = (n - first < chunk) ? n - first : chunk;
+
+        memcpy(sorted, ptrs + first, count * sizeof(void *));
+        qsort(sorted, count, sizeof(void *), compare_address);
+        free_runs (heap, sorted, count);
+    }
+    dbg_checkheap(__LINE__);
+}
+
+/*
+ * mm_heap_realloc: returns a pointer to an allocated region of at least size bytes:
+ *          if ptrv is NULL, then call malloc(size);
+ *          if size == 0, then call free(ptr) and returns NULL;
+ *          if the block grows into the free block after it, or shrinks
+ *          by at most a mini block, resizes it in place;
+ *          else allocates new region of memory, copies old data to new memory,
+ *          and then free old block. A block realloc has grown before is
+ *          moved, if it can be, to the start of a free block with
+ *          1/realloc_room_share more room, which is left free after it.
+ *          Returns NULL, leaving the old block alone, if realloc fails or
+ *          returns new pointer on success.
+ */
+void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size)
+{
+    block_t *block = payload_to_header(ptr);
+    size_t copysize;
+    size_t asize;
+    size_t room;       // Size of the block a regrown block is moved to
+    bool regrown;      // Grown by realloc before
+    bool growing;
+    void *newptr;
+
+    // If size == 0, then free block and return NULL
+    if (size == 0)
+    {
+        mm_heap_free(heap, ptr);
+        return NULL;
+    }
+
+    // If ptr is NULL, then equivalent to malloc
+    if (ptr == NULL)
+    {
+        return mm_heap_malloc(heap, size);
+    }
+
+    if (size > SIZE_MAX - chunksize) // adjust_size would wrap, as in malloc
+    {
+        return NULL;
+    }
+
+    // Resize in place if the block and the free block after it leave
+    // room. A shrink that frees more than a mini block moves it instead,
+    // which keeps the heap more compact
+    asize = adjust_size(size);
+    regrown = ((block -> header) & 0x8) != 0;
+    growing = asize > get_size(block);
+    if ((growing || get_size(block) - asize <= dsize) &&
+        realloc_in_place(heap, block, asize))
+    {
+        mark_grown(block, regrown || growing);
+        return ptr;
+    }
+
+    // Otherwise, proceed with reallocation. A block grown before will
+    // likely grow again, so it is moved where it can grow in place next
+    newptr = NULL;
+    if (regrown && growing)
+    {
+        room = size / realloc_room_share;
+        room = (room > SIZE_MAX - chunksize - size) ? SIZE_MAX - chunksize : size + room;
+        newptr = realloc_fit(heap, asize, adjust_size(room));
+    }
+    if (!newptr)
+    {
+        newptr = mm_heap_malloc(heap, size);
     }
-
-    // Otherwise, proceed with reallocation
-    newptr = malloc(size);
     // If malloc fails, the original block is left untouched
     if (!newptr)
     {
@@ -378,17 +1345,18 @@ void *realloc(void *ptr, size_t size)
     memcpy(newptr, ptr, copysize);
 
     // Free the old block
-    free(ptr);
+    mm_heap_free(heap, ptr);
 
+    mark_grown(payload_to_header(newptr), growing);
     return newptr;
 }
 
 /*
- * calloc: Allocates a block with size at least (elements * size + dsize)
+ * mm_heap_calloc: Allocates a block with size at least (elements * size + dsize)
  *         through malloc, then initializes all bits in allocated memory to 0.
  *         Returns NULL on failure.
  */
-void *calloc(size_t nmemb, size_t size)
+void *mm_heap_calloc(mm_heap_t *heap, size_t nmemb, size_t size)
 {
     void *bp;
     size_t asize = nmemb * size;
@@ -397,7 +1365,7 @@ void *calloc(size_t nmemb, size_t size)
 	// Multiplication overflowed
 	return NULL;
     
-    bp = malloc(asize);
+    bp = mm_heap_malloc(heap, asize);
     if (bp == NULL)
     {
         return NULL;
@@ -410,303 +1378,2054 @@ void *calloc(size_t nmemb, size_t size)
 
 /******** The remaining content below are helper and debug routines ********/
 /*
- * find_free_list: This function finds the segregated list according
- *                 to the size based on powers of 2. It then returns
- *                 the index
+ * mm_heap_memalign: allocates size bytes whose address is a multiple of alignment,
+ *           which must be a power of two. Alignments of up to 16 bytes are
+ *           what malloc gives anyway. Returns NULL on failure.
  */
-
-static int find_free_list (size_t size)
+void *mm_heap_memalign(mm_heap_t *heap, size_t alignment, size_t size)
 {
-    if (size <= 64)
-    {
-        return 0;
-    }
-    else if (size <= 128)
+    size_t asize;      // Adjusted block size
+    size_t need;       // Size of free block that surely holds an aligned fit
+    size_t csize;
+    size_t lead;       // Bytes in front of the aligned block
+    block_t *block;
+    block_t *aligned_block;
+    uintptr_t bp;
+
+    if (!is_power_of_two (alignment))
     {
-        return 1;
+        return NULL;
     }
-    else if (size <= 256)
+    if (alignment <= ALIGNMENT)
     {
-        return 2;
+        return mm_heap_malloc(heap, size);
     }
-    else if (size <= 512)
+
+    if (size == 0 || size > SIZE_MAX - alignment - 2 * min_block_size)
     {
-        return 3;
+        return NULL;
     }
-    else if (size <= 1024)
+
+    // The gap in front is less than alignment + min_block_size
+    asize = adjust_size (size);
+    need = asize + alignment + min_block_size;
+
+    block = find_fit_or_consolidate(heap, need);
+    if (block == NULL)
     {
-        return 4;
+        block = extend_heap(heap, grow_size(heap, need));
+        if (block == NULL)
+        {
+            return NULL;
+        }
     }
-    else if (size <= 2048)
+    else
     {
-        return 5;
+        remove_block (heap, block);
     }
-    else if (size <= 4096)
+
+    /* Find the first aligned payload that leaves room for a free block */
+    bp = (uintptr_t) header_to_payload(block);
+    lead = ((bp + alignment - 1) & ~(uintptr_t) (alignment - 1)) - bp;
+    if (lead > 0 && lead < min_block_size)
     {
-        return 6;
+        lead += alignment;
     }
-    else if (size <= 8192)
+
+    csize = get_size(block);
+    aligned_block = block;
+    if (lead > 0)
     {
-        return 7;
+        /* The block before a free block is always allocated */
+        aligned_block = (block_t *) ((char *) block + lead);
+        write_header(aligned_block, csize - lead, true, false);
+        if (block == heap -> last_block)
+        {
+            heap -> last_block = aligned_block;
+        }
+        write_header(block, lead, false, get_prev_alloc (block));
+        write_footer(block, lead, false, get_prev_alloc (block));
+        insert_free_block (heap, block);
     }
-    else if (size <= 16384)
+    change_alloc_next_block (aligned_block, true);
+    place(heap, aligned_block, asize);
+    dbg_checkheap(__LINE__);
+    return header_to_payload(aligned_block);
+}
+
+/*
+ * aligned_alloc: C11 interface to memalign.
+ */
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+/*
+ * posix_memalign: POSIX interface to memalign. Stores the block in *memptr
+ *                 and returns 0, or returns EINVAL if alignment is not a
+ *                 power of two multiple of sizeof(void *), or ENOMEM.
+ */
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    void *bp;
+
+    if (!is_power_of_two (alignment) || alignment % sizeof(void *) != 0)
     {
-        return 8;
+        return EINVAL;
     }
-    else if (size <= 32768)
+    bp = memalign(alignment, size);
+    if (bp == NULL && size != 0)
     {
-        return 9;
+        return ENOMEM;
     }
-    else
+    *memptr = bp;
+    return 0;
+}
+
+/*
+ * mm_heap_arena_create: returns a new, empty arena on the heap whose chunks
+ *                       hold chunk_size bytes (or a default if chunk_size is
+ *                       0), or NULL.
+ */
+mm_arena_t *mm_heap_arena_create(mm_heap_t *heap, size_t chunk_size)
+{
+    mm_arena_t *arena = mm_heap_malloc(heap, sizeof(mm_arena_t));
+
+    if (arena == NULL)
     {
-        return 10;
+        return NULL;
     }
+    arena -> heap = heap;
+    arena -> chunks = NULL;
+    arena -> bump = NULL;
+    arena -> end = NULL;
+    arena -> chunk_size = (chunk_size == 0) ? arena_chunk_size : align(chunk_size);
+    return arena;
 }
 
 /*
- * insert_free_block: This function first determines the index
- *                    of the segregated list into which the block
- *                    should be inserted. It then inserts the block at the start
- *                    of the list
+ * mm_arena_alloc: returns size bytes from the arena, aligned like malloc,
+ *                 or NULL if a new chunk is needed and can't be allocated.
+ *                 The block lives until the arena is reset or destroyed.
  */
-static void insert_free_block (block_t *block)
+void *mm_arena_alloc(mm_arena_t *arena, size_t size)
 {
-    size_t size = get_size (block);
-    int ind = find_free_list (size);
+    char *bp;
+    arena_chunk_t *chunk;
 
-    /* If nothing is present in the segregated list */
-    if (freeListPtr[ind] == NULL)
+    if (size == 0 || size > SIZE_MAX - ALIGNMENT) // Would wrap when aligned
     {
-        (block -> d).ptrArr[0] = NULL;
-        (block -> d).ptrArr[1] = NULL;
-        freeListPtr[ind] = block;
+        return NULL;
     }
+    size = align(size);
 
-    /* If the segregated list is not empty. Inserting the new block
-    after the block pointed by startIndex[ind] so the newly inserted block is 
-    also included in the next search */
-    else
+    if (size <= (size_t) (arena -> end - arena -> bump)) // Common case
     {
-        if (startIndex[ind] == NULL)
-        {
-            (block -> d).ptrArr[1] = freeListPtr[ind];
-            (block -> d).ptrArr[0] = NULL;
-            ((freeListPtr[ind]) -> d).ptrArr[0] = block;
-            freeListPtr[ind] = block;
-        }
-        else if (((startIndex[ind]) -> d).ptrArr[1] == NULL)
-        {
-            ((startIndex[ind]) -> d).ptrArr[1] = block;
-            (block -> d).ptrArr[0] = startIndex[ind];
-            (block -> d).ptrArr[1] = NULL;
-        }
-        else
+        bp = arena -> bump;
+        arena -> bump += size;
+        return bp;
+    }
+
+    // Big requests get their own chunk and leave the current one alone
+    if (size > arena -> chunk_size / 4)
+    {
+        chunk = arena_new_chunk (arena, size);
+        return (chunk == NULL) ? NULL : (void *) (chunk + 1);
+    }
+
+    chunk = arena_new_chunk (arena, arena -> chunk_size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    arena -> bump = (char *) (chunk + 1) + size;
+    arena -> end = (char *) (chunk + 1) + chunk -> size;
+    return chunk + 1;
+}
+
+/*
+ * mm_arena_reset: releases every block in the arena. All chunks but the
+ *                 current one are freed; the current one is kept for the
+ *                 next round of allocations.
+ */
+void mm_arena_reset(mm_arena_t *arena)
+{
+    arena_chunk_t *current = arena_current (arena);
+    arena_chunk_t *chunk = arena -> chunks;
+    arena_chunk_t *next;
+
+    while (chunk != NULL)
+    {
+        next = chunk -> next;
+        if (chunk != current)
         {
-            (block -> d).ptrArr[1] = ((startIndex[ind]) -> d).ptrArr[1];
-            (((block -> d).ptrArr[1]) -> d).ptrArr[0] = block;
-            ((startIndex[ind]) -> d).ptrArr[1] = block;
-            (block -> d).ptrArr[0] = startIndex[ind];
+            mm_heap_free(arena -> heap, chunk);
         }
+        chunk = next;
+    }
+
+    chunk = current;
+    arena -> chunks = chunk;
+    if (chunk != NULL)
+    {
+        chunk -> next = NULL;
+        arena -> bump = (char *) (chunk + 1);
     }
-    return;
 }
 
 /*
- * remove_block: This function removes the block from a particular
- *               segregated list while making sure the linking is not
- *               destroyed
+ * mm_arena_destroy: releases every block in the arena and the arena itself.
  */
-static void remove_block (block_t *block)
+void mm_arena_destroy(mm_arena_t *arena)
 {
-    size_t size = get_size (block);
-    int ind = find_free_list (size);
-    block_t *freeListStart = freeListPtr[ind];
+    if (arena == NULL)
+    {
+        return;
+    }
+    mm_arena_reset(arena);
+    mm_heap_free(arena -> heap, arena_current (arena));
+    mm_heap_free(arena -> heap, arena);
+}
 
-    /* If the block to be deleted is the sole block in the list */
-    if (((block -> d).ptrArr[0] == NULL) && ((block -> d).ptrArr[1] == NULL))
+/*
+ * mm_heap_cache_create: returns a new cache on the heap of objects of
+ *                       objsize bytes, aligned to align bytes (a power of
+ *                       two; 0 means as malloc), or NULL on failure.
+ */
+mm_cache_t *mm_heap_cache_create(mm_heap_t *heap, size_t objsize, size_t align)
+{
+    mm_cache_t *cache;
+    size_t slab_size = slab_min_size;
+
+    if (align == 0)
     {
-        freeListStart = NULL;
+        align = ALIGNMENT;
+    }
+    if (!is_power_of_two (align) || objsize == 0 ||
+        objsize > SIZE_MAX / (4 * slab_min_objects) ||
+        align > SIZE_MAX / (4 * slab_min_objects))
+    {
+        return NULL;
     }
+    if (align < sizeof(void *))
+    {
+        align = sizeof(void *);
+    }
+    objsize = (max(objsize, sizeof(void *)) + align - 1) & ~(align - 1);
 
-    /* If the block to be deleted is at the start of the segregated list*/
-    else if (((block -> d).ptrArr[0] == NULL) && ((block -> d).ptrArr[1] != NULL))
+    // A slab holds its header and at least slab_min_objects objects
+    while (slab_size < sizeof(cache_slab_t) + align + dsize +
+                       slab_min_objects * objsize)
     {
-        freeListStart = (block -> d).ptrArr[1];
-        (freeListStart -> d).ptrArr[0] = NULL;
+        slab_size *= 2;
     }
 
-    /* If the block to be deleted is at the end of the segregated list */
-    else if (((block -> d).ptrArr[0] != NULL) && ((block -> d).ptrArr[1] == NULL))
+    cache = mm_heap_malloc(heap, sizeof(mm_cache_t));
+    if (cache == NULL)
     {
-        (((block -> d).ptrArr[0]) -> d).ptrArr[1] = NULL;
+        return NULL;
     }
+    cache -> heap = heap;
+    cache -> partial = NULL;
+    cache -> full = NULL;
+    cache -> empty = NULL;
+    cache -> objsize = objsize;
+    cache -> align = align;
+    cache -> slab_size = slab_size;
+    cache -> next = heap -> cache_list;
+    heap -> cache_list = cache;
+    return cache;
+}
 
-    /* If the block to be deleted is at the middle of the segregated list */
+/*
+ * mm_cache_alloc: returns an object from the cache, or NULL on failure.
+ */
+void *mm_cache_alloc(mm_cache_t *cache)
+{
+    cache_slab_t *slab = cache -> partial;
+    void *obj;
+
+    if (slab == NULL)
+    {
+        slab = cache -> empty;
+        if (slab != NULL)
+        {
+            slab_unlink (&(cache -> empty), slab);
+        }
+        else
+        {
+            // A slab is a double word short of slab_size, so that its
+            // block ends at the next slab boundary and slabs can sit
+            // back to back in the heap
+            size_t bytes = cache -> slab_size - dsize;
+            uintptr_t first = (uintptr_t) (slab = mm_heap_memalign(cache -> heap,
+                                                            cache -> slab_size, bytes));
+            if (slab == NULL)
+            {
+                return NULL;
+            }
+            // Objects start at the first aligned address after the header
+            first = (first + sizeof(cache_slab_t) + cache -> align - 1)
+                        & ~(uintptr_t) (cache -> align - 1);
+            slab -> free = NULL;
+            slab -> bump = (char *) first;
+            slab -> end = (char *) slab + bytes;
+            slab -> inuse = 0;
+        }
+        slab_push (&(cache -> partial), slab);
+    }
+
+    if (slab -> free != NULL) // Most recently freed object first
+    {
+        obj = slab -> free;
+        slab -> free = *(void **) obj;
+    }
     else
     {
-        (((block -> d).ptrArr[0]) -> d).ptrArr[1] = (block -> d).ptrArr[1];
-        (((block -> d).ptrArr[1]) -> d).ptrArr[0] = (block -> d).ptrArr[0];
+        obj = slab -> bump;
+        slab -> bump += cache -> objsize;
     }
-    freeListPtr[ind] = freeListStart;
+    slab -> inuse ++;
 
-    /* If the block to be removed is the starting index for a segregated
-    list, change the index to the next block if not NULL else set it to start
-    of the list*/
-    if (startIndex[ind] == block)
+    if (slab -> free == NULL &&
+        (size_t) (slab -> end - slab -> bump) < cache -> objsize)
+    {
+        slab_unlink (&(cache -> partial), slab);
+        slab_push (&(cache -> full), slab);
+    }
+    return obj;
+}
+
+/*
+ * mm_cache_free: returns obj, which came from mm_cache_alloc on the same
+ *                cache, to the cache.
+ */
+void mm_cache_free(mm_cache_t *cache, void *obj)
+{
+    cache_slab_t *slab;
+    bool was_full;
+
+    if (obj == NULL)
+    {
+        return;
+    }
+    slab = (cache_slab_t *) ((uintptr_t) obj & ~(uintptr_t) (cache -> slab_size - 1));
+    was_full = (slab -> free == NULL &&
+                (size_t) (slab -> end - slab -> bump) < cache -> objsize);
+
+    *(void **) obj = slab -> free;
+    slab -> free = obj;
+    slab -> inuse --;
+
+    if (slab -> inuse == 0)
+    {
+        slab_unlink (was_full ? &(cache -> full) : &(cache -> partial), slab);
+        slab_push (&(cache -> empty), slab);
+    }
+    else if (was_full)
+    {
+        slab_unlink (&(cache -> full), slab);
+        slab_push (&(cache -> partial), slab);
+    }
+}
+
+/*
+ * mm_cache_reap: gives the empty slabs of the cache back to the heap, and
+ *                returns how many there were.
+ */
+size_t mm_cache_reap(mm_cache_t *cache)
+{
+    size_t n = 0;
+    cache_slab_t *slab;
+
+    while ((slab = cache -> empty) != NULL)
+    {
+        cache -> empty = slab -> next;
+        mm_heap_free(cache -> heap, slab);
+        n ++;
+    }
+    return n;
+}
+
+/*
+ * mm_cache_destroy: gives every slab of the cache back to the heap, along
+ *                   with the cache itself. Objects still in use are lost.
+ */
+void mm_cache_destroy(mm_cache_t *cache)
+{
+    mm_cache_t **iter;
+    cache_slab_t *slab;
+
+    if (cache == NULL)
+    {
+        return;
+    }
+    for (iter = &(cache -> heap -> cache_list); *iter != NULL; iter = &((*iter) -> next))
+    {
+        if (*iter == cache)
+        {
+            *iter = cache -> next;
+            break;
+        }
+    }
+
+    mm_cache_reap(cache);
+    while ((slab = cache -> partial) != NULL)
+    {
+        cache -> partial = slab -> next;
+        mm_heap_free(cache -> heap, slab);
+    }
+    while ((slab = cache -> full) != NULL)
+    {
+        cache -> full = slab -> next;
+        mm_heap_free(cache -> heap, slab);
+    }
+    mm_heap_free(cache -> heap, cache);
+}
+
+/*
+ * find_free_list: This function finds the segregated list according
+ *                 to the size based on powers of 2. It then returns
+ *                 the index
+ */
+
+static int find_free_list (size_t size)
+{
+    if (size <= dsize)
+    {
+        return 0;
+    }
+    else if (size <= 64)
+    {
+        return 1;
+    }
+    else if (size <= 128)
+    {
+        return 2;
+    }
+    else if (size <= 256)
+    {
+        return 3;
+    }
+    else if (size <= 512)
+    {
+        return 4;
+    }
+    else if (size <= 1024)
+    {
+        return 5;
+    }
+    else if (size <= 2048)
+    {
+        return 6;
+    }
+    else if (size <= 4096)
+    {
+        return 7;
+    }
+    else if (size <= 8192)
+    {
+        return 8;
+    }
+    else if (size <= 16384)
+    {
+        return 9;
+    }
+    else if (size <= 32768)
+    {
+        return 10;
+    }
+    else
+    {
+        return 11;
+    }
+}
+
+/*
+ * insert_free_block: This function first determines the index
+ *                    of the segregated list into which the block
+ *                    should be inserted. It then inserts the block at the start
+ *                    of the list
+ */
+static void insert_free_block (mm_heap_t *heap, block_t *block)
+{
+    size_t size = get_size (block);
+    int ind = find_free_list (size);
+
+    heap -> freeCounts[ind] ++;
+    dir_insert (heap, block, ind, size);
+
+    /* If nothing is present in the segregated list */
+    if (heap -> freeListPtr[ind] == NULL)
+    {
+        set_prev_free (heap, block, NULL);
+        set_next_free (heap, block, NULL);
+        heap -> freeListPtr[ind] = block;
+    }
+
+    /* If the segregated list is not empty. Inserting the new block
+    after the block pointed by heap -> startIndex[ind] so the newly inserted block is 
+    also included in the next search */
+    else
+    {
+        if (heap -> startIndex[ind] == NULL)
+        {
+            set_next_free (heap, block, heap -> freeListPtr[ind]);
+            set_prev_free (heap, block, NULL);
+            set_prev_free (heap, heap -> freeListPtr[ind], block);
+            heap -> freeListPtr[ind] = block;
+        }
+        else if (get_next_free (heap, heap -> startIndex[ind]) == NULL)
+        {
+            set_next_free (heap, heap -> startIndex[ind], block);
+            set_prev_free (heap, block, heap -> startIndex[ind]);
+            set_next_free (heap, block, NULL);
+        }
+        else
+        {
+            block_t *next = get_next_free (heap, heap -> startIndex[ind]);
+            set_next_free (heap, block, next);
+            set_prev_free (heap, next, block);
+            set_next_free (heap, heap -> startIndex[ind], block);
+            set_prev_free (heap, block, heap -> startIndex[ind]);
+        }
+    }
+    return;
+}
+
+/*
+ * remove_block: This function removes the block from a particular
+ *               segregated list while making sure the linking is not
+ *               destroyed
+ */
+static void remove_block (mm_heap_t *heap, block_t *block)
+{
+    size_t size = get_size (block);
+    int ind = find_free_list (size);
+    block_t *freeListStart = heap -> freeListPtr[ind];
+    block_t *prev = get_prev_free (heap, block);
+    block_t *next = get_next_free (heap, block);
+
+    // Both neighbours are written below, after the directory update
+    prefetch_block (prev);
+    prefetch_block (next);
+    heap -> freeCounts[ind] --;
+    dir_remove (heap, block, ind);
+
+    /* If the block to be deleted is the sole block in the list */
+    if ((prev == NULL) && (next == NULL))
+    {
+        freeListStart = NULL;
+    }
+
+    /* If the block to be deleted is at the start of the segregated list*/
+    else if ((prev == NULL) && (next != NULL))
+    {
+        freeListStart = next;
+        set_prev_free (heap, freeListStart, NULL);
+    }
+
+    /* If the block to be deleted is at the end of the segregated list */
+    else if ((prev != NULL) && (next == NULL))
+    {
+        set_next_free (heap, prev, NULL);
+    }
+
+    /* If the block to be deleted is at the middle of the segregated list */
+    else
+    {
+        set_next_free (heap, prev, next);
+        set_prev_free (heap, next, prev);
+    }
+    heap -> freeListPtr[ind] = freeListStart;
+
+    /* If the block to be removed is the starting index for a segregated
+    list, change the index to the next block if not NULL else set it to start
+    of the list*/
+    if (heap -> startIndex[ind] == block)
+    {
+        if (next != NULL)
+        {
+            heap -> startIndex[ind] = next;
+        }
+        else
+        {
+            heap -> startIndex[ind] = heap -> freeListPtr[ind];
+        }
+    }
+    return;
+}
+
+
+
+/*
+ * extend_heap: Extends the heap with the requested number of bytes, and
+ *              recreates epilogue header. Returns a pointer to the result of
+ *              coalescing the newly-created block with previous free block, if
+ *              applicable, or NULL in failure.
+ */
+static block_t *extend_heap(mm_heap_t *heap, size_t size) 
+{
+    void *bp;
+
+    // Allocate an even number of words to maintain alignment
+    size = align(size);
+    if (size > mem_region_room(heap -> region))
+    {
+        return add_segment(heap, size);
+    }
+    if ((bp = mem_region_sbrk(heap -> region, size)) == (void *)-1)
+    {
+        return NULL;
+    }
+    
+    // Initialize free block header/footer 
+    block_t *block = payload_to_header(bp);
+    write_header(block, size, false, get_alloc (heap -> last_block));
+    write_footer(block, size, false, get_alloc (heap -> last_block));
+
+    // Create new epilogue header
+    block_t *block_next = find_next(block);
+    write_header(block_next, 0, true, false);
+
+    heap -> last_block = block;
+    // Coalesce in case the previous block was free
+    block_t *finalBlock = coalesce (heap, block);
+    return finalBlock;
+}
+
+/*
+ * grow_size: returns how far to extend the heap for a free block of asize
+ *            bytes, when nothing fits. A free tail block of at least a
+ *            quarter of asize is grown by just what it lacks, unless the
+ *            extension doesn't fit in the region: it then becomes a
+ *            segment, which can't merge with the tail, and gets all of
+ *            asize. A smaller tail is left for small requests. The
+ *            extension is at least chunksize, and after grow_streak_min
+ *            extensions in a row with no free between them, at least
+ *            1/2^grow_shift of the heap, so a heap that only grows is
+ *            extended geometrically.
+ */
+static size_t grow_size(mm_heap_t *heap, size_t asize)
+{
+    size_t tail = get_alloc (heap -> last_block) ? 0 : get_size (heap -> last_block);
+    size_t grow = chunksize;
+    size_t need = asize;
+
+    if (tail * shortfall_share >= asize)
+    {
+        need = (asize > tail) ? asize - tail : 0;
+    }
+    if (heap -> grow_streak < UINT8_MAX)
+    {
+        heap -> grow_streak ++;
+    }
+    if (heap -> grow_streak >= grow_streak_min)
+    {
+        grow = max(grow, mem_region_size(heap -> region) >> grow_shift);
+    }
+    // A segment doesn't merge with the tail, so it must hold all of asize
+    if (align (max(need, grow)) > mem_region_room(heap -> region))
+    {
+        return max(asize, grow);
+    }
+    return max(need, grow);
+}
+
+/*
+ * realloc_in_place: resizes an allocated block to asize bytes where it is,
+ *                   taking in the free block after it if there is one.
+ *                   What is left past asize is split off by place. Returns
+ *                   false, leaving the block alone, if there is not room.
+ */
+static bool realloc_in_place(mm_heap_t *heap, block_t *block, size_t asize)
+{
+    block_t *block_next = find_next(block);
+    size_t size = get_size(block);
+
+    if (!get_alloc (block_next))
+    {
+        size += get_size(block_next);
+        if (size < asize)
+        {
+            return false;
+        }
+        remove_block (heap, block_next);
+        if (block_next == heap -> last_block)
+        {
+            heap -> last_block = block;
+        }
+        write_header(block, size, true, get_prev_alloc (block));
+        change_alloc_next_block (block, true);
+    }
+    else if (size < asize)
+    {
+        return false;
+    }
+    place(heap, block, asize);
+    return true;
+}
+
+/*
+ * realloc_fit: places a block of asize bytes at the start of a free block
+ *              of at least room bytes, so that the rest is a free block
+ *              right after it, and returns its payload. Returns NULL,
+ *              rather than extend the heap, if there is none.
+ */
+static void *realloc_fit(mm_heap_t *heap, size_t asize, size_t room)
+{
+    block_t *block = find_fit(heap, room);
+
+    if (block == NULL)
+    {
+        return NULL;
+    }
+    remove_block (heap, block);
+    change_alloc_next_block (block, true);
+    place(heap, block, asize);
+    return header_to_payload(block);
+}
+
+/*
+ * mark_grown: marks an allocated block that realloc has grown, if it is
+ *             at least realloc_grown_min bytes, or clears the mark.
+ */
+static void mark_grown(block_t *block, bool grown)
+{
+    if (grown && get_size(block) >= realloc_grown_min)
+    {
+        block -> header |= 0x8;
+    }
+    else
+    {
+        block -> header &= ~(word_t) 0x8;
+    }
+}
+
+/*
+ * add_segment: gives the heap a segment, from memlib, with room for a free
+ *              block of at least size bytes, for when the region's break
+ *              can't grow. Returns the block, which is not inserted into
+ *              the segregated lists, or NULL in failure. The segment must
+ *              be in reach of the 32-bit links.
+ */
+static block_t *add_segment(mm_heap_t *heap, size_t size)
+{
+    size_t page = mem_pagesize();
+    size_t ssize = max(size + segment_overhead, segment_min_size);
+    heap_segment_t *seg;
+
+    ssize = (ssize + page - 1) & ~(page - 1);
+    seg = mem_region_segment(heap -> region, ssize);
+    if (seg == NULL)
+    {
+        return NULL;
+    }
+#ifndef WIDE_LINKS
+    if ((char *) seg < link_base (heap) ||
+        (size_t) ((char *) seg + ssize - link_base (heap)) >> 4 > UINT32_MAX)
+    {
+        mem_region_segment_release(heap -> region, seg);
+        return NULL;
+    }
+#endif
+    seg -> size = ssize;
+    seg -> next = heap -> segments;
+    heap -> segments = seg;
+
+    word_t *start = (word_t *) (seg + 1);
+    start[0] = pack(0, true, true); // Prologue footer
+    block_t *block = (block_t *) &start[1];
+    size = ssize - segment_overhead;
+    write_header(block, size, false, true);
+    write_footer(block, size, false, true);
+    find_next(block) -> header = pack(0, true, false); // Epilogue header
+    return block;
+}
+
+/*
+ * release_segment: if the free block, which is in no list, fills a whole
+ *                  segment and another segment is already empty, gives the
+ *                  segment back to memlib and returns true. The first
+ *                  segment to empty is kept on the lists instead, so a heap
+ *                  that keeps crossing a segment's worth of blocks doesn't
+ *                  map and unmap one each time. The brk part of the heap is
+ *                  never released here.
+ */
+static bool release_segment(mm_heap_t *heap, block_t *block)
+{
+    heap_segment_t **link = NULL;
+    heap_segment_t **iter;
+    heap_segment_t *seg;
+    bool cached = false;
+
+    // Only the last block of a segment, which is not last_block, can fill it
+    if (block == heap -> last_block || get_size (find_next (block)) != 0)
+    {
+        return false;
+    }
+    seg = (heap_segment_t *) ((char *) block - sizeof(heap_segment_t) - wsize);
+    for (iter = &heap -> segments; *iter != NULL; iter = &(*iter) -> next)
+    {
+        if (*iter == seg)
+        {
+            link = iter;
+        }
+        else if (segment_empty (*iter))
+        {
+            cached = true;
+        }
+    }
+    if (link == NULL || !cached ||
+        get_size (block) != seg -> size - segment_overhead)
+    {
+        return false;
+    }
+    *link = seg -> next;
+    mem_region_segment_release(heap -> region, seg);
+    return true;
+}
+
+/*
+ * segment_block: returns the first block of the segment.
+ */
+static block_t *segment_block(heap_segment_t *seg)
+{
+    return (block_t *) ((char *) (seg + 1) + wsize);
+}
+
+/*
+ * segment_empty: returns true if the segment is a single free block.
+ */
+static bool segment_empty(heap_segment_t *seg)
+{
+    block_t *block = segment_block (seg);
+
+    return !get_alloc (block) && get_size (block) == seg -> size - segment_overhead;
+}
+
+/*
+ * trim_segments: gives every empty segment, including the one that
+ *                release_segment keeps, back to memlib. Returns the number
+ *                of bytes given back.
+ */
+static size_t trim_segments(mm_heap_t *heap)
+{
+    heap_segment_t **link = &heap -> segments;
+    heap_segment_t *seg;
+    size_t trim = 0;
+
+    while ((seg = *link) != NULL)
+    {
+        if (!segment_empty (seg))
+        {
+            link = &seg -> next;
+            continue;
+        }
+        remove_block (heap, segment_block (seg));
+        *link = seg -> next;
+        trim += seg -> size;
+        mem_region_segment_release(heap -> region, seg);
+    }
+    return trim;
+}
+
+/* Coalesce: Coalesces current block with previous and next blocks if
+ *           either or both are unallocated; otherwise the block is not
+ *           modified. Then, insert coalesced block into the segregated list.
+ *           Returns pointer to the coalesced block. After coalescing, the
+ *           immediate contiguous previous and next blocks must be allocated. If 
+ *           in any situation the blocks to be coalesced is the last block then 
+ *           the pointer to the last block is changed accordingly
+ */
+static block_t *coalesce(mm_heap_t *heap, block_t * block) 
+{
+    block_t *block_prev;
+    block_t *block_next = find_next(block);
+    bool prev_alloc = get_prev_alloc (block);
+    bool next_alloc;
+    size_t size = get_size(block);
+
+    // The previous block's header is only needed after the next block's
+    if (!prev_alloc)
+    {
+        prefetch_block (find_prev (block));
+    }
+    next_alloc = get_alloc(block_next);
+
+    if (prev_alloc && next_alloc)              // Case 1
+    {
+        return block;
+    }
+
+    else if (prev_alloc && !next_alloc)        // Case 2
+    {
+        size += get_size(block_next);
+        if (block_next == heap -> last_block)
+        {
+            heap -> last_block = block;
+        }
+        remove_block (heap, block_next);
+        write_header(block, size, false, true);
+        write_footer(block, size, false, true);
+    }
+
+    else if (!prev_alloc && next_alloc)        // Case 3
+    {
+        block_prev = find_prev (block);
+        size += get_size(block_prev);
+        if (block == heap -> last_block)
+        {
+            heap -> last_block = block_prev;
+        }
+        remove_block (heap, block_prev);
+        write_header(block_prev, size, false, get_prev_alloc (block_prev));
+        write_footer(block_prev, size, false, get_prev_alloc (block_prev));
+        block = block_prev;
+    }
+
+    else                                        // Case 4
+    {
+        block_prev = find_prev (block);
+        size += get_size(block_next) + get_size(block_prev);
+        if (block_next == heap -> last_block)
+        {
+            heap -> last_block = block_prev;
+        }
+        remove_block (heap, block_next);
+        remove_block (heap, block_prev);
+        write_header(block_prev, size, false, get_prev_alloc (block_prev));
+        write_footer(block_prev, size, false, get_prev_alloc (block_prev));
+        block = block_prev;
+    }
+    return block;
+}
+
+/*
+ * place: Places block with size of asize at the start of bp. If the remaining
+ *        size is at least min_block_size, then split the block to the
+ *        the allocated block and the remaining block as free, which is then
+ *        inserted into the segregated list. A mini block is split off too,
+ *        so that an allocated block is exactly asize bytes, which
+ *        mm_heap_free_sized relies on; only with WIDE_LINKS is a 16-byte
+ *        remainder given to the block. Requires that the
+ *        block is initially unallocated.
+ */
+static void 
+place(mm_heap_t *heap, block_t *block, size_t asize)
+{
+    size_t csize = get_size(block);
+
+    if ((csize - asize) >= min_block_size)
+    {
+	    block_t *block_next;
+        write_header(block, asize, true, get_prev_alloc (block));
+
+        block_next = find_next(block);
+        write_header(block_next, csize-asize, false, true);
+        write_footer(block_next, csize-asize, false, true);
+        change_alloc_next_block (block_next, false);
+        if (block == heap -> last_block)
+        {
+            heap -> last_block = block_next;
+        }
+        insert_free_block (heap, block_next);
+    }
+    else
+    { 
+        write_header(block, csize, true, get_prev_alloc (block));
+    }
+}
+
+/*
+ * change_alloc_next_block: This function changes the second last bit of the 
+ *                          next block based on the allocation status of the 
+ *                          current block passed in as a parameter.
+ */
+static void change_alloc_next_block (block_t *block, bool alloc)
+{
+    block_t *nextBlock = find_next (block);
+    nextBlock -> header = (alloc) ? ((nextBlock -> header) | (0x2)) : 
+                        ((nextBlock -> header) & (0xFFFFFFFFFFFFFFFD));
+}
+
+/*
+ * adjust_size: returns the size of the block needed for a payload of size
+ *              bytes: the payload plus the header, rounded up to 16 bytes,
+ *              and at least the minimum block size.
+ */
+static size_t adjust_size (size_t size)
+{
+    return max (min_block_size, align (size - wsize) + dsize);
+}
+
+/*
+ * free_runs: frees the blocks at the n payload pointers in ptrs, which are
+ *            sorted by address, merging each run of blocks that are
+ *            adjacent in the heap into a single free block. NULL pointers
+ *            are ignored.
+ */
+static void free_runs (mm_heap_t *heap, void **ptrs, size_t n)
+{
+    size_t i = 0;
+
+    while (i < n && ptrs[i] == NULL)
+    {
+        i ++;
+    }
+    if (i < n)
+    {
+        heap -> grow_streak = 0;
+    }
+
+    while (i < n)
+    {
+        block_t *start = payload_to_header(ptrs[i]);
+        block_t *end = start;
+        size_t size = get_size(start);
+        block_t *newBlock;
+
+        /* Extend the run while the next pointer is the next block */
+        for (i ++; i < n && payload_to_header(ptrs[i]) == find_next(end); i ++)
+        {
+            end = payload_to_header(ptrs[i]);
+            size += get_size(end);
+        }
+
+        if (end == heap -> last_block)
+        {
+            heap -> last_block = start;
+        }
+        write_header(start, size, false, get_prev_alloc (start));
+        write_footer(start, size, false, get_prev_alloc (start));
+
+        newBlock = coalesce(heap, start);
+        settle_free_block (heap, newBlock);
+    }
+}
+
+/*
+ * compare_address: orders payload pointers by address, for qsort.
+ */
+static int compare_address (const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(void * const *) a;
+    uintptr_t y = (uintptr_t) *(void * const *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * carve_batch: splits the free block, already off the free lists, into up
+ *              to n allocated blocks of asize bytes, storing their payload
+ *              pointers in out. The remainder is split off as a free block
+ *              if it is large enough, and otherwise given to the last
+ *              allocated block. Returns the number of blocks carved.
+ */
+static size_t carve_batch (mm_heap_t *heap, block_t *block, size_t asize, size_t n, void **out)
+{
+    size_t csize = get_size(block);
+    size_t k = csize / asize;
+    bool was_last = (block == heap -> last_block);
+    block_t *iter = block;
+
+    if (k > n)
+    {
+        k = n;
+    }
+
+    /* Every block but the first follows an allocated one */
+    for (size_t i = 0; i < k; i ++)
+    {
+        size_t bsize = asize;
+        if (i == k - 1 && (csize - k * asize) < min_block_size)
+        {
+            bsize += csize - k * asize; // Remainder too small to split off
+        }
+        write_header(iter, bsize, true, (i == 0) ? get_prev_alloc (iter) : true);
+        out[i] = header_to_payload(iter);
+        if (was_last)
+        {
+            heap -> last_block = iter;
+        }
+        iter = find_next(iter);
+    }
+
+    /* iter is now the block following the last one carved */
+    if ((csize - k * asize) >= min_block_size)
+    {
+        write_header(iter, csize - k * asize, false, true);
+        write_footer(iter, csize - k * asize, false, true);
+        change_alloc_next_block (iter, false);
+        if (was_last)
+        {
+            heap -> last_block = iter;
+        }
+        insert_free_block (heap, iter);
+    }
+    else
+    {
+        change_alloc_next_block (payload_to_header(out[k - 1]), true);
+    }
+    return k;
+}
+
+/*
+ * free_block: marks the block free, given its header and size, then
+ *             coalesces it and inserts it into the segregated list.
+ */
+static void free_block (mm_heap_t *heap, block_t *block, word_t header, size_t size)
+{
+    block_t *newBlock;
+    bool prev_alloc = extract_prev_alloc(header);
+
+    heap -> grow_streak = 0;
+
+    // coalesce reads the next header, which is far away in a large block
+    prefetch_block ((char *) block + size);
+    write_header(block, size, false, prev_alloc);
+    write_footer(block, size, false, prev_alloc);
+
+    newBlock = coalesce(heap, block);
+    settle_free_block (heap, newBlock);
+}
+
+/*
+ * settle_free_block: puts a block that was just freed and coalesced into
+ *                    the segregated list, unless release_segment gives
+ *                    its segment back to memlib.
+ */
+static void settle_free_block (mm_heap_t *heap, block_t *block)
+{
+    if (heap -> segments != NULL && release_segment (heap, block))
+    {
+        return;
+    }
+    change_alloc_next_block (block, false);
+    insert_free_block (heap, block);
+}
+
+/*
+ * is_power_of_two: returns true if x is a (nonzero) power of two.
+ */
+static bool is_power_of_two (size_t x)
+{
+    return x != 0 && (x & (x - 1)) == 0;
+}
+
+/*
+ * arena_new_chunk: allocates a chunk with size bytes of data and pushes it
+ *                  on the arena's list of chunks. Returns NULL on failure.
+ */
+static arena_chunk_t *arena_new_chunk (mm_arena_t *arena, size_t size)
+{
+    arena_chunk_t *chunk;
+
+    if (size > SIZE_MAX - sizeof(arena_chunk_t)) // Chunk size overflows
+    {
+        return NULL;
+    }
+    chunk = mm_heap_malloc(arena -> heap, sizeof(arena_chunk_t) + size);
+    if (chunk == NULL)
+    {
+        return NULL;
+    }
+    chunk -> size = size;
+    chunk -> next = arena -> chunks;
+    arena -> chunks = chunk;
+    return chunk;
+}
+
+/*
+ * arena_current: returns the chunk the bump pointer is in, found from its
+ *                end, or NULL if the arena has none.
+ */
+static arena_chunk_t *arena_current (mm_arena_t *arena)
+{
+    if (arena -> end == NULL)
+    {
+        return NULL;
+    }
+    return (arena_chunk_t *) (arena -> end - arena -> chunk_size) - 1;
+}
+
+/*
+ * slab_unlink: removes the slab from a list of slabs.
+ */
+static void slab_unlink (cache_slab_t **list, cache_slab_t *slab)
+{
+    if (slab -> prev != NULL)
+    {
+        slab -> prev -> next = slab -> next;
+    }
+    else
+    {
+        *list = slab -> next;
+    }
+    if (slab -> next != NULL)
+    {
+        slab -> next -> prev = slab -> prev;
+    }
+}
+
+/*
+ * slab_push: adds the slab to the front of a list of slabs.
+ */
+static void slab_push (cache_slab_t **list, cache_slab_t *slab)
+{
+    slab -> prev = NULL;
+    slab -> next = *list;
+    if (*list != NULL)
+    {
+        (*list) -> prev = slab;
+    }
+    *list = slab;
+}
+
+/*
+ * reap_caches: gives the empty slabs of every cache back to the heap, and
+ *              returns how many there were.
+ */
+static size_t reap_caches (mm_heap_t *heap)
+{
+    size_t n = 0;
+
+    for (mm_cache_t *cache = heap -> cache_list; cache != NULL; cache = cache -> next)
+    {
+        n += mm_cache_reap(cache);
+    }
+    return n;
+}
+
+/*
+ * fastbin_push: puts a block being freed on the fast bin for its size,
+ *               without coalescing it, and consolidates the bins if they
+ *               have grown past fastbin_limit. Returns false, leaving the
+ *               block alone, if the block is too large for a fast bin.
+ */
+static bool fastbin_push (mm_heap_t *heap, block_t *block, size_t size)
+{
+    size_t ind = (size - min_block_size) / dsize;
+
+    if (ind >= (size_t) fastbin_count)
+    {
+        return false;
+    }
+    heap -> grow_streak = 0;
+    (block -> d).ptrArr[0] = heap -> fastBins[ind];
+    heap -> fastBins[ind] = block;
+    heap -> fastbin_bytes += size;
+    if (heap -> fastbin_bytes > fastbin_limit)
+    {
+        consolidate_fastbins (heap);
+    }
+    return true;
+}
+
+/*
+ * fastbin_pop: takes a block of exactly asize bytes off its fast bin and
+ *              returns it, still marked allocated, or NULL if there is none.
+ */
+static block_t *fastbin_pop (mm_heap_t *heap, size_t asize)
+{
+    size_t ind = (asize - min_block_size) / dsize;
+    block_t *block;
+
+    if (ind >= (size_t) fastbin_count || heap -> fastBins[ind] == NULL)
+    {
+        return NULL;
+    }
+    block = heap -> fastBins[ind];
+    heap -> fastBins[ind] = (block -> d).ptrArr[0];
+    heap -> fastbin_bytes -= asize;
+    return block;
+}
+
+/*
+ * consolidate_fastbins: frees every block in the fast bins for real, so
+ *                       that they coalesce with their free neighbours and
+ *                       go on the segregated lists. Returns false if the
+ *                       bins were empty.
+ */
+static bool consolidate_fastbins (mm_heap_t *heap)
+{
+    block_t *block;
+
+    if (heap -> fastbin_bytes == 0)
+    {
+        return false;
+    }
+    for (int i = 0; i < fastbin_count; i ++)
+    {
+        while ((block = heap -> fastBins[i]) != NULL)
+        {
+            heap -> fastBins[i] = (block -> d).ptrArr[0];
+            free_block (heap, block, block -> header, get_size (block));
+        }
+    }
+    heap -> fastbin_bytes = 0;
+    return true;
+}
+
+/*
+ * find_fit_or_consolidate: like find_fit, but if nothing fits, empties the
+ *                          fast bins into the segregated lists and tries
+ *                          again before giving up.
+ */
+static block_t *find_fit_or_consolidate (mm_heap_t *heap, size_t asize)
+{
+    block_t *block = find_fit(heap, asize);
+
+    if (block == NULL && consolidate_fastbins (heap))
+    {
+        block = find_fit(heap, asize);
+    }
+    return block;
+}
+
+/*
+ * get_next_free: returns the next block in the free list of a free block.
+ */
+static block_t *get_next_free (mm_heap_t *heap, block_t *block)
+{
+#ifdef WIDE_LINKS
+    return (block -> d).ptrArr[1];
+#else
+    uint32_t link = (block -> d).links[1];
+    return (link == 0) ? NULL :
+        (block_t *)(link_base (heap) + ((size_t) link << 4) + wsize);
+#endif
+}
+
+/*
+ * get_prev_free: returns the previous block in the free list of a free block.
+ */
+static block_t *get_prev_free (mm_heap_t *heap, block_t *block)
+{
+#ifdef WIDE_LINKS
+    return (block -> d).ptrArr[0];
+#else
+    uint32_t link = (block -> d).links[0];
+    return (link == 0) ? NULL :
+        (block_t *)(link_base (heap) + ((size_t) link << 4) + wsize);
+#endif
+}
+
+/*
+ * set_next_free: sets the next block in the free list of a free block. A
+ *                link is the distance from the start of the heap in units
+ *                of 16 bytes; no free block starts in the first 16 bytes,
+ *                so 0 stands for NULL.
+ */
+static void set_next_free (mm_heap_t *heap, block_t *block, block_t *next)
+{
+#ifdef WIDE_LINKS
+    (block -> d).ptrArr[1] = next;
+#else
+    dbg_assert(next == NULL || (size_t) ((char *) next - link_base (heap)) >> 4 <= UINT32_MAX);
+    (block -> d).links[1] = (next == NULL) ? 0 :
+        (uint32_t) (((char *) next - link_base (heap)) >> 4);
+#endif
+}
+
+/*
+ * set_prev_free: sets the previous block in the free list of a free block.
+ */
+static void set_prev_free (mm_heap_t *heap, block_t *block, block_t *prev)
+{
+#ifdef WIDE_LINKS
+    (block -> d).ptrArr[0] = prev;
+#else
+    dbg_assert(prev == NULL || (size_t) ((char *) prev - link_base (heap)) >> 4 <= UINT32_MAX);
+    (block -> d).links[0] = (prev == NULL) ? 0 :
+        (uint32_t) (((char *) prev - link_base (heap)) >> 4);
+#endif
+}
+
+/*
+ * link_base: returns the address links are offsets from, the words right
+ *            after the struct mm_heap. It is a constant distance from the
+ *            heap, so no load is needed to find it.
+ */
+static char *link_base (mm_heap_t *heap)
+{
+    return (char *) heap + align(sizeof(mm_heap_t));
+}
+
+/*
+ * block_link: returns the 32-bit link to a free block.
+ */
+static uint32_t block_link (mm_heap_t *heap, block_t *block)
+{
+    return (uint32_t) (((char *) block - link_base (heap)) >> 4);
+}
+
+/*
+ * link_block: returns the free block a (non-zero) 32-bit link refers to.
+ */
+static block_t *link_block (mm_heap_t *heap, uint32_t link)
+{
+    return (block_t *)(link_base (heap) + ((size_t) link << 4) + wsize);
+}
+
+/*
+ * dir_usable: returns true if list ind has a directory that is up to date.
+ */
+static bool dir_usable (mm_heap_t *heap, int ind)
+{
+    return dir_enabled && ind > 0 && (heap -> dir_stale & (1u << ind)) == 0 &&
+           heap -> freeDirs[ind] != NULL;
+}
+
+/*
+ * dir_insert: appends a block being inserted into list ind to its
+ *             directory, and stores the slot in the block. A directory
+ *             that is full, or missing on a list that has grown long
+ *             enough to have one, is marked stale instead.
+ */
+static void dir_insert (mm_heap_t *heap, block_t *block, int ind, size_t size)
+{
+    free_dir_t *dir = heap -> freeDirs[ind];
+    uint32_t slot;
+
+    if (!dir_enabled || ind == 0 || (heap -> dir_stale & (1u << ind)) != 0)
+    {
+        return;
+    }
+    if (dir == NULL || dir -> count == dir -> cap)
+    {
+        if (dir != NULL || heap -> freeCounts[ind] >= dir_min_list)
+        {
+            heap -> dir_stale |= 1u << ind;
+        }
+        return;
+    }
+    slot = dir -> count ++;
+    dir -> entries[slot] = (uint32_t) (size / dsize);
+    dir -> entries[dir -> cap + slot] = block_link (heap, block);
+    (block -> d).links[2] = slot;
+}
+
+/*
+ * dir_remove: removes a block being removed from list ind from its
+ *             directory, by moving the last entry into its slot.
+ */
+static void dir_remove (mm_heap_t *heap, block_t *block, int ind)
+{
+    free_dir_t *dir = heap -> freeDirs[ind];
+    uint32_t slot;
+    uint32_t last;
+
+    if (!dir_usable (heap, ind))
+    {
+        return;
+    }
+    slot = (block -> d).links[2];
+    last = -- dir -> count;
+    dbg_assert(dir -> entries[dir -> cap + slot] == block_link (heap, block));
+    if (slot != last)
+    {
+        uint32_t link = dir -> entries[dir -> cap + last];
+        dir -> entries[slot] = dir -> entries[last];
+        dir -> entries[dir -> cap + slot] = link;
+        (link_block (heap, link) -> d).links[2] = slot;
+    }
+}
+
+/*
+ * dir_search: returns the first slot in the directory whose size (in
+ *             units of 16 bytes) is at least want, or the count of
+ *             entries if there is none. Eight sizes are compared at a
+ *             time with SSE2, biased so that the signed compare orders
+ *             them as unsigned.
+ */
+static uint32_t dir_search (const free_dir_t *dir, uint32_t want)
+{
+    const uint32_t *sizes = dir -> entries;
+    uint32_t n = dir -> count;
+    uint32_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i bias = _mm_set1_epi32(INT32_MIN);
+    const __m128i below = _mm_set1_epi32((int32_t) ((want - 1) ^ 0x80000000u));
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i lo = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (sizes + i)), bias);
+        __m128i hi = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (sizes + i + 4)), bias);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(lo, below))) |
+                   (_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(hi, below))) << 4);
+        if (mask != 0)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < n; i ++)
+    {
+        if (sizes[i] >= want)
+        {
+            return i;
+        }
+    }
+    return n;
+}
+
+/*
+ * grow_directories: replaces every stale directory.
+ */
+static void grow_directories (mm_heap_t *heap)
+{
+    for (int i = 1; i < seg_list_count; i ++)
+    {
+        if ((heap -> dir_stale & (1u << i)) != 0)
+        {
+            grow_directory (heap, i);
+        }
+    }
+}
+
+/*
+ * grow_directory: replaces the directory of list ind with one twice the
+ *                 length of the list, allocated like any other block, and
+ *                 fills it from the list. The list stays stale while the
+ *                 allocation and the free of the old directory change the
+ *                 lists, and stays stale if the heap can't be extended.
+ */
+static void grow_directory (mm_heap_t *heap, int ind)
+{
+    size_t cap = 2 * heap -> freeCounts[ind];
+    size_t asize;
+    block_t *block;
+    free_dir_t *old = heap -> freeDirs[ind];
+
+    asize = adjust_size (sizeof(free_dir_t) + 2 * cap * sizeof(uint32_t));
+
+    block = search_fit (heap, asize);
+    if (block == NULL)
+    {
+        block = extend_heap(heap, grow_size(heap, asize));
+        if (block == NULL)
+        {
+            return;
+        }
+    }
+    else
+    {
+        remove_block (heap, block);
+    }
+    change_alloc_next_block (block, true);
+    place(heap, block, asize);
+
+    heap -> freeDirs[ind] = (free_dir_t *) header_to_payload(block);
+    heap -> freeDirs[ind] -> count = 0;
+    heap -> freeDirs[ind] -> cap = (uint32_t) cap;
+    if (old != NULL)
+    {
+        block = payload_to_header(old);
+        free_block (heap, block, block -> header, get_size (block));
+    }
+
+    heap -> dir_stale &= ~(1u << ind);
+    for (block = heap -> freeListPtr[ind]; block != NULL; block = get_next_free (heap, block))
+    {
+        dir_insert (heap, block, ind, get_size (block));
+    }
+}
+
+/*
+ * prefetch_block: in a build with PREFETCH defined, starts loading the
+ *                 cache line at p (a block header, or NULL) for writing.
+ *                 Otherwise it does nothing.
+ */
+static void prefetch_block (const void *p)
+{
+#ifdef PREFETCH
+    __builtin_prefetch(p, 1, 3);
+#else
+    (void) p;
+#endif
+}
+
+/*
+ * drain_remote_frees: takes the whole queue of remote frees at once, so
+ *                     pushes that race with it simply start a new queue,
+ *                     and frees every block on it.
+ */
+static void drain_remote_frees(mm_heap_t *heap)
+{
+    block_t *block = __atomic_exchange_n(&heap -> remote_free, NULL,
+                                         __ATOMIC_ACQUIRE);
+
+    while (block != NULL)
+    {
+        block_t *next = block -> d.ptrArr[0];
+        mm_heap_free(heap, header_to_payload(block));
+        block = next;
+    }
+}
+
+/*
+ * trim_heap: gives the free block at the end of the heap back to the
+ *            region, but for chunksize bytes, once it is larger than
+ *            trim_threshold. Returns the number of bytes given back.
+ */
+static size_t trim_heap (mm_heap_t *heap)
+{
+    block_t *block = heap -> last_block;
+    size_t size = get_size(block);
+    size_t trim;
+
+    if (get_alloc(block) || size < trim_threshold + chunksize)
+    {
+        return 0;
+    }
+    trim = size - chunksize;
+    remove_block (heap, block);
+    if (mem_region_trim(heap -> region, trim))
+    {
+        size = chunksize;
+        write_header(block, size, false, get_prev_alloc(block));
+        write_footer(block, size, false, get_prev_alloc(block));
+        find_next(block) -> header = pack(0, true, false); // New epilogue
+    }
+    else
+    {
+        trim = 0;
+    }
+    insert_free_block (heap, block);
+    return trim;
+}
+
+/*
+ * maint_work: one round of the work the maintenance thread does on the
+ *             heap: frees the blocks queued for it, maint_slice at a time
+ *             so malloc never waits long for the lock, then trims the
+ *             tail and the empty segments. On a round with nothing queued, it also empties the
+ *             fast bins, so their blocks coalesce while the heap is idle.
+ *             Returns true if there was anything to do.
+ */
+static bool maint_work (mm_heap_t *heap)
+{
+#ifdef MM_THREADSAFE
+    block_t *block = __atomic_exchange_n(&heap -> remote_free, NULL,
+                                         __ATOMIC_ACQUIRE);
+    bool busy = (block != NULL);
+
+    while (block != NULL)
+    {
+        lock_default ();
+        for (int i = 0; i < maint_slice && block != NULL; i ++)
+        {
+            block_t *next = block -> d.ptrArr[0];
+            mm_heap_free(heap, header_to_payload(block));
+            block = next;
+        }
+        unlock_default ();
+    }
+
+    lock_default ();
+    if (!busy && heap -> fastbin_bytes > 0)
+    {
+        busy = consolidate_fastbins (heap);
+    }
+    busy = (trim_heap (heap) > 0) || busy;
+    busy = (heap -> segments != NULL && trim_segments (heap) > 0) || busy;
+    unlock_default ();
+    return busy;
+#else
+    (void) heap;
+    return false;
+#endif
+}
+
+/*
+ * maint_main: the maintenance thread. It does a round of work every
+ *             maint_period_ns, or as soon as its share of a CPU allows
+ *             after a busy round, until it is stopped. It keeps to that
+ *             share by sleeping after each round for as long as the round
+ *             took it, scaled by (1 - share) / share. It sleeps on
+ *             maint_cond with the default lock, which mm_maint_stop holds
+ *             while it signals, so the signal can't come between the
+ *             check of maint_stopping and the wait.
+ */
+static void *maint_main (void *arg)
+{
+#ifdef MM_THREADSAFE
+    mm_heap_t *heap = arg;
+    struct timespec cpu0, cpu1, wake;
+    long rest = maint_period_ns;
+
+    lock_default ();
+    while (!__atomic_load_n(&maint_stopping, __ATOMIC_ACQUIRE))
+    {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += rest;
+        wake.tv_sec += wake.tv_nsec / 1000000000L;
+        wake.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&maint_cond, &default_lock, &wake);
+        if (__atomic_load_n(&maint_stopping, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        unlock_default ();
+
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+        bool busy = maint_work (heap);
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+
+        // After a busy round, come back as soon as the budget allows
+        double used = (cpu1.tv_sec - cpu0.tv_sec) * 1e9 +
+            (cpu1.tv_nsec - cpu0.tv_nsec);
+        double owed = used * (1 - maint_share) / maint_share;
+        rest = (busy || owed > maint_period_ns) ? (long) owed : maint_period_ns;
+        if (rest > 100 * maint_period_ns)
+        {
+            rest = 100 * maint_period_ns;
+        }
+        lock_default ();
+    }
+    unlock_default ();
+#else
+    (void) arg;
+#endif
+    return NULL;
+}
+
+/*
+ * cache_init: sets up the caches in front of a new default heap, if
+ *             MM_PERCPU is defined. Per-CPU caches live in the heap; the
+ *             per-thread caches of the last heap are dropped by bumping
+ *             the epoch. Returns false if the caches can't be allocated.
+ */
+static bool cache_init (void)
+{
+#ifdef MM_PERCPU
+    cache_epoch ++;
+    percpu_caches = NULL;
+    if (percpu_wanted && rseq_usable ())
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_CONF);
+        percpu_count = (cpus > 0) ? (unsigned) cpus : 1;
+        percpu_caches = mm_heap_memalign(default_heap, sizeof(cpu_cache_t),
+                                         percpu_count * sizeof(cpu_cache_t));
+        if (percpu_caches == NULL)
+        {
+            return false;
+        }
+        memset(percpu_caches, 0, percpu_count * sizeof(cpu_cache_t));
+    }
+#endif
+    return true;
+}
+
+/*
+ * cache_pop: takes a cached block for a request of size bytes from the
+ *            cache of this CPU, or of this thread. Returns NULL if there
+ *            is none, or no caches.
+ */
+static void *cache_pop (size_t size)
+{
+#ifdef MM_PERCPU
+    size_t asize = adjust_size (size);
+    int ind = (int) ((asize - cpu_cache_min_size) / dsize);
+    cpu_cache_t *cache;
+    void **bp;
+
+    if (size == 0 || default_heap == NULL || asize < cpu_cache_min_size ||
+        ind >= cpu_cache_count)
+    {
+        return NULL;
+    }
+    if (percpu_caches != NULL)
+    {
+        return rseq_pop (ind);
+    }
+    cache = thread_cache_get ();
+    bp = cache -> bins[ind];
+    if (bp != NULL)
+    {
+        cache -> bins[ind] = bp[0];
+    }
+    return bp;
+#else
+    (void) size;
+    return NULL;
+#endif
+}
+
+/*
+ * cache_push: puts the allocated block at bp in the cache of this CPU, or
+ *             of this thread, if it is of a cached size and the list for
+ *             its size is not full. Returns false if it didn't.
+ */
+static bool cache_push (void *bp)
+{
+#ifdef MM_PERCPU
+    size_t size = get_size(payload_to_header(bp));
+    int ind = (int) ((size - cpu_cache_min_size) / dsize);
+    cpu_cache_t *cache;
+    void **head;
+    size_t depth;
+
+    if (size < cpu_cache_min_size || ind >= cpu_cache_count)
+    {
+        return false;
+    }
+    if (percpu_caches != NULL)
     {
-        if (((block -> d).ptrArr[1]) != NULL)
-        {
-            startIndex[ind] = (block -> d).ptrArr[1];
-        }
-        else
-        {
-            startIndex[ind] = freeListPtr[ind];
-        }
+        return rseq_push (bp, ind);
     }
-    return;
+    cache = thread_cache_get ();
+    head = cache -> bins[ind];
+    depth = (head == NULL) ? 1 : (size_t) head[1] + 1;
+    if (depth > cpu_cache_depth)
+    {
+        return false;
+    }
+    ((void **) bp)[0] = head;
+    ((void **) bp)[1] = (void *) depth;
+    cache -> bins[ind] = bp;
+    return true;
+#else
+    (void) bp;
+    return false;
+#endif
 }
 
-
-
 /*
- * extend_heap: Extends the heap with the requested number of bytes, and
- *              recreates epilogue header. Returns a pointer to the result of
- *              coalescing the newly-created block with previous free block, if
- *              applicable, or NULL in failure.
+ * rseq_usable: true if this thread is registered for restartable
+ *              sequences, which the C library does for every thread.
  */
-static block_t *extend_heap(size_t size) 
+static bool rseq_usable (void)
 {
-    void *bp;
+#ifdef MM_RSEQ
+    return __rseq_size > 0;
+#else
+    return false;
+#endif
+}
 
-    // Allocate an even number of words to maintain alignment
-    size = align(size);
-    if ((bp = mem_sbrk(size)) == (void *)-1)
-    {
-        return NULL;
-    }
-    
-    // Initialize free block header/footer 
-    block_t *block = payload_to_header(bp);
-    write_header(block, size, false, get_alloc (last_block));
-    write_footer(block, size, false, get_alloc (last_block));
+#ifdef MM_RSEQ
+/*
+ * rseq_area: the struct rseq of this thread, which the kernel keeps the
+ *            current CPU in.
+ */
+static struct rseq *rseq_area (void)
+{
+    char *tp;
 
-    // Create new epilogue header
-    block_t *block_next = find_next(block);
-    write_header(block_next, 0, true, false);
+    __asm__ ("movq %%fs:0, %0" : "=r" (tp));
+    return (struct rseq *) (tp + __rseq_offset);
+}
+#endif
 
-    last_block = block;
-    // Coalesce in case the previous block was free
-    block_t *finalBlock = coalesce (block);
-    return finalBlock;
+/*
+ * rseq_pop: pops the first block from list ind of the cache of the CPU it
+ *           runs on, or returns NULL if the list is empty. The load of
+ *           the CPU number through the store of the new head is a
+ *           restartable sequence: if the thread is preempted, migrated or
+ *           signalled in between, the kernel sends it to the abort
+ *           handler, which starts over, so no lock or atomic is needed.
+ */
+static void *rseq_pop (int ind)
+{
+#ifdef MM_RSEQ
+    struct rseq *rs = rseq_area ();
+    void **bin = &percpu_caches[0].bins[ind];
+    void *head;
+
+    __asm__ __volatile__ (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"              // version, flags
+        ".quad 1f, (2f - 1f), 4f\n\t"     // start, length, abort
+        ".popsection\n\t"
+        "0:\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[rseq_cs]\n\t"
+        "1:\n\t"
+        "movl %[cpu_id], %%eax\n\t"
+        "cmpl %[ncpu], %%eax\n\t"
+        "jae 5f\n\t"
+        "shlq $6, %%rax\n\t"               // sizeof(cpu_cache_t)
+        "addq %[bin], %%rax\n\t"
+        "movq (%%rax), %[head]\n\t"
+        "testq %[head], %[head]\n\t"
+        "jz 2f\n\t"
+        "movq (%[head]), %%rdx\n\t"
+        "movq %%rdx, (%%rax)\n\t"          // commit
+        "2:\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "xorl %k[head], %k[head]\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"       // RSEQ_SIG, as an ud1
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp 0b\n\t"
+        ".popsection\n\t"
+        "6:\n\t"
+        : [head] "=&r" (head), [rseq_cs] "=m" (rs -> rseq_cs)
+        : [cpu_id] "m" (rs -> cpu_id), [ncpu] "r" (percpu_count),
+          [bin] "r" (bin)
+        : "rax", "rdx", "memory", "cc");
+    return head;
+#else
+    (void) ind;
+    return NULL;
+#endif
 }
 
-/* Coalesce: Coalesces current block with previous and next blocks if
- *           either or both are unallocated; otherwise the block is not
- *           modified. Then, insert coalesced block into the segregated list.
- *           Returns pointer to the coalesced block. After coalescing, the
- *           immediate contiguous previous and next blocks must be allocated. If 
- *           in any situation the blocks to be coalesced is the last block then 
- *           the pointer to the last block is changed accordingly
+/*
+ * rseq_push: pushes the block at bp on list ind of the cache of the CPU it
+ *            runs on, in a restartable sequence like rseq_pop's. The link
+ *            and length are written into the block first; only the store
+ *            of the new head commits. Returns false if the list is full.
  */
-static block_t *coalesce(block_t * block) 
+static bool rseq_push (void *bp, int ind)
 {
-    block_t *block_prev;
-    block_t *block_next = find_next(block);
-    bool prev_alloc = get_prev_alloc (block);
-    bool next_alloc = get_alloc(block_next);
-    size_t size = get_size(block);
+#ifdef MM_RSEQ
+    struct rseq *rs = rseq_area ();
+    void **bin = &percpu_caches[0].bins[ind];
+    int done;
+
+    __asm__ __volatile__ (
+        ".pushsection __rseq_cs, \"aw\"\n\t"
+        ".balign 32\n\t"
+        "3:\n\t"
+        ".long 0x0, 0x0\n\t"
+        ".quad 1f, (2f - 1f), 4f\n\t"
+        ".popsection\n\t"
+        "0:\n\t"
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[rseq_cs]\n\t"
+        "1:\n\t"
+        "movl %[cpu_id], %%eax\n\t"
+        "cmpl %[ncpu], %%eax\n\t"
+        "jae 5f\n\t"
+        "shlq $6, %%rax\n\t"
+        "addq %[bin], %%rax\n\t"
+        "movq (%%rax), %%rdx\n\t"          // head
+        "movl $1, %%ecx\n\t"               // length with bp on it
+        "testq %%rdx, %%rdx\n\t"
+        "jz 7f\n\t"
+        "movq 8(%%rdx), %%rcx\n\t"
+        "addq $1, %%rcx\n\t"
+        "cmpq %[depth], %%rcx\n\t"
+        "ja 5f\n\t"
+        "7:\n\t"
+        "movq %%rdx, (%[bp])\n\t"
+        "movq %%rcx, 8(%[bp])\n\t"
+        "movq %[bp], (%%rax)\n\t"          // commit
+        "2:\n\t"
+        "movl $1, %[done]\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "movl $0, %[done]\n\t"
+        ".pushsection __rseq_failure, \"ax\"\n\t"
+        ".byte 0x0f, 0xb9, 0x3d\n\t"
+        ".long 0x53053053\n\t"
+        "4:\n\t"
+        "jmp 0b\n\t"
+        ".popsection\n\t"
+        "6:\n\t"
+        : [done] "=r" (done), [rseq_cs] "=m" (rs -> rseq_cs)
+        : [cpu_id] "m" (rs -> cpu_id), [ncpu] "r" (percpu_count),
+          [bin] "r" (bin), [bp] "r" (bp), [depth] "r" (cpu_cache_depth)
+        : "rax", "rcx", "rdx", "memory", "cc");
+    return done != 0;
+#else
+    (void) bp;
+    (void) ind;
+    return false;
+#endif
+}
 
-    if (prev_alloc && next_alloc)              // Case 1
+/*
+ * thread_cache_get: the caches of this thread, emptied first if they hold
+ *                   blocks of an earlier default heap. The first time a
+ *                   thread uses them, they are registered to be flushed
+ *                   back to the heap when it exits.
+ */
+static cpu_cache_t *thread_cache_get (void)
+{
+#ifdef MM_PERCPU
+    if (thread_cache_epoch != cache_epoch)
     {
-        return block;
+        memset(&thread_cache, 0, sizeof(thread_cache));
+        thread_cache_epoch = cache_epoch;
+        pthread_once(&thread_cache_once, thread_cache_make_key);
+        pthread_setspecific(thread_cache_key, &thread_cache);
     }
+    return &thread_cache;
+#else
+    return NULL;
+#endif
+}
 
-    else if (prev_alloc && !next_alloc)        // Case 2
-    {
-        size += get_size(block_next);
-        if (block_next == last_block)
-        {
-            last_block = block;
-        }
-        remove_block (block_next);
-        write_header(block, size, false, true);
-        write_footer(block, size, false, true);
-    }
+/*
+ * thread_cache_make_key: makes the key whose destructor flushes the
+ *                        caches of an exiting thread.
+ */
+static void thread_cache_make_key (void)
+{
+#ifdef MM_PERCPU
+    pthread_key_create(&thread_cache_key, thread_cache_flush);
+#endif
+}
 
-    else if (!prev_alloc && next_alloc)        // Case 3
-    {
-        block_prev = find_prev (block);
-        size += get_size(block_prev);
-        if (block == last_block)
-        {
-            last_block = block_prev;
-        }
-        remove_block (block_prev);
-        write_header(block_prev, size, false, get_prev_alloc (block_prev));
-        write_footer(block_prev, size, false, get_prev_alloc (block_prev));
-        block = block_prev;
-    }
+/*
+ * thread_cache_flush: frees the blocks in the caches of an exiting
+ *                     thread to the default heap, unless they belong to
+ *                     an earlier one.
+ */
+static void thread_cache_flush (void *arg)
+{
+#ifdef MM_PERCPU
+    cpu_cache_t *cache = arg;
 
-    else                                        // Case 4
+    lock_default ();
+    if (thread_cache_epoch == cache_epoch)
     {
-        block_prev = find_prev (block);
-        size += get_size(block_next) + get_size(block_prev);
-        if (block_next == last_block)
+        for (int i = 0; i < cpu_cache_count; i ++)
         {
-            last_block = block_prev;
+            void **bp = cache -> bins[i];
+            while (bp != NULL)
+            {
+                void **next = bp[0];
+                mm_heap_free(default_heap, bp);
+                bp = next;
+            }
+            cache -> bins[i] = NULL;
         }
-        remove_block (block_next);
-        remove_block (block_prev);
-        write_header(block_prev, size, false, get_prev_alloc (block_prev));
-        write_footer(block_prev, size, false, get_prev_alloc (block_prev));
-        block = block_prev;
     }
-    return block;
+    unlock_default ();
+#else
+    (void) arg;
+#endif
 }
 
 /*
- * place: Places block with size of asize at the start of bp. If the remaining
- *        size is at least the minimum block size, then split the block to the
- *        the allocated block and the remaining block as free, which is then
- *        inserted into the segregated list. Requires that the block is
- *        initially unallocated.
+ * lock_default: in a build with MM_THREADSAFE defined, takes the lock of
+ *               the default heap. Otherwise it does nothing.
  */
-static void 
-place(block_t *block, size_t asize)
+static void lock_default (void)
 {
-    size_t csize = get_size(block);
-
-    if ((csize - asize) >= min_block_size)
-    {
-	    block_t *block_next;
-        write_header(block, asize, true, get_prev_alloc (block));
-
-        block_next = find_next(block);
-        write_header(block_next, csize-asize, false, true);
-        write_footer(block_next, csize-asize, false, true);
-        change_alloc_next_block (block_next, false);
-        if (block == last_block)
-        {
-            last_block = block_next;
-        }
-        insert_free_block (block_next);
-    }
-    else
-    { 
-        write_header(block, csize, true, get_prev_alloc (block));
-    }
+#ifdef MM_THREADSAFE
+    pthread_mutex_lock(&default_lock);
+#endif
 }
 
 /*
- * change_alloc_next_block: This function changes the second last bit of the 
- *                          next block based on the allocation status of the 
- *                          current block passed in as a parameter.
+ * unlock_default: releases the lock taken by lock_default.
  */
-static void change_alloc_next_block (block_t *block, bool alloc)
+static void unlock_default (void)
 {
-    block_t *nextBlock = find_next (block);
-    nextBlock -> header = (alloc) ? ((nextBlock -> header) | (0x2)) : 
-                        ((nextBlock -> header) & (0xFFFFFFFFFFFFFFFD));
+#ifdef MM_THREADSAFE
+    pthread_mutex_unlock(&default_lock);
+#endif
 }
 
 /* rounds up to the nearest multiple of ALIGNMENT */
@@ -716,20 +3435,50 @@ static size_t align(size_t x) {
 
 /*
  * find_fit: Looks for a free block with at least asize bytes with
- *           first-fit policy. Returns NULL if none is found.
+ *           first-fit policy, after bringing stale directories up to
+ *           date. Returns NULL if none is found.
+ */
+static block_t *find_fit(mm_heap_t *heap, size_t asize)
+{
+    if (heap -> dir_stale != 0)
+    {
+        grow_directories (heap);
+    }
+    return search_fit (heap, asize);
+}
+
+/*
+ * search_fit: the search of find_fit. In the list for asize, the sizes in
+ *             the directory are scanned, if it is up to date; a block on
+ *             any later list fits, so the next one in next-fit order is
+ *             taken.
  */
-static block_t *find_fit(size_t asize)
+static block_t *search_fit (mm_heap_t *heap, size_t asize)
 {
     block_t *iter;
     int ind = find_free_list (asize);
-    for (int i = ind; i < 11; i ++)
+
+    if (dir_usable (heap, ind))
+    {
+        free_dir_t *dir = heap -> freeDirs[ind];
+        uint32_t slot = dir_search (dir, (uint32_t) (asize / dsize));
+        if (slot < dir -> count)
+        {
+            iter = link_block (heap, dir -> entries[dir -> cap + slot]);
+            heap -> startIndex[ind] = get_next_free (heap, iter);
+            return iter;
+        }
+        ind ++;
+    }
+    for (int i = ind; i < seg_list_count; i ++)
     {
-        for (iter = (startIndex[i] != NULL) ? (startIndex[i]) : freeListPtr[i]; 
-                    (iter != NULL); iter = (iter -> d).ptrArr[1])
+        for (iter = (heap -> startIndex[i] != NULL) ? (heap -> startIndex[i]) : heap -> freeListPtr[i]; 
+                    (iter != NULL); iter = get_next_free (heap, iter))
         {
+            prefetch_block (get_next_free (heap, iter));
             if (asize <= get_size(iter))
             {
-                startIndex[i] = (iter -> d).ptrArr[1];
+                heap -> startIndex[i] = get_next_free (heap, iter);
                 return iter;
             }
         }
@@ -835,7 +3584,8 @@ static bool get_prev_alloc(block_t *block)
  */
 static void write_header(block_t *block, size_t size, bool alloc, bool prev_alloc)
 {
-    block->header = pack(size, alloc, prev_alloc);
+    // The mini bit belongs to the previous block, which write_footer keeps
+    block->header = pack(size, alloc, prev_alloc) | (block->header & 0x4);
 }
 
 
@@ -846,6 +3596,15 @@ static void write_header(block_t *block, size_t size, bool alloc, bool prev_allo
  */
 static void write_footer(block_t *block, size_t size, bool alloc, bool prev_alloc)
 {
+    block_t *block_next = (block_t *)(((char *)(block) + get_size(block)));
+
+    // A mini block has no room for a footer; the next header says it's mini
+    if (size == dsize)
+    {
+        block_next -> header |= 0x4;
+        return;
+    }
+    block_next -> header &= ~(word_t) 0x4;
     word_t *footerp = (word_t *)(((char *)(block) + get_size(block)) - wsize);
     *footerp = pack(size, alloc, prev_alloc);
 }
@@ -876,6 +3635,10 @@ static word_t *find_prev_footer(block_t *block)
  */
 static block_t *find_prev(block_t *block)
 {
+    if ((block -> header) & 0x4)
+    {
+        return (block_t *)((char *)block - dsize);
+    }
     word_t *footerp = find_prev_footer(block);
     size_t size = extract_size(*footerp);
     return (block_t *)((char *)block - size);
@@ -903,8 +3666,21 @@ static void *header_to_payload(block_t *block)
  * Return whether the pointer is in the heap.
  * May be useful for debugging.
  */
-static bool in_heap(const void *p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+static bool in_heap(mm_heap_t *heap, const void *p) {
+    heap_segment_t *seg;
+
+    if (p <= mem_region_hi(heap -> region) && p >= mem_region_lo(heap -> region))
+    {
+        return true;
+    }
+    for (seg = heap -> segments; seg != NULL; seg = seg -> next)
+    {
+        if ((const char *) p >= (char *) seg && (const char *) p < (char *) seg + seg -> size)
+        {
+            return true;
+        }
+    }
+    return false;
 }
 
 /*
@@ -917,39 +3693,102 @@ static bool aligned(const void *p) {
 }
 
 /* This algorithm detects cycles in a linked list */
-static bool is_acyclic (block_t *block)
+static bool is_acyclic (mm_heap_t *heap, block_t *block)
 {
     if (block == NULL)
     {
         return true;
     }
     block_t *tort = block; // tortoise
-    block_t *hare = (block -> d).ptrArr[1]; // hare
+    block_t *hare = get_next_free (heap, block); // hare
     while (hare != tort) 
     {
-        if (hare == NULL || (hare -> d).ptrArr[1] == NULL)
+        if (hare == NULL || get_next_free (heap, hare) == NULL)
         {
             return true;
         } 
-        tort = (tort -> d).ptrArr[1]; // tortoise moves by 1 step
-        hare = (((hare -> d).ptrArr[1]) -> d).ptrArr[1]; // hare moves by 2 steps
+        tort = get_next_free (heap, tort); // tortoise moves by 1 step
+        hare = get_next_free (heap, get_next_free (heap, hare)); // hare moves by 2 steps
     }
     return false;
 }
 
-/* mm_checkheap: checks the heap for correctness; returns true if
- *               the heap is correct, and false otherwise.
- *               can call this function using mm_checkheap(__LINE__);
- *               to identify the line number of the call site.
+/* check_blocks: checks each block from block up to the epilogue header:
+ *               its alignment, size and header bits, and the footer of a
+ *               free one. Returns the number of free blocks, or -1 if a
+ *               block is wrong.
+ */
+static int check_blocks (block_t *block, int lineno)
+{
+    int freeBlocks = 0;
+
+    for (; get_size(block) > 0; block = find_next(block))
+    {
+        if (!(aligned ((block -> d).payload)))
+        {
+            dbg_printf ("Block not aligned. Error on line number %d.\n", lineno);
+            return -1;
+        }
+        if (get_size (block) < min_block_size)
+        {
+            dbg_printf ("Block size not correct. Error on line number %d.\n", lineno);
+            return -1;
+        }
+        if (get_prev_alloc (find_next (block)) != get_alloc (block))
+        {
+            dbg_printf ("Next block does not hold alloc status of prev block. Error on line number %d.\n", lineno);
+            return -1;
+        }
+        if (! get_alloc (block))
+        {
+            if (!get_alloc (find_next (block)))
+            {
+                dbg_printf ("2 contiguous free blocks. Error on line number %d.\n", block, lineno);
+                return -1;
+            }
+            if ((block -> header) & 0x8)
+            {
+                dbg_printf ("Free block marked grown. Error on line number %d.\n", lineno);
+                return -1;
+            }
+            if (get_size (block) == dsize)
+            {
+                if (!((find_next (block) -> header) & 0x4))
+                {
+                    dbg_printf ("Mini block not marked in next header. Error on line number %d.\n", lineno);
+                    return -1;
+                }
+            }
+            else if (extract_size (block -> header) != extract_size (*(word_t *)(((char *)(block) + get_size(block)) - wsize)))
+            {
+                dbg_printf ("Block Header and footer do not agree. Error on line number %d.\n", lineno);
+                return -1;
+            }
+            else if ((find_next (block) -> header) & 0x4)
+            {
+                dbg_printf ("Block wrongly marked as mini in next header. Error on line number %d.\n", lineno);
+                return -1;
+            }
+            freeBlocks ++;
+        }
+    }
+    return freeBlocks;
+}
+
+/* mm_heap_checkheap: checks the heap for correctness; returns true if
+ *                    the heap is correct, and false otherwise.
+ *                    can call this function using mm_checkheap(__LINE__);
+ *                    to identify the line number of the call site.
  */
-bool mm_checkheap(int lineno)  
+bool mm_heap_checkheap(mm_heap_t *heap, int lineno)  
 { 
     block_t *block;
     block_t *prevBlock;
     int freeBlocks = 0;
     int freeBlocksList = 0;
-    block_t *footer = (block_t *)((char *)heap_listp - wsize);
-    block_t *header = (block_t *)((char *)(mem_heap_hi ()) - (wsize - 1));
+    heap_segment_t *seg;
+    block_t *footer = (block_t *)((char *)heap -> heap_listp - wsize);
+    block_t *header = (block_t *)((char *)(mem_region_hi(heap -> region)) - (wsize - 1));
 
     /* Checking epilogue and prologue blocks*/
     if (get_size (footer) != 0 || ! (get_alloc (footer)))
@@ -964,70 +3803,62 @@ bool mm_checkheap(int lineno)
                     lineno);
         return false;
     }
-    if (last_block != header && last_block != footer)
+    if (heap -> last_block != header && heap -> last_block != footer)
     {
-        if (find_next (last_block) != header)
+        if (find_next (heap -> last_block) != header)
         {
             dbg_printf ("Pointer to last block is not correct. Error on line number %d.\n", lineno);
             return false;
         }
     }
     
-    /* Checking each block address alignment */
-    for (block = heap_listp; get_size(block) > 0;
-                             block = find_next(block))
+    /* Checking the blocks below the break, then those of each segment */
+    if ((freeBlocks = check_blocks (heap -> heap_listp, lineno)) < 0)
     {
-        if (!(aligned ((block -> d).payload)))
-        {
-            dbg_printf ("Block not aligned. Error on line number %d.\n", lineno);
-            return false;
-        }
-        if (get_size (block) < min_block_size)
+        return false;
+    }
+    for (seg = heap -> segments; seg != NULL; seg = seg -> next)
+    {
+        block_t *segFooter = (block_t *) (seg + 1);
+        block_t *segHeader = (block_t *) ((char *) seg + seg -> size - wsize);
+        int segFree;
+
+        if (!mem_region_contains(heap -> region, seg, seg -> size) ||
+            get_size (segFooter) != 0 || !get_alloc (segFooter) ||
+            get_size (segHeader) != 0 || !get_alloc (segHeader))
         {
-            dbg_printf ("Block size not correct. Error on line number %d.\n", lineno);
+            dbg_printf ("Bad segment sentinels. Error on line number %d.\n", lineno);
             return false;
         }
-        if (get_prev_alloc (find_next (block)) != get_alloc (block))
+        if ((segFree = check_blocks ((block_t *) ((char *) segFooter + wsize), lineno)) < 0)
         {
-            dbg_printf ("Next block does not hold alloc status of prev block. Error on line number %d.\n", lineno);
             return false;
         }
-        if (! get_alloc (block))
-        {
-            if ((!get_alloc (find_next (block))) && ((find_next (block) != header)))
-            {
-                dbg_printf ("2 contiguous free blocks. Error on line number %d.\n", block, lineno);
-                return false;
-            }
-            if (extract_size (block -> header) != extract_size (*(word_t *)(((char *)(block) + get_size(block)) - wsize)))
-            {
-                dbg_printf ("Block Header and footer do not agree. Error on line number %d.\n", lineno);
-                return false;
-            }
-            freeBlocks ++;
-        }
+        freeBlocks += segFree;
     }
     /* Checking explicit free list */
-    for (int i = 0; i < 11; i ++)
+    for (int i = 0; i < seg_list_count; i ++)
     {
-        if (! is_acyclic (freeListPtr[i]))
+        int listStart = freeBlocksList;
+
+        if (! is_acyclic (heap, heap -> freeListPtr[i]))
         {
             dbg_printf ("Cycles present in linked list. Error on line number %d.\n", lineno);
             return false;
         }
-        for (block = freeListPtr[i]; (block != NULL); 
-                                block = (block -> d).ptrArr[1])
+        for (block = heap -> freeListPtr[i]; (block != NULL); 
+                                block = get_next_free (heap, block))
         {
-            if ((block -> d).ptrArr[1] != NULL)
+            if (get_next_free (heap, block) != NULL)
             {
-                prevBlock = (((block -> d).ptrArr[1]) -> d).ptrArr[0];
+                prevBlock = get_prev_free (heap, get_next_free (heap, block));
                 if (prevBlock != block)
                 {
                     dbg_printf ("Free block ptrs not consistent. Error on line number %d.\n", lineno);
                     return false;
                 }
             }
-            if (! (in_heap (block)))
+            if (! (in_heap (heap, block)))
             {
                 dbg_printf ("Free ptrs not between heap hi and lo. Error on line number %d.\n", lineno);
                 return false;
@@ -1038,30 +3869,66 @@ bool mm_checkheap(int lineno)
                 return false;
 
             }
-            if ((i == 0) && (get_size (block) > pow (2, i + 6)))
-            {
-                dbg_printf ("Free blocks not within segregated list size. Error on line number %d.\n", i, block, lineno);
-                return false;
-            }
-            else if ((i != 0 && i != 10) && (get_size (block) > pow (2, i + 6) 
-                    || get_size (block) <= pow (2, i + 5)))
+            if (find_free_list (get_size (block)) != i)
             {
-                dbg_printf ("Free blocks not within segregated list size. Error on line number %d.\n", i, lineno);
+                dbg_printf ("Free blocks not within segregated list size. Error on line number %d.\n", lineno);
                 return false;
             }
-            else if ((i == 10) && (get_size (block) <= pow (2, i + 5)))
+            if (dir_usable (heap, i))
             {
-                dbg_printf ("Free blocks not within segregated list size. Error on line number %d.\n", i, lineno);
-                return false;
+                free_dir_t *dir = heap -> freeDirs[i];
+                uint32_t slot = (block -> d).links[2];
+                if (slot >= dir -> count || dir -> entries[slot] != get_size (block) / dsize ||
+                    dir -> entries[dir -> cap + slot] != block_link (heap, block))
+                {
+                    dbg_printf ("Free block not in its directory slot. Error on line number %d.\n", lineno);
+                    return false;
+                }
             }
             freeBlocksList ++;
         }
+        if (heap -> freeCounts[i] != (size_t) (freeBlocksList - listStart) ||
+            (dir_usable (heap, i) && heap -> freeDirs[i] -> count != heap -> freeCounts[i]))
+        {
+            dbg_printf ("List length or directory count is wrong. Error on line number %d.\n", lineno);
+            return false;
+        }
     }
     if (freeBlocksList != freeBlocks)
     {
         dbg_printf ("Number of free blocks not equal. Error on line number %d.\n", lineno);
         return false;
     }
+    /* Checking fast bins: blocks of the bin's size, still marked allocated */
+    size_t fastBytes = 0;
+    for (int i = 0; i < fastbin_count; i ++)
+    {
+        for (block = heap -> fastBins[i]; block != NULL; block = (block -> d).ptrArr[0])
+        {
+            if (!in_heap (heap, block) || !get_alloc (block) ||
+                get_size (block) != min_block_size + i * dsize)
+            {
+                dbg_printf ("Bad block in fast bin %d. Error on line number %d.\n", i, lineno);
+                return false;
+            }
+            fastBytes += get_size (block);
+        }
+    }
+    if (fastBytes != heap -> fastbin_bytes)
+    {
+        dbg_printf ("Fast bin byte count is wrong. Error on line number %d.\n", lineno);
+        return false;
+    }
+    /* Checking remote frees: blocks of this heap, still marked allocated */
+    for (block = __atomic_load_n(&heap -> remote_free, __ATOMIC_ACQUIRE);
+         block != NULL; block = (block -> d).ptrArr[0])
+    {
+        if (!in_heap (heap, block) || !get_alloc (block))
+        {
+            dbg_printf ("Bad block in remote free queue. Error on line number %d.\n", lineno);
+            return false;
+        }
+    }
     return true;
 }
 
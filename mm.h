@@ -8,6 +8,9 @@ extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
 extern void *mm_calloc (size_t nmemb, size_t size);
+extern void *mm_memalign (size_t alignment, size_t size);
+extern void *mm_aligned_alloc (size_t alignment, size_t size);
+extern int mm_posix_memalign (void **memptr, size_t alignment, size_t size);
 
 #else
 
@@ -16,10 +19,76 @@ extern void *malloc (size_t size);
 extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
+extern void *memalign (size_t alignment, size_t size);
+extern void *aligned_alloc (size_t alignment, size_t size);
+extern int posix_memalign (void **memptr, size_t alignment, size_t size);
 
 #endif
 
 extern bool mm_init(void);
 
+/* Allocate n blocks of size bytes into out; returns n, or 0 on failure */
+extern size_t mm_malloc_batch(size_t size, size_t n, void **out);
+
+/* Free the n blocks in ptrs; ptrs itself is left as it was */
+extern void mm_free_batch(void **ptrs, size_t n);
+
+/* Free ptr, last (re)allocated with size bytes, or of usable size bytes */
+extern void mm_free_sized(void *ptr, size_t size);
+
+/* Bytes usable at ptr; at least the size it was allocated with */
+extern size_t mm_usable_size(void *ptr);
+
+/* malloc that also returns the usable size of the block in *usable */
+extern void *mm_malloc_usable(size_t size, size_t *usable);
+
+/* Bump-pointer arenas whose blocks are all released at once */
+typedef struct mm_arena mm_arena_t;
+extern mm_arena_t *mm_arena_create(size_t chunk_size);
+extern void *mm_arena_alloc(mm_arena_t *arena, size_t size);
+extern void mm_arena_reset(mm_arena_t *arena);
+extern void mm_arena_destroy(mm_arena_t *arena);
+
+/* Caches of headerless objects of one size, carved from slabs */
+typedef struct mm_cache mm_cache_t;
+extern mm_cache_t *mm_cache_create(size_t objsize, size_t align);
+extern void *mm_cache_alloc(mm_cache_t *cache);
+extern void mm_cache_free(mm_cache_t *cache, void *obj);
+extern size_t mm_cache_reap(mm_cache_t *cache);
+extern void mm_cache_destroy(mm_cache_t *cache);
+
+/* Cache small blocks per CPU (true) or per thread in MM_PERCPU builds;
+   returns true if per-CPU caches will be used from the next mm_init */
+extern bool mm_set_cpu_caches(bool percpu);
+
+/* Run a thread that does the deferred work of the default heap, using at
+   most cpu_share of a CPU, in MM_THREADSAFE builds; false if not started */
+extern bool mm_maint_start(double cpu_share);
+extern void mm_maint_stop(void);
+
 /* This is for debugging.  Returns false if error encountered */
 extern bool mm_checkheap(int lineno);
+
+/*
+ * Heaps of their own, each in a region from memlib.  The functions above
+ * work on the default heap, made by mm_init in the default region; these
+ * take the heap to work on, and a block must be freed to the heap it
+ * came from.
+ */
+typedef struct mm_heap mm_heap_t;
+struct mem_region;
+extern mm_heap_t *mm_heap_create(struct mem_region *region);
+extern void *mm_heap_malloc(mm_heap_t *heap, size_t size);
+extern void mm_heap_free(mm_heap_t *heap, void *ptr);
+extern void mm_heap_free_sized(mm_heap_t *heap, void *ptr, size_t size);
+
+/* Free ptr to heap from a thread other than the one using heap */
+extern void mm_heap_free_remote(mm_heap_t *heap, void *ptr);
+extern void *mm_heap_realloc(mm_heap_t *heap, void *ptr, size_t size);
+extern void *mm_heap_calloc(mm_heap_t *heap, size_t nmemb, size_t size);
+extern void *mm_heap_memalign(mm_heap_t *heap, size_t alignment, size_t size);
+extern size_t mm_heap_malloc_batch(mm_heap_t *heap, size_t size, size_t n, void **out);
+extern void mm_heap_free_batch(mm_heap_t *heap, void **ptrs, size_t n);
+extern mm_arena_t *mm_heap_arena_create(mm_heap_t *heap, size_t chunk_size);
+extern mm_cache_t *mm_heap_cache_create(mm_heap_t *heap, size_t objsize, size_t align);
+extern bool mm_heap_checkheap(mm_heap_t *heap, int lineno);
@@ -0,0 +1,258 @@
+/*
+ * oracle.c - Offline bounds on the heap size a trace requires
+ *
+ * oracle_peak is the classic lower bound used by mdriver's utilization
+ * metric.  It is not achievable in general, because live blocks cannot
+ * be moved to squeeze out the holes left by dead ones.  The other two
+ * routines compute heap sizes that a real (if idealized) allocator
+ * actually reaches, so the distance between them and mm.c is headroom
+ * that better placement could recover.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include "oracle.h"
+
+/* An allocation or free of block idx at op time */
+typedef struct {
+    long time;
+    int kind;     /* 0 = free, 1 = alloc, so frees sort first */
+    size_t idx;
+} event_t;
+
+/* A hole in the heap, as a range of offsets */
+typedef struct {
+    size_t off;
+    size_t size;
+} extent_t;
+
+/* qsort has no context argument, so comparators look here */
+static const lifetime_t *cmp_lt = NULL;
+
+static void *xmalloc(size_t bytes);
+static event_t *make_events(const lifetime_t *lt, size_t n);
+static int cmp_event(const void *a, const void *b);
+static int cmp_size_desc(const void *a, const void *b);
+
+/*
+ * oracle_peak - maximum over time of the total size of live blocks
+ */
+size_t oracle_peak(const lifetime_t *lt, size_t n)
+{
+    event_t *ev = make_events(lt, n);
+    size_t live = 0, peak = 0;
+    size_t i;
+
+    for (i = 0; i < 2*n; i++) {
+        if (ev[i].kind)
+            live += lt[ev[i].idx].size;
+        else
+            live -= lt[ev[i].idx].size;
+        if (live > peak)
+            peak = live;
+    }
+    free(ev);
+    return peak;
+}
+
+/*
+ * oracle_bestfit - replay the lifetimes in time order against an
+ *     address-ordered array of holes.  Each block goes into the smallest
+ *     hole that fits; if none does, it goes at the end of the heap,
+ *     reusing a hole that touches the end so that only the shortfall is
+ *     added.  Freed blocks merge with adjacent holes.
+ */
+size_t oracle_bestfit(const lifetime_t *lt, size_t n)
+{
+    event_t *ev = make_events(lt, n);
+    size_t *offs = xmalloc((n ? n : 1) * sizeof(size_t));
+    extent_t *holes = xmalloc((n+1) * sizeof(extent_t));
+    size_t nholes = 0;
+    size_t top = 0;
+    size_t i, h;
+
+    for (i = 0; i < 2*n; i++) {
+        size_t idx = ev[i].idx;
+        size_t size = lt[idx].size;
+
+        if (ev[i].kind) {
+            size_t best = nholes;
+            for (h = 0; h < nholes; h++) {
+                if (holes[h].size >= size &&
+                    (best == nholes || holes[h].size < holes[best].size))
+                    best = h;
+            }
+            if (best < nholes) {
+                offs[idx] = holes[best].off;
+                holes[best].off += size;
+                holes[best].size -= size;
+            } else if (nholes > 0 &&
+                       holes[nholes-1].off + holes[nholes-1].size == top) {
+                best = nholes - 1;
+                offs[idx] = holes[best].off;
+                top = holes[best].off + size;
+                holes[best].size = 0;
+            } else {
+                offs[idx] = top;
+                top += size;
+            }
+            if (best < nholes && holes[best].size == 0) {
+                for (h = best; h+1 < nholes; h++)
+                    holes[h] = holes[h+1];
+                nholes--;
+            }
+        } else {
+            size_t off = offs[idx];
+            size_t lo = 0, hi = nholes;
+
+            /* Find the first hole above the block */
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (holes[mid].off < off)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            bool join_prev = lo > 0 &&
+                holes[lo-1].off + holes[lo-1].size == off;
+            bool join_next = lo < nholes && off + size == holes[lo].off;
+
+            if (join_prev && join_next) {
+                holes[lo-1].size += size + holes[lo].size;
+                for (h = lo; h+1 < nholes; h++)
+                    holes[h] = holes[h+1];
+                nholes--;
+            } else if (join_prev) {
+                holes[lo-1].size += size;
+            } else if (join_next) {
+                holes[lo].off = off;
+                holes[lo].size += size;
+            } else {
+                for (h = nholes; h > lo; h--)
+                    holes[h] = holes[h-1];
+                holes[lo].off = off;
+                holes[lo].size = size;
+                nholes++;
+            }
+        }
+    }
+    free(ev);
+    free(offs);
+    free(holes);
+    return top;
+}
+
+/*
+ * oracle_offline - greedy-by-size placement.  Blocks are visited from
+ *     largest to smallest (longest lived first on ties).  Placed blocks
+ *     are kept sorted by offset, and each new block goes into the lowest
+ *     gap that no placed block with an overlapping lifetime occupies.
+ */
+size_t oracle_offline(const lifetime_t *lt, size_t n, size_t max_work)
+{
+    size_t *order = xmalloc((n ? n : 1) * sizeof(size_t));
+    size_t *placed = xmalloc((n ? n : 1) * sizeof(size_t));
+    size_t *offs = xmalloc((n ? n : 1) * sizeof(size_t));
+    size_t nplaced = 0;
+    size_t heap = 0, work = 0;
+    size_t i, j;
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+    cmp_lt = lt;
+    qsort(order, n, sizeof(size_t), cmp_size_desc);
+
+    for (i = 0; i < n && work <= max_work; i++) {
+        size_t b = order[i];
+        size_t size = lt[b].size;
+        size_t off = 0;
+
+        /* Nothing at or past off + size can collide, so stop there */
+        for (j = 0; j < nplaced; j++) {
+            size_t p = placed[j];
+            if (offs[p] >= off + size)
+                break;
+            if (lt[p].start < lt[b].end && lt[p].end > lt[b].start &&
+                offs[p] + lt[p].size > off)
+                off = offs[p] + lt[p].size;
+        }
+        work += j;
+
+        /* Insert after every placed block at or below off */
+        size_t lo = 0, hi = nplaced;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (offs[placed[mid]] <= off)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (j = nplaced; j > lo; j--)
+            placed[j] = placed[j-1];
+        placed[lo] = b;
+        nplaced++;
+        offs[b] = off;
+        if (off + size > heap)
+            heap = off + size;
+    }
+    if (work > max_work)
+        heap = 0;
+
+    free(order);
+    free(placed);
+    free(offs);
+    return heap;
+}
+
+/*************** Private Functions *******************/
+
+static void *xmalloc(size_t bytes)
+{
+    void *p = malloc(bytes);
+    if (!p) {
+        fprintf(stderr, "ERROR.  Couldn't allocate oracle state\n");
+        exit(1);
+    }
+    return p;
+}
+
+/* Build the list of alloc and free events, sorted by time */
+static event_t *make_events(const lifetime_t *lt, size_t n)
+{
+    event_t *ev = xmalloc((n ? 2*n : 1) * sizeof(event_t));
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        ev[2*i].time = lt[i].start;
+        ev[2*i].kind = 1;
+        ev[2*i].idx = i;
+        ev[2*i+1].time = lt[i].end;
+        ev[2*i+1].kind = 0;
+        ev[2*i+1].idx = i;
+    }
+    qsort(ev, 2*n, sizeof(event_t), cmp_event);
+    return ev;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+    const event_t *x = a, *y = b;
+    if (x->time != y->time)
+        return (x->time < y->time) ? -1 : 1;
+    if (x->kind != y->kind)
+        return x->kind - y->kind;
+    return (x->idx < y->idx) ? -1 : (x->idx > y->idx);
+}
+
+static int cmp_size_desc(const void *a, const void *b)
+{
+    const lifetime_t *x = &cmp_lt[*(const size_t *) a];
+    const lifetime_t *y = &cmp_lt[*(const size_t *) b];
+    if (x->size != y->size)
+        return (x->size > y->size) ? -1 : 1;
+    long xl = x->end - x->start, yl = y->end - y->start;
+    if (xl != yl)
+        return (xl > yl) ? -1 : 1;
+    return (x->start < y->start) ? -1 : (x->start > y->start);
+}
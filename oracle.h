@@ -0,0 +1,35 @@
+/*
+ * oracle.h - Offline bounds on the heap size a trace requires
+ *
+ * Each allocated block is described by its lifetime: the block is live
+ * over the trace operations [start, end) and occupies size bytes.  The
+ * routines below compute how large a heap an allocator would need to
+ * hold every block, given different amounts of knowledge about the
+ * trace.  Sizes are taken as given; callers round them to the payload
+ * alignment beforehand.
+ */
+
+#include <stddef.h>
+
+typedef struct {
+    long start;   /* first op at which the block is live */
+    long end;     /* first op at which the block is dead */
+    size_t size;  /* bytes occupied by the block */
+} lifetime_t;
+
+/* Peak number of simultaneously live bytes.  No allocator can do better */
+size_t oracle_peak(const lifetime_t *lt, size_t n);
+
+/*
+ * Heap size reached by an ideal online allocator: no headers, exact
+ * best-fit, immediate coalescing, and only growing by the shortfall
+ */
+size_t oracle_bestfit(const lifetime_t *lt, size_t n);
+
+/*
+ * Heap size reached by offline placement with full knowledge of the
+ * future: blocks are placed largest first at the lowest offset that does
+ * not collide with any already placed block whose lifetime overlaps.
+ * Returns 0 if the placement gave up after max_work overlap checks.
+ */
+size_t oracle_offline(const lifetime_t *lt, size_t n, size_t max_work);
@@ -0,0 +1,169 @@
+#!/usr/bin/perl
+use Getopt::Std;
+
+##############################################################################
+#
+# This program compiles a trace file into C source code that replays the
+# trace as straight-line calls to mm_malloc, mm_realloc, mm_memalign and
+# mm_free, to mm_malloc_batch and mm_free_batch for the batch requests,
+# to the mm_arena_* functions for the arena requests, and to the
+# mm_cache_* functions for the object cache requests.
+# Linked with replay.c and mm.c, it measures the cost of the allocator
+# alone, without mdriver's per-op dispatch on the trace arrays.
+#
+##############################################################################
+
+sub usage 
+{
+    printf STDERR "$_[0]\n";
+    printf STDERR "Usage: $0 [-h] [-n OPS] -f INFILE [-o OUTFILE]\n";
+    printf STDERR "Options:\n";
+    printf STDERR "  -h               Print this message\n";
+    printf STDERR "  -n OPS           Operations per generated function (default 4096)\n";
+    printf STDERR "  -f INFILE        Trace file to compile\n";
+    printf STDERR "  -o OUTFILE       Write C code to OUTFILE (default stdout)\n";
+    die "\n" ;
+}
+
+# Number of header values at the start of a trace file
+$hdrlines = 4;
+
+# Very large functions take the compiler a long time to optimize
+$chunk = 4096;
+
+getopts('hn:f:o:');
+
+if ($opt_h || !$opt_f) {
+    usage($ARGV[0]);
+}
+
+if ($opt_n) {
+    $chunk = $opt_n;
+}
+
+open($infile, "<", $opt_f) || die "Couldn't open input file '$opt_f'\n";
+$outfile = STDOUT;
+if ($opt_o) {
+    open($outfile, ">", $opt_o) || die "Couldn't open output file '$opt_o'\n";
+}
+
+# Read the header: weight, number of ids, number of ops, peak bytes
+@header = ();
+while (@header < $hdrlines && defined($line = <$infile>)) {
+    push(@header, split(' ', $line));
+}
+($weight, $num_ids, $num_ops, $data_bytes) = @header;
+if (!defined($data_bytes)) {
+    die "Trace file '$opt_f' has an incomplete header\n";
+}
+
+print $outfile "/* Generated by $0 from $opt_f.  Do not edit. */\n";
+print $outfile "#include <stddef.h>\n";
+print $outfile "#include \"mm.h\"\n";
+print $outfile "#include \"replay.h\"\n\n";
+print $outfile "const char *replay_trace = \"$opt_f\";\n";
+print $outfile "const long replay_num_ops = $num_ops;\n\n";
+printf $outfile "static char *b[%d];\n", $num_ids > 0 ? $num_ids : 1;
+
+# Arena and cache requests name their arena or cache, so size the
+# arrays of arenas and caches up front.  An unused array would trip
+# -Werror, so leave out the ones the trace doesn't need
+@lines = <$infile>;
+$num_arenas = 0;
+$num_caches = 0;
+foreach $line (@lines) {
+    @f = split(' ', $line);
+    shift(@f) while (@f > 0 && $f[0] =~ /^@/);
+    if (@f > 1 && $f[0] =~ /^[NbRD]$/ && $f[1] >= $num_arenas) {
+	$num_arenas = $f[1] + 1;
+    }
+    if (@f > 1 && $f[0] =~ /^[KkxX]$/ && $f[1] >= $num_caches) {
+	$num_caches = $f[1] + 1;
+    }
+}
+if ($num_arenas > 0) {
+    print $outfile "static mm_arena_t *ar[$num_arenas];\n";
+}
+if ($num_caches > 0) {
+    print $outfile "static mm_cache_t *ca[$num_caches];\n";
+}
+
+$nops = 0;
+$nlines = 0;
+$nfuncs = 0;
+$infunc = 0;
+foreach $line (@lines) {
+    last if ($nops >= $num_ops);
+    @f = split(' ', $line);
+    # The @<thread> tags only matter to mdriver -M; the replay is made
+    # on one thread, in trace order
+    shift(@f) while (@f > 0 && $f[0] =~ /^@/);
+    next if (@f == 0);
+    if ($infunc == 0) {
+	if ($nfuncs > 0) {
+	    print $outfile "}\n";
+	}
+	print $outfile "\nstatic void replay_$nfuncs(void)\n{\n";
+	$nfuncs++;
+    }
+    # Line number in the trace file
+    $lineno = $nlines + $hdrlines + 1;
+    $count = 1;
+    if ($f[0] eq "a") {
+	print $outfile "    if (!(b[$f[1]] = mm_malloc($f[2]))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "r") {
+	if ($f[2] == 0) {
+	    print $outfile "    b[$f[1]] = mm_realloc(b[$f[1]], 0);\n";
+	} else {
+	    print $outfile "    if (!(b[$f[1]] = mm_realloc(b[$f[1]], $f[2]))) replay_fail($lineno);\n";
+	}
+    } elsif ($f[0] eq "f") {
+	if ($f[1] < 0) {
+	    print $outfile "    mm_free(NULL);\n";
+	} else {
+	    print $outfile "    mm_free(b[$f[1]]);\n";
+	}
+    } elsif ($f[0] eq "m") {
+	print $outfile "    if (!(b[$f[1]] = mm_memalign($f[3], $f[2]))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "N") {
+	print $outfile "    if (!(ar[$f[1]] = mm_arena_create(0))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "b") {
+	print $outfile "    if (!(b[$f[2]] = mm_arena_alloc(ar[$f[1]], $f[3]))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "R") {
+	print $outfile "    mm_arena_reset(ar[$f[1]]);\n";
+    } elsif ($f[0] eq "D") {
+	print $outfile "    mm_arena_destroy(ar[$f[1]]);\n";
+    } elsif ($f[0] eq "K") {
+	print $outfile "    if (!(ca[$f[1]] = mm_cache_create($f[2], $f[3]))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "k") {
+	print $outfile "    if (!(b[$f[2]] = mm_cache_alloc(ca[$f[1]]))) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "x") {
+	print $outfile "    mm_cache_free(ca[$f[1]], b[$f[2]]);\n";
+    } elsif ($f[0] eq "X") {
+	print $outfile "    mm_cache_destroy(ca[$f[1]]);\n";
+    } elsif ($f[0] eq "A") {
+	$count = $f[2];
+	print $outfile "    if (mm_malloc_batch($f[3], $count, (void **) &b[$f[1]]) != $count) replay_fail($lineno);\n";
+    } elsif ($f[0] eq "F") {
+	$count = $f[2];
+	print $outfile "    mm_free_batch((void **) &b[$f[1]], $count);\n";
+    } else {
+	die "Bogus type character ($f[0]) in tracefile $opt_f\n";
+    }
+    # A batch counts as one op per object, as in the trace header
+    $nops += $count;
+    $nlines++;
+    $infunc += $count;
+    if ($infunc >= $chunk) {
+	$infunc = 0;
+    }
+}
+if ($nfuncs > 0) {
+    print $outfile "}\n";
+}
+
+print $outfile "\nvoid replay_run(void)\n{\n";
+for ($i = 0; $i < $nfuncs; $i++) {
+    print $outfile "    replay_$i();\n";
+}
+print $outfile "}\n";
@@ -0,0 +1,63 @@
+/*
+ * replay.c - Throughput harness for traces compiled by rep2c.pl
+ *
+ * mdriver interprets a trace: every request is dispatched on its type and
+ * its operands are loaded from the trace arrays.  For short requests that
+ * interpretation is a noticeable fraction of the measured time.  Here the
+ * trace has been compiled into straight-line calls, so the time measured
+ * is the allocator's own.
+ *
+ *     unix> make replay TRACE=traces/syn-array-short.rep
+ *     unix> ./replay
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "fsecs.h"
+#include "replay.h"
+
+int verbose = 0;  /* read by the timing package */
+
+/*
+ * replay_once - run the compiled trace on a fresh heap.  Timed by fsecs.
+ */
+static void replay_once(void *arg)
+{
+    mem_reset_brk();
+    if (!mm_init()) {
+        fprintf(stderr, "mm_init failed\n");
+        exit(1);
+    }
+    replay_run();
+}
+
+/*
+ * replay_fail - called by the compiled trace when a request fails
+ */
+void replay_fail(int lineno)
+{
+    printf("ERROR [trace %s, line %d]: allocation failed\n",
+           replay_trace, lineno);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    setbuf(stdout, 0);
+    mem_init(false);
+    init_fsecs();
+
+    /* One untimed run so that the heap's pages are mapped */
+    replay_once(NULL);
+
+    double secs = fsecs(replay_once, NULL);
+    printf("%8ld ops %10.3f msecs %7.0f Kops  %s\n",
+           replay_num_ops, secs * 1000.0,
+           (replay_num_ops * 1e-3) / secs, replay_trace);
+
+    mem_deinit();
+    return 0;
+}
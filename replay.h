@@ -0,0 +1,14 @@
+/*
+ * replay.h - Interface between replay.c and the code rep2c.pl generates
+ *     from a trace file
+ */
+
+/* Name and length of the compiled trace */
+extern const char *replay_trace;
+extern const long replay_num_ops;
+
+/* Perform every request of the trace, in order */
+void replay_run(void);
+
+/* Report an allocator failure at trace line lineno and exit */
+void replay_fail(int lineno);